@@ -0,0 +1,91 @@
+#include <benchmark/benchmark.h>
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Producer-side latency and end-to-end throughput of Logger::log.
+// Each iteration starts a logger, has every producer thread log its share of kMessages, and destroys the logger,
+// which waits until everything is in the file. Iteration time is therefore end-to-end; the latency of every
+// single log() call is recorded as well and reported as percentiles, in nanoseconds.
+//
+// Arguments: producer threads, message bytes, load (0 steady: one message per kSteadyGap per thread; 1 bursty:
+// kBurst messages back to back, then a kBurstPause rest) and per_thread (LoggerOptions::per_thread).
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMessages {20000};
+constexpr auto kSteadyGap {std::chrono::microseconds {2}};
+constexpr int kBurst {256};
+constexpr auto kBurstPause {std::chrono::microseconds {500}};
+
+static void Produce(Logger& logger, const std::string& message, int count, bool bursty, std::vector<uint64_t>& out) {
+    auto next {Clock::now()};
+    for (int i {0}; i < count; ++i) {
+        if (bursty) {
+            if (i > 0 && i % kBurst == 0) {
+                std::this_thread::sleep_for(kBurstPause);
+            }
+        } else {
+            next += kSteadyGap;
+            while (Clock::now() < next) {
+            }
+        }
+        auto start {Clock::now()};
+        logger.log(message);
+        out.push_back(std::chrono::nanoseconds {Clock::now() - start}.count());
+    }
+}
+
+static void BM_LoggerLog(benchmark::State& state) {
+    const auto threads {static_cast<int>(state.range(0))};
+    const std::string message(state.range(1) - 1, 'x');  // The newline makes up the last byte.
+    const bool bursty {state.range(2) != 0};
+    const LoggerOptions options {.per_thread = state.range(3) != 0};
+    const std::string path {(std::filesystem::temp_directory_path() / "logger_bench.log").string()};
+    const int per_thread {kMessages / threads};
+
+    std::vector<std::vector<uint64_t>> latencies(threads);
+    for (auto _ : state) {
+        std::remove(path.c_str());
+        {
+            Logger logger {path, options};
+            std::vector<std::thread> producers;
+            for (int t {0}; t < threads; ++t) {
+                producers.emplace_back(Produce, std::ref(logger), std::cref(message), per_thread, bursty,
+                                       std::ref(latencies[t]));
+            }
+            for (auto& producer : producers) {
+                producer.join();
+            }
+        }
+    }
+    std::remove(path.c_str());
+
+    std::vector<uint64_t> all;
+    for (auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    auto percentile = [&all](double p) {
+        auto nth {all.begin() + static_cast<size_t>(p * (all.size() - 1))};
+        std::nth_element(all.begin(), nth, all.end());
+        return static_cast<double>(*nth);
+    };
+    state.counters["p50_ns"] = percentile(0.50);
+    state.counters["p99_ns"] = percentile(0.99);
+    state.counters["p99.9_ns"] = percentile(0.999);
+    state.counters["max_ns"] = static_cast<double>(*std::max_element(all.begin(), all.end()));
+    state.SetItemsProcessed(state.iterations() * per_thread * threads);
+    state.SetBytesProcessed(state.iterations() * per_thread * threads * state.range(1));
+}
+
+BENCHMARK(BM_LoggerLog)
+    ->ArgNames({"threads", "bytes", "bursty", "per_thread"})
+    ->ArgsProduct({{1, 4, 16, 64}, {16, 256, 4096}, {0, 1}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,125 @@
+#include <benchmark/benchmark.h>
+#include "scalable_watchdog.hpp"
+#include "watchdog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <random>
+#include <vector>
+
+// Detection latency, monitor CPU cost and feed cost of ScalableWatchdog as the number of tasks grows, and the cost
+// of Watchdog::feed, interval histogram included.
+// Arguments: tasks and shards (ScalableWatchdogOptions::shards).
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kThresholdMs {300};
+constexpr uint32_t kFeedThresholdMs {10000};  // Long enough for a pass over a million tasks.
+
+static double ProcessCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Registers every task at once and lets them all starve. Latency is from a task's deadline to its miss reaching
+// the handler; cpu_ns_per_task is the process CPU time from the last registration until the last miss, which is
+// the monitors' (the main thread is blocked), divided by the number of tasks.
+static void BM_ScalableWatchdogDetect(benchmark::State& state) {
+    const auto tasks {static_cast<uint32_t>(state.range(0))};
+    const auto shards {static_cast<uint32_t>(state.range(1))};
+
+    std::vector<int64_t> deadlines(tasks + shards);
+    std::vector<int64_t> latencies;
+    latencies.reserve(tasks);
+    double register_ns {0};
+    double cpu_ns {0};
+    for (auto _ : state) {
+        latencies.clear();
+        std::mutex mtx;
+        std::condition_variable done;
+        auto on_miss = [&](TaskHandle id, std::chrono::milliseconds) {
+            int64_t now {Clock::now().time_since_epoch().count()};
+            std::lock_guard<std::mutex> lock {mtx};
+            if (latencies.size() < tasks) {
+                latencies.push_back(now - deadlines[uint32_t(id)]);
+                if (latencies.size() == tasks) {
+                    done.notify_one();
+                }
+            }
+        };
+        ScalableWatchdog wd {on_miss, {.shards = shards, .tick_ms = 1, .wheel_size = 4096,
+                                       .check_interval_ms = 60000}};
+
+        auto start {Clock::now()};
+        for (uint32_t i {0}; i < tasks; ++i) {
+            auto deadline {Clock::now() + std::chrono::milliseconds {kThresholdMs}};
+            TaskHandle id {wd.registerTask(kThresholdMs)};
+            deadlines[uint32_t(id)] = deadline.time_since_epoch().count();
+        }
+        register_ns += std::chrono::nanoseconds {Clock::now() - start}.count();
+
+        double cpu_start {ProcessCpuNs()};
+        std::unique_lock<std::mutex> lock {mtx};
+        done.wait(lock, [&] { return latencies.size() == tasks; });
+        cpu_ns += ProcessCpuNs() - cpu_start;
+    }
+
+    auto percentile = [&latencies](double p) {
+        auto nth {latencies.begin() + static_cast<size_t>(p * (latencies.size() - 1))};
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        return *nth / 1e6;
+    };
+    state.counters["register_ns"] = register_ns / state.iterations() / tasks;
+    state.counters["cpu_ns_per_task"] = cpu_ns / state.iterations() / tasks;
+    state.counters["p50_ms"] = percentile(0.50);
+    state.counters["p99_ms"] = percentile(0.99);
+    state.counters["max_ms"] = *std::max_element(latencies.begin(), latencies.end()) / 1e6;
+}
+
+// Feeds the tasks in random order while the monitors keep re-filing them.
+static void BM_ScalableWatchdogFeed(benchmark::State& state) {
+    const auto tasks {static_cast<uint32_t>(state.range(0))};
+    std::atomic<uint64_t> missed {0};
+    ScalableWatchdog wd {[&missed](TaskHandle, std::chrono::milliseconds) { missed++; },
+                         {.shards = static_cast<uint32_t>(state.range(1))}};
+    std::vector<TaskHandle> handles(tasks);
+    for (auto& handle : handles) {
+        handle = wd.registerTask(kFeedThresholdMs);
+    }
+    std::shuffle(handles.begin(), handles.end(), std::mt19937 {42});
+
+    size_t i {0};
+    for (auto _ : state) {
+        wd.feed(handles[i]);
+        if (++i == handles.size()) {
+            i = 0;
+        }
+    }
+    state.counters["missed"] = static_cast<double>(missed.load());
+}
+
+BENCHMARK(BM_ScalableWatchdogDetect)
+    ->ArgNames({"tasks", "shards"})
+    ->ArgsProduct({{1000, 10000, 100000, 1000000}, {1, 4}})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_ScalableWatchdogFeed)
+    ->ArgNames({"tasks", "shards"})
+    ->ArgsProduct({{1000, 10000, 100000, 1000000}, {1, 4}});
+
+// One task fed back to back; the monitor only wakes for its deadline.
+static void BM_WatchdogFeed(benchmark::State& state) {
+    Watchdog wd {100};
+    wd.registerTask(1, 60000);
+    for (auto _ : state) {
+        wd.feed(1);
+    }
+}
+
+BENCHMARK(BM_WatchdogFeed);
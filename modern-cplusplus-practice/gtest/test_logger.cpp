@@ -0,0 +1,501 @@
+#include <gtest/gtest.h>
+#include "logger.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+class TestLogger : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path_ = ::testing::TempDir() + "test_logger.log";
+        std::remove(path_.c_str());
+        RemoveSegments();
+    }
+
+    void TearDown() override {
+        std::remove(path_.c_str());
+        RemoveSegments();
+    }
+
+    void RemoveSegments() const {
+        for (uint64_t index : listSegments(path_)) {
+            std::remove(segmentPath(path_, index).c_str());
+        }
+    }
+
+    // StallWriter - Get the writer to sit on a partial batch for a while, so the ring fills up behind it.
+    static void StallWriter(Logger& logger) {
+        logger.log("stall");
+        std::this_thread::sleep_for(std::chrono::milliseconds {20});
+    }
+
+    static std::vector<std::string> SplitLines(const std::string& text) {
+        std::vector<std::string> lines;
+        std::istringstream iss {text};
+        for (std::string line; std::getline(iss, line);) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    std::vector<std::string> ReadLines() const {
+        std::ifstream ifs {path_};
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(ifs, line);) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    std::string path_;
+};
+
+TEST_F(TestLogger, every_entry_written_in_order_per_thread) {
+    const int threads {8};
+    const int per_thread {5000};
+    {
+        Logger logger {path_, LoggerOptions {64}};
+        std::vector<std::thread> producers;
+        for (int t {0}; t < threads; ++t) {
+            producers.emplace_back([&logger, t]() {
+                for (int i {0}; i < per_thread; ++i) {
+                    logger.log(std::to_string(t) + " " + std::to_string(i));
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+    }
+
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), static_cast<size_t>(threads * per_thread));
+    std::vector<int> next(threads, 0);
+    for (auto const& line : lines) {
+        int t {0}, i {0};
+        ASSERT_EQ(sscanf(line.c_str(), "%d %d", &t, &i), 2);
+        EXPECT_EQ(i, next[t]++);
+    }
+}
+
+TEST_F(TestLogger, long_entries_survive) {
+    std::string long_entry(1000, 'x');
+    {
+        Logger logger {path_};
+        logger.log("short");
+        logger.log(long_entry);
+        logger.log("");
+    }
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0], "short");
+    EXPECT_EQ(lines[1], long_entry);
+    EXPECT_EQ(lines[2], "");
+}
+
+TEST_F(TestLogger, logf_formats_on_the_writer) {
+    enum class Color : uint8_t { kRed, kGreen };
+    std::string name {"disk"};
+    {
+        Logger logger {path_};
+        logger.logf("{} {} {}", 1, -2ll, 3u);
+        logger.logf("{:.2f} {} {}", 0.5, 1.5f, true);
+        logger.logf("{} '{}' {}", name, "literal", std::string_view {"view"});
+        logger.logf("{}{}", 'c', static_cast<uint8_t>(Color::kGreen));
+        logger.logf("no arguments");
+        logger.logf(fmt::runtime(name + " {}"), 42);
+        logger.logf("{} {}", std::string(200, 'y'), 7);
+    }
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), 7u);
+    EXPECT_EQ(lines[0], "1 -2 3");
+    EXPECT_EQ(lines[1], "0.50 1.5 true");
+    EXPECT_EQ(lines[2], "disk 'literal' view");
+    EXPECT_EQ(lines[3], "c1");
+    EXPECT_EQ(lines[4], "no arguments");
+    EXPECT_EQ(lines[5], "disk 42");
+    EXPECT_EQ(lines[6], std::string(200, 'y') + " 7");
+}
+
+TEST_F(TestLogger, binary_log_decodes_to_text_log) {
+    auto write = [](Logger& logger) {
+        for (int i {0}; i < 100; ++i) {
+            logger.logf("request {} took {:.3f} ms on {}", i, i * 0.25, i % 2 ? "odd" : "even");
+            logger.log("plain entry");
+        }
+        logger.logf("{}", std::string(300, 'z'));
+    };
+    {
+        Logger logger {path_};
+        write(logger);
+    }
+    auto expected {ReadLines()};
+    std::remove(path_.c_str());
+    {
+        Logger logger {path_, LoggerOptions {.binary = true}};
+        write(logger);
+    }
+
+    std::ifstream ifs {path_, std::ios_base::binary};
+    std::ostringstream decoded;
+    ASSERT_TRUE(decodeBinaryLog(ifs, decoded));
+    EXPECT_EQ(SplitLines(decoded.str()), expected);
+}
+
+TEST_F(TestLogger, truncated_binary_log_is_rejected) {
+    {
+        Logger logger {path_, LoggerOptions {.binary = true}};
+        logger.logf("{} {}", 1, "two");
+    }
+    std::ifstream ifs {path_, std::ios_base::binary};
+    std::string data {std::istreambuf_iterator<char> {ifs}, std::istreambuf_iterator<char> {}};
+    data.pop_back();
+    std::istringstream truncated {data};
+    std::ostringstream decoded;
+    EXPECT_FALSE(decodeBinaryLog(truncated, decoded));
+}
+
+TEST_F(TestLogger, flush_makes_entries_durable) {
+    Logger logger {path_, LoggerOptions {.flush_interval = std::chrono::seconds {10}}};
+    logger.log("first");
+    logger.logf("second {}", 2);
+    logger.flush();
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[1], "second 2");
+    EXPECT_EQ(logger.stats().syncs, 1u);
+}
+
+TEST_F(TestLogger, burst_shares_writes) {
+    const int entries {2000};
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.flush_interval = std::chrono::milliseconds {20}}};
+        for (int i {0}; i < entries; ++i) {
+            logger.logf("entry {}", i);
+        }
+        logger.flush();
+        stats = logger.stats();
+    }
+    EXPECT_EQ(stats.entries, static_cast<uint64_t>(entries));
+    EXPECT_LT(stats.writes, 10u);
+    EXPECT_LT(stats.syscallsPerEntry(), 0.01);
+    EXPECT_EQ(ReadLines().size(), static_cast<size_t>(entries));
+}
+
+TEST_F(TestLogger, size_threshold_splits_batches) {
+    {
+        Logger logger {path_, LoggerOptions {.flush_bytes = 4096, .flush_interval = std::chrono::seconds {10}}};
+        std::string entry(99, 'x');
+        for (int i {0}; i < 1000; ++i) {
+            logger.log(entry);
+        }
+        logger.flush();
+        // 100 KB in batches of at most a page or so.
+        EXPECT_GE(logger.stats().writes, 100000u / 8192);
+    }
+    EXPECT_EQ(ReadLines().size(), 1000u);
+}
+
+TEST_F(TestLogger, segments_rotate_by_size_and_can_be_tailed) {
+    const int entries {5000};
+    LogTail tail {path_};
+    std::string tailed;
+    {
+        Logger logger {path_, LoggerOptions {.segments = {.bytes = 8192}}};
+        for (int i {0}; i < entries; ++i) {
+            logger.logf("segment entry {}", i);
+            if (i % 500 == 0) {
+                tail.read(tailed);
+            }
+        }
+    }
+    tail.read(tailed);
+
+    auto lines {SplitLines(tailed)};
+    ASSERT_EQ(lines.size(), static_cast<size_t>(entries));
+    for (int i {0}; i < entries; ++i) {
+        ASSERT_EQ(lines[i], "segment entry " + std::to_string(i));
+    }
+    // About 100 KB of entries; no entry is split between segments.
+    auto segments {listSegments(path_)};
+    EXPECT_GE(segments.size(), 10u);
+    for (uint64_t index : segments) {
+        auto segment {LogSegment::open(path_, index)};
+        ASSERT_TRUE(segment);
+        uint64_t committed {segment->header()->committed.load()};
+        EXPECT_TRUE(segment->header()->sealed.load());
+        EXPECT_TRUE(committed == 0 || segment->data()[committed - 1] == '\n');
+    }
+}
+
+TEST_F(TestLogger, flush_covers_segments_rotated_out) {
+    // Segments the writer has moved on from are synced by the helper, and flush waits for it: by the time flush
+    // returns, every segment but the active one has been synced, sealed and trimmed.
+    Logger logger {path_, LoggerOptions {.flush_interval = std::chrono::seconds {10}, .segments = {.bytes = 4096}}};
+    for (int i {0}; i < 1000; ++i) {
+        logger.logf("rotated entry {}", i);
+    }
+    logger.flush();
+    auto segments {listSegments(path_)};
+    ASSERT_GE(segments.size(), 4u);
+    segments.pop_back();  // The spare.
+    segments.pop_back();  // The active segment.
+    // One msync for each segment rotated out, and flush's own of the active one.
+    EXPECT_EQ(logger.stats().syncs, segments.size() + 1);
+    for (uint64_t index : segments) {
+        auto segment {LogSegment::open(path_, index)};
+        ASSERT_TRUE(segment);
+        EXPECT_TRUE(segment->header()->sealed.load());
+        EXPECT_EQ(std::filesystem::file_size(segment->path()),
+                  kSegmentHeaderSize + segment->header()->committed.load());
+    }
+}
+
+TEST_F(TestLogger, segments_resume_after_failing_to_make_one) {
+    // Cap the file size so new segments cannot be reserved, as on a full disk, and lift the cap again.
+    rlimit old_limit;
+    ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    auto old_handler {std::signal(SIGXFSZ, SIG_IGN)};
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.flush_interval = std::chrono::seconds {10}, .segments = {.bytes = 4096}}};
+        logger.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds {50});  // Let the helper make the first spare.
+        rlimit limit {old_limit};
+        limit.rlim_cur = 1024;
+        ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &limit), 0);
+        for (int i {0}; i < 1000; ++i) {
+            logger.logf("lost entry {}", i);
+        }
+        logger.flush();
+        ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds {200});
+        logger.log("after the disk has room again");
+        logger.flush();
+        stats = logger.stats();
+    }
+    std::signal(SIGXFSZ, old_handler);
+
+    EXPECT_GT(stats.dropped, 0u);
+    EXPECT_EQ(stats.entries + stats.dropped, 1001u);
+    LogTail tail {path_};
+    std::string text;
+    tail.read(text);
+    auto lines {SplitLines(text)};
+    EXPECT_EQ(lines.size(), stats.entries);
+    ASSERT_FALSE(lines.empty());
+    EXPECT_EQ(lines.back(), "after the disk has room again");
+}
+
+TEST_F(TestLogger, segments_rotate_by_age_and_respect_retention) {
+    {
+        Logger logger {path_, LoggerOptions {.segments = {.bytes = 4096, .max_age = std::chrono::milliseconds {1}}}};
+        for (int i {0}; i < 5; ++i) {
+            logger.log("aged");
+            logger.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds {2});
+        }
+    }
+    EXPECT_GE(listSegments(path_).size(), 5u);
+    RemoveSegments();
+
+    const uint64_t retain {4 * (kSegmentHeaderSize + 4096)};
+    {
+        Logger logger {path_, LoggerOptions {.segments = {.bytes = 4096, .retain_bytes = retain}}};
+        for (int i {0}; i < 5000; ++i) {
+            logger.logf("retained entry {}", i);
+        }
+    }
+    uint64_t total {0};
+    for (uint64_t index : listSegments(path_)) {
+        total += std::filesystem::file_size(segmentPath(path_, index));
+    }
+    EXPECT_LE(total, retain);
+    LogTail tail {path_};
+    std::string text;
+    tail.read(text);
+    EXPECT_EQ(SplitLines(text).back(), "retained entry 4999");
+}
+
+TEST_F(TestLogger, binary_segments_decode_on_their_own) {
+    {
+        Logger logger {path_, LoggerOptions {.binary = true, .segments = {.bytes = 4096}}};
+        for (int i {0}; i < 1000; ++i) {
+            logger.logf("binary entry {} of {}", i, "segments");
+        }
+    }
+    auto segments {listSegments(path_)};
+    ASSERT_GE(segments.size(), 2u);
+    std::vector<std::string> lines;
+    for (uint64_t index : segments) {
+        auto segment {LogSegment::open(path_, index)};
+        ASSERT_TRUE(segment);
+        std::istringstream in {std::string {segment->data(), segment->header()->committed.load()}};
+        std::ostringstream out;
+        ASSERT_TRUE(decodeBinaryLog(in, out));
+        for (auto& line : SplitLines(out.str())) {
+            lines.push_back(line);
+        }
+    }
+    ASSERT_EQ(lines.size(), 1000u);
+    EXPECT_EQ(lines[999], "binary entry 999 of segments");
+}
+
+TEST_F(TestLogger, per_thread_buffers_keep_every_entry) {
+    const int threads {8};
+    const int per_thread {5000};
+    {
+        Logger logger {path_, LoggerOptions {.per_thread = true, .thread_capacity = 64}};
+        std::vector<std::thread> producers;
+        for (int t {0}; t < threads; ++t) {
+            producers.emplace_back([&logger, t]() {
+                for (int i {0}; i < per_thread; ++i) {
+                    logger.logf("{} {}", t, i);
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+    }
+
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), static_cast<size_t>(threads * per_thread));
+    std::vector<int> next(threads, 0);
+    for (auto const& line : lines) {
+        int t {0}, i {0};
+        ASSERT_EQ(sscanf(line.c_str(), "%d %d", &t, &i), 2);
+        EXPECT_EQ(i, next[t]++);
+    }
+}
+
+TEST_F(TestLogger, per_thread_buffers_merge_in_time_order) {
+    // Two threads take turns, so each entry is logged after the one before it on the other thread.
+    const int turns {2000};
+    {
+        Logger logger {path_, LoggerOptions {.per_thread = true}};
+        std::atomic<int> turn {0};
+        auto player = [&](int parity) {
+            for (int i {parity}; i < turns; i += 2) {
+                while (turn.load() != i) {
+                    std::this_thread::yield();
+                }
+                logger.logf("{}", i);
+                turn.store(i + 1);
+            }
+        };
+        std::thread even {player, 0};
+        std::thread odd {player, 1};
+        even.join();
+        odd.join();
+    }
+
+    auto lines {ReadLines()};
+    ASSERT_EQ(lines.size(), static_cast<size_t>(turns));
+    for (int i {0}; i < turns; ++i) {
+        ASSERT_EQ(lines[i], std::to_string(i));
+    }
+}
+
+TEST_F(TestLogger, per_thread_buffers_of_exited_threads_are_reclaimed) {
+    Logger logger {path_, LoggerOptions {.per_thread = true, .thread_capacity = 16}};
+    for (int t {0}; t < 50; ++t) {
+        std::thread {[&logger, t]() { logger.logf("thread {}", t); }}.join();
+    }
+    logger.flush();
+    logger.flush();
+    EXPECT_EQ(logger.stats().thread_buffers, 1u);
+    EXPECT_EQ(ReadLines().size(), 50u);
+}
+
+TEST_F(TestLogger, drop_newest_keeps_the_queue_bounded) {
+    const int entries {1000};
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.capacity = 64, .overflow = OverflowPolicy::kDropNewest,
+                                             .flush_interval = std::chrono::milliseconds {100}}};
+        StallWriter(logger);
+        for (int i {0}; i < entries; ++i) {
+            logger.logf("entry {}", i);
+        }
+        stats = logger.stats();
+        EXPECT_LE(stats.enqueued - stats.entries, 64u);
+    }
+    EXPECT_GE(stats.dropped, static_cast<uint64_t>(entries - 64));
+    EXPECT_EQ(stats.enqueued + stats.dropped, static_cast<uint64_t>(entries + 1));
+    auto lines {ReadLines()};
+    EXPECT_EQ(lines.size(), entries + 1 - stats.dropped);
+    EXPECT_EQ(lines[1], "entry 0");
+}
+
+TEST_F(TestLogger, drop_oldest_keeps_the_latest_entries) {
+    const int entries {1000};
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.capacity = 64, .overflow = OverflowPolicy::kDropOldest,
+                                             .flush_interval = std::chrono::milliseconds {100}}};
+        StallWriter(logger);
+        for (int i {0}; i < entries; ++i) {
+            logger.log(i % 10 ? "entry " + std::to_string(i) : std::string(300, 'h'));  // Some on the heap.
+        }
+        logger.flush();
+        stats = logger.stats();
+    }
+    EXPECT_GE(stats.dropped, static_cast<uint64_t>(entries - 64));
+    EXPECT_EQ(stats.entries + stats.dropped, static_cast<uint64_t>(entries + 1));
+    EXPECT_EQ(ReadLines().back(), "entry 999");
+}
+
+TEST_F(TestLogger, sampling_keeps_important_entries) {
+    const int entries {1000};
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.capacity = 64, .overflow = OverflowPolicy::kSampleByLevel,
+                                             .sample_every = 10, .flush_interval = std::chrono::milliseconds {5}}};
+        StallWriter(logger);
+        for (int i {0}; i < entries; ++i) {
+            if (i % 100 == 0) {
+                logger.logf(LogLevel::kError, "error {}", i);
+            } else {
+                logger.logf(LogLevel::kDebug, "debug {}", i);
+            }
+        }
+        stats = logger.stats();
+    }
+    auto lines {ReadLines()};
+    int errors {0};
+    for (auto const& line : lines) {
+        errors += line.rfind("error", 0) == 0;
+    }
+    EXPECT_EQ(errors, entries / 100);
+    EXPECT_GT(stats.dropped, 0u);
+    EXPECT_EQ(lines.size(), entries + 1 - stats.dropped);
+}
+
+TEST_F(TestLogger, stats_track_depth_and_write_time) {
+    LoggerStats stats;
+    {
+        Logger logger {path_, LoggerOptions {.capacity = 256, .flush_interval = std::chrono::milliseconds {50}}};
+        StallWriter(logger);
+        for (int i {0}; i < 200; ++i) {
+            logger.logf("entry {}", i);
+        }
+        logger.flush();
+        stats = logger.stats();
+    }
+    EXPECT_EQ(stats.enqueued, 201u);
+    EXPECT_EQ(stats.entries, 201u);
+    EXPECT_EQ(stats.dropped, 0u);
+    EXPECT_GE(stats.high_water, 100u);
+    EXPECT_GT(stats.write_ns, 0u);
+    EXPECT_GE(stats.write_ns, stats.max_write_ns);
+}
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include "scalable_watchdog.hpp"
+
+#include <set>
+
+class TestScalableWatchdog : public ::testing::Test {
+protected:
+    ScalableWatchdog::MissHandler Record() {
+        return [this](TaskHandle id, std::chrono::milliseconds overdue) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            missed_.push_back({id, overdue});
+        };
+    }
+
+    std::vector<std::pair<TaskHandle, std::chrono::milliseconds>> Missed() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return missed_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<std::pair<TaskHandle, std::chrono::milliseconds>> missed_;
+};
+
+TEST_F(TestScalableWatchdog, reports_only_the_starved_task) {
+    ScalableWatchdog wd(Record(), {.shards = 4, .tick_ms = 5});
+    std::vector<TaskHandle> tasks;
+    for (int i = 0; i < 10000; i++) {
+        tasks.push_back(wd.registerTask(200));
+    }
+    EXPECT_EQ(wd.size(), 10000u);
+    EXPECT_EQ(std::set<TaskHandle>(tasks.begin(), tasks.end()).size(), tasks.size());
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (std::chrono::steady_clock::now() < end) {
+        for (size_t i = 1; i < tasks.size(); i++) {
+            wd.feed(tasks[i]);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    auto missed = Missed();
+    ASSERT_FALSE(missed.empty());
+    for (auto& [id, overdue] : missed) {
+        EXPECT_EQ(id, tasks[0]);
+    }
+}
+
+TEST_F(TestScalableWatchdog, detects_a_miss_within_a_few_ticks) {
+    ScalableWatchdog wd(Record(), {.shards = 2, .tick_ms = 5, .check_interval_ms = 10000});
+    wd.registerTask(50);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto missed = Missed();
+    ASSERT_EQ(missed.size(), 1u);
+    EXPECT_LT(missed[0].second.count(), 50);
+}
+
+TEST_F(TestScalableWatchdog, unregistered_handle_goes_stale) {
+    ScalableWatchdog wd(Record(), {.shards = 1, .tick_ms = 5});
+    TaskHandle id = wd.registerTask(20);
+    EXPECT_TRUE(wd.unregisterTask(id));
+    EXPECT_FALSE(wd.unregisterTask(id));
+    EXPECT_FALSE(wd.unregisterTask(kNoTask));
+    wd.feed(id);
+    wd.feed(kNoTask);
+    EXPECT_EQ(wd.size(), 0u);
+
+    // The slot is reused under a new handle.
+    TaskHandle reused = wd.registerTask(1000);
+    EXPECT_NE(reused, id);
+    EXPECT_EQ(uint32_t(reused), uint32_t(id));
+    EXPECT_FALSE(wd.unregisterTask(id));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(Missed().empty());
+}
+
+TEST_F(TestScalableWatchdog, full_shard_refuses_tasks) {
+    ScalableWatchdog wd(Record(), {.shards = 2, .max_tasks = 4});
+    for (int i = 0; i < 4; i++) {
+        EXPECT_NE(wd.registerTask(1000), kNoTask);
+    }
+    EXPECT_EQ(wd.registerTask(1000), kNoTask);
+}
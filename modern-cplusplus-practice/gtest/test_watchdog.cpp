@@ -48,3 +48,199 @@ TEST_F(TestWatchdog, v1) {
     std::this_thread::sleep_for(std::chrono::seconds(2));
     std::cout << "Main finished." << std::endl;
 }
+
+TEST_F(TestWatchdog, detects_miss_without_waiting_for_poll) {
+    // The check interval only paces repeated reports; a miss shows up when the deadline passes.
+    testing::internal::CaptureStdout();
+    {
+        Watchdog wd(10000);
+        wd.registerTask(1, 50);
+        wd.registerTask(2, 1000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_NE(output.find("feed not received in time!"), std::string::npos);
+    EXPECT_EQ(output.find("feed not received", output.find("feed not received") + 1), std::string::npos);
+}
+
+TEST_F(TestWatchdog, zero_check_interval_does_not_stall_the_monitor) {
+    // A missed task is reported again on every pass; the monitor must still let go of the lock in between.
+    testing::internal::CaptureStdout();
+    auto start = std::chrono::steady_clock::now();
+    {
+        Watchdog wd(0);
+        wd.registerTask(1, 10);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        wd.registerTask(2, 10);
+        wd.feedStats(1);
+    }
+    testing::internal::GetCapturedStdout();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST_F(TestWatchdog, fed_task_is_not_reported) {
+    testing::internal::CaptureStdout();
+    {
+        Watchdog wd(10);
+        wd.registerTask(1, 100);
+        for (int i = 0; i < 20; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            wd.feed(1);
+        }
+    }
+    std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_EQ(output.find("feed not received"), std::string::npos);
+}
+
+TEST_F(TestWatchdog, concurrent_feeds_do_not_block_or_print) {
+    testing::internal::CaptureStdout();
+    {
+        Watchdog wd(10);
+        for (TaskID id = 0; id < 8; id++) {
+            wd.registerTask(id, 500);
+        }
+        std::vector<std::thread> feeders;
+        for (TaskID id = 0; id < 8; id++) {
+            feeders.emplace_back([&wd, id]() {
+                auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+                while (std::chrono::steady_clock::now() < end) {
+                    wd.feed(id);
+                    wd.feed(id + 100);  // Not registered: ignored.
+                }
+            });
+        }
+        for (auto& feeder : feeders) {
+            feeder.join();
+        }
+    }
+    std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_EQ(output, "");
+}
+
+TEST_F(TestWatchdog, dependency_cycles_are_rejected) {
+    Watchdog wd(100);
+    EXPECT_TRUE(wd.addDependency(2, 1));
+    EXPECT_TRUE(wd.addDependency(3, 2));
+    EXPECT_FALSE(wd.addDependency(1, 3));
+    EXPECT_FALSE(wd.addDependency(1, 1));
+    EXPECT_TRUE(wd.addDependency(3, 1));
+}
+
+static size_t count(const std::string& output, const std::string& text) {
+    size_t n = 0;
+    for (size_t pos = output.find(text); pos != std::string::npos; pos = output.find(text, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+TEST_F(TestWatchdog, root_cause_is_reported_once) {
+    testing::internal::CaptureStdout();
+    {
+        Watchdog wd(10000);
+        wd.registerTask(1, 50);
+        wd.registerTask(2, 50);
+        wd.registerTask(3, 50);
+        wd.registerTask(4, 50);
+        wd.addDependency(2, 1);
+        wd.addDependency(3, 1);
+        wd.addDependency(4, 2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_EQ(count(output, "Dependency violation"), 1u);
+    EXPECT_NE(output.find("Dependency violation: Task 1 is stale"), std::string::npos);
+    EXPECT_EQ(count(output, "feed not received in time!"), 1u);
+    EXPECT_EQ(count(output, "(dependency check)!"), 3u);
+}
+
+TEST_F(TestWatchdog, slow_recovery_does_not_hold_up_detection) {
+    testing::internal::CaptureStdout();
+    std::atomic<int> calls(0);
+    {
+        Watchdog wd(10000);
+        wd.onTimeout(1, [&calls](TaskID) {
+            calls++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        });
+        wd.registerTask(1, 20);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ASSERT_EQ(calls.load(), 1);
+
+        // The handler is still running.
+        auto start = std::chrono::steady_clock::now();
+        wd.registerTask(2, 20);
+        wd.feed(1);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_NE(testing::internal::GetCapturedStdout().find("Task 2 feed not received in time!"), std::string::npos);
+    }
+    EXPECT_EQ(calls.load(), 1);
+}
+
+TEST_F(TestWatchdog, recovery_is_rate_limited) {
+    std::atomic<int> calls(0);
+    {
+        Watchdog wd(10);
+        wd.onTimeout(1, [&calls](TaskID) { calls++; }, 100);
+        testing::internal::CaptureStdout();
+        wd.registerTask(1, 20);
+        std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    }
+    testing::internal::GetCapturedStdout();
+    EXPECT_GE(calls.load(), 2);
+    EXPECT_LE(calls.load(), 4);
+}
+
+TEST_F(TestWatchdog, dependency_violation_names_the_root) {
+    std::atomic<int> timeouts(0);
+    std::atomic<int> violations(0);
+    std::atomic<int> root(-1);
+    {
+        Watchdog wd(10000);
+        wd.addDependency(3, 2);
+        wd.addDependency(2, 1);
+        wd.onTimeout(3, [&timeouts](TaskID) { timeouts++; });
+        wd.onDependencyViolation(3, [&violations, &root](TaskID, TaskID r) {
+            violations++;
+            root = r;
+        });
+        testing::internal::CaptureStdout();
+        wd.registerTask(1, 20);
+        wd.registerTask(2, 20);
+        wd.registerTask(3, 20);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    testing::internal::GetCapturedStdout();
+    EXPECT_EQ(timeouts.load(), 0);
+    EXPECT_EQ(violations.load(), 1);
+    EXPECT_EQ(root.load(), 1);
+}
+
+TEST_F(TestWatchdog, histogram_buckets_are_within_an_eighth) {
+    for (uint64_t us : {0ull, 1ull, 7ull, 8ull, 15ull, 100ull, 12345ull, 999999ull, 4000000000ull}) {
+        uint64_t middle = FeedHistogram::middleOf(FeedHistogram::bucketOf(us));
+        EXPECT_LE(std::llabs(int64_t(middle) - int64_t(us)), int64_t(us / 8 + 1)) << us;
+    }
+    EXPECT_EQ(FeedHistogram::bucketOf(UINT64_MAX), FeedHistogram::kBuckets - 1);
+}
+
+TEST_F(TestWatchdog, feed_stats_track_the_interval) {
+    Watchdog wd(100);
+    wd.registerTask(1, 100);
+    for (int i = 0; i < 20; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        wd.feed(1);
+    }
+    FeedStats stats = wd.feedStats(1);
+    EXPECT_EQ(stats.count, 20u);
+    EXPECT_GE(stats.p50, std::chrono::milliseconds(9));
+    EXPECT_LE(stats.p50, std::chrono::milliseconds(15));
+    EXPECT_LE(stats.p50, stats.p99);
+    EXPECT_LE(stats.p99, stats.max);
+    EXPECT_GT(stats.headroom, 0.0);
+    EXPECT_LT(stats.headroom, 0.95);
+
+    wd.registerTask(1, 100);
+    EXPECT_EQ(wd.feedStats(1).count, 0u);
+}
@@ -0,0 +1,144 @@
+#ifndef BATCH_WRITER_HPP
+#define BATCH_WRITER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log_sink.hpp"
+
+// BatchWriter - Appends to a file in batches.
+// Data is staged in a page-aligned buffer and handed to the kernel with one write(2) per commit(), so a burst of
+// entries costs one syscall instead of one per entry. Data too large for the buffer is written straight from where
+// it is, along with whatever is staged, with a single writev(2).
+class BatchWriter : public LogSink {
+public:
+    static constexpr size_t kAlignment {4096};
+
+    // capacity is rounded up to a whole number of pages.
+    BatchWriter(const std::string& path, size_t capacity)
+    : capacity_((std::max(capacity, size_t {1}) + kAlignment - 1) / kAlignment * kAlignment),
+      buffer_(static_cast<char*>(std::aligned_alloc(kAlignment, capacity_))) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd_ >= 0 && ::fstat(fd_, &st) == 0) {
+            size_ = static_cast<uint64_t>(st.st_size);
+        }
+    }
+
+    ~BatchWriter() override {
+        commit();
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    BatchWriter(const BatchWriter& src) = delete;
+    BatchWriter& operator=(const BatchWriter& rhs) = delete;
+
+    bool is_open() const override { return fd_ >= 0; }
+    uint64_t size() const override { return size_ + pending_; }
+    size_t pending() const override { return pending_; }
+    std::chrono::steady_clock::time_point staged_since() const override { return staged_since_; }
+
+    // reserve - Entries all go to the one file; append() makes room as it goes.
+    void reserve(size_t) override {}
+
+    using LogSink::append;
+    void append(const char* data, size_t size) override {
+        if (size > capacity_ - pending_) {
+            if (size >= capacity_) {
+                iovec iov[2] {{buffer_.get(), pending_}, {const_cast<char*>(data), size}};
+                WriteAll(iov, 2);
+                return;
+            }
+            commit();
+        }
+        if (pending_ == 0) {
+            staged_since_ = std::chrono::steady_clock::now();
+        }
+        memcpy(buffer_.get() + pending_, data, size);
+        pending_ += size;
+    }
+
+    // commit - Write out everything staged.
+    void commit() override {
+        if (pending_ > 0) {
+            iovec iov {buffer_.get(), pending_};
+            WriteAll(&iov, 1);
+        }
+    }
+
+    // sync - Commit, then wait until the file data is on stable storage.
+    void sync() override {
+        commit();
+        if (fd_ >= 0) {
+            auto start {std::chrono::steady_clock::now()};
+            ::fdatasync(fd_);
+            syncs_.fetch_add(1, std::memory_order_relaxed);
+            Waited(start);
+        }
+    }
+
+private:
+    struct Free {
+        void operator()(char* p) const { std::free(p); }
+    };
+
+    // WriteAll - Write out iov, resuming after short writes; empties the buffer either way. A failed write is
+    // reported and the data dropped, so a full disk does not stop the logger.
+    void WriteAll(iovec* iov, int count) {
+        uint64_t total {0};
+        for (int i {0}; i < count; ++i) {
+            total += iov[i].iov_len;
+        }
+        pending_ = 0;
+        if (fd_ < 0) {
+            return;
+        }
+        auto start {std::chrono::steady_clock::now()};
+        while (total > 0) {
+            ssize_t n {::writev(fd_, iov, count)};
+            writes_.fetch_add(1, std::memory_order_relaxed);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Failed to write logfile: " << strerror(errno) << std::endl;
+                break;
+            }
+            size_ += n;
+            total -= n;
+            for (auto left {static_cast<size_t>(n)}; left > 0;) {
+                size_t step {std::min(left, iov->iov_len)};
+                iov->iov_base = static_cast<char*>(iov->iov_base) + step;
+                iov->iov_len -= step;
+                left -= step;
+                if (iov->iov_len == 0) {
+                    ++iov;
+                    --count;
+                }
+            }
+        }
+        Waited(start);
+    }
+
+    int fd_ {-1};
+    size_t capacity_;
+    std::unique_ptr<char, Free> buffer_;
+    size_t pending_ {0};
+    uint64_t size_ {0};
+    std::chrono::steady_clock::time_point staged_since_;
+};
+
+#endif // BATCH_WRITER_HPP
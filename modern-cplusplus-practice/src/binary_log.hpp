@@ -0,0 +1,200 @@
+#ifndef BINARY_LOG_HPP
+#define BINARY_LOG_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <fmt/args.h>
+#include <fmt/format.h>
+
+// Arguments of a deferred log entry travel as raw bytes, each described by a one-byte type code: numbers as their
+// native little-endian representation, strings as a uint32_t length and the characters. The same encoding is
+// used in the logger's ring and in binary log files, so the writer can copy arguments straight through.
+
+enum class LogArgType : uint8_t {
+    kBool, kChar, kI8, kI16, kI32, kI64, kU8, kU16, kU32, kU64, kF32, kF64, kString,
+};
+
+template <typename T>
+constexpr bool isLogString = std::is_same_v<T, const char*> || std::is_same_v<T, char*> ||
+                             std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>;
+
+// logArgType - The type code T travels as. Enums travel as their underlying type.
+template <typename T>
+constexpr LogArgType logArgType() {
+    if constexpr (std::is_enum_v<T>) {
+        return logArgType<std::underlying_type_t<T>>();
+    } else if constexpr (isLogString<T>) {
+        return LogArgType::kString;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return LogArgType::kBool;
+    } else if constexpr (std::is_same_v<T, char>) {
+        return LogArgType::kChar;
+    } else if constexpr (std::is_integral_v<T>) {
+        constexpr LogArgType kSigned[] = {LogArgType::kI8, LogArgType::kI16, LogArgType::kI32, LogArgType::kI64};
+        constexpr LogArgType kUnsigned[] = {LogArgType::kU8, LogArgType::kU16, LogArgType::kU32, LogArgType::kU64};
+        constexpr int index {sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3};
+        return std::is_signed_v<T> ? kSigned[index] : kUnsigned[index];
+    } else if constexpr (std::is_same_v<T, float>) {
+        return LogArgType::kF32;
+    } else if constexpr (std::is_same_v<T, double>) {
+        return LogArgType::kF64;
+    } else {
+        static_assert(sizeof(T) == 0, "logf arguments must be numbers, enums, chars or strings");
+    }
+}
+
+inline std::string_view logArgString(std::string_view s) { return s; }
+inline std::string_view logArgString(const char* s) { return s ? std::string_view {s} : std::string_view {"(null)"}; }
+
+// logArgSize - Bytes v takes once encoded.
+template <typename T>
+size_t logArgSize(const T& v) {
+    if constexpr (isLogString<T>) {
+        return sizeof(uint32_t) + logArgString(v).size();
+    } else {
+        return sizeof(T);
+    }
+}
+
+// encodeLogArg - Write v at p; returns the end of it.
+template <typename T>
+char* encodeLogArg(char* p, const T& v) {
+    if constexpr (isLogString<T>) {
+        std::string_view s {logArgString(v)};
+        auto size {static_cast<uint32_t>(s.size())};
+        memcpy(p, &size, sizeof(size));
+        memcpy(p + sizeof(size), s.data(), s.size());
+        return p + sizeof(size) + s.size();
+    } else {
+        memcpy(p, &v, sizeof(T));
+        return p + sizeof(T);
+    }
+}
+
+// readLogValue - Copy a T from p, advancing p. Returns false if fewer than sizeof(T) bytes are left.
+template <typename T>
+bool readLogValue(const char*& p, const char* end, T& value) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+        return false;
+    }
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+template <typename T>
+bool decodeLogArg(const char*& p, const char* end, fmt::dynamic_format_arg_store<fmt::format_context>& store) {
+    T value {};
+    if (!readLogValue(p, end, value)) {
+        return false;
+    }
+    store.push_back(value);
+    return true;
+}
+
+// decodeLogArgs - Read n arguments of the given types from [p, end) into store. Strings are stored as views of
+// the input. Returns the end of the arguments, or nullptr if they run past end or a type is unknown.
+inline const char* decodeLogArgs(const uint8_t* types, size_t n, const char* p, const char* end,
+                                 fmt::dynamic_format_arg_store<fmt::format_context>& store) {
+    for (size_t i {0}; i < n; ++i) {
+        bool ok {false};
+        switch (static_cast<LogArgType>(types[i])) {
+        case LogArgType::kBool: ok = decodeLogArg<bool>(p, end, store); break;
+        case LogArgType::kChar: ok = decodeLogArg<char>(p, end, store); break;
+        case LogArgType::kI8: ok = decodeLogArg<int8_t>(p, end, store); break;
+        case LogArgType::kI16: ok = decodeLogArg<int16_t>(p, end, store); break;
+        case LogArgType::kI32: ok = decodeLogArg<int32_t>(p, end, store); break;
+        case LogArgType::kI64: ok = decodeLogArg<int64_t>(p, end, store); break;
+        case LogArgType::kU8: ok = decodeLogArg<uint8_t>(p, end, store); break;
+        case LogArgType::kU16: ok = decodeLogArg<uint16_t>(p, end, store); break;
+        case LogArgType::kU32: ok = decodeLogArg<uint32_t>(p, end, store); break;
+        case LogArgType::kU64: ok = decodeLogArg<uint64_t>(p, end, store); break;
+        case LogArgType::kF32: ok = decodeLogArg<float>(p, end, store); break;
+        case LogArgType::kF64: ok = decodeLogArg<double>(p, end, store); break;
+        case LogArgType::kString: {
+            uint32_t size {0};
+            ok = readLogValue(p, end, size) && static_cast<size_t>(end - p) >= size;
+            if (ok) {
+                store.push_back(fmt::string_view {p, size});
+                p += size;
+            }
+            break;
+        }
+        }
+        if (!ok) {
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+// Binary log files: the magic, then records, each starting with a BinaryLogRecord tag.
+//   kFormatRecord  uint32_t id, uint32_t size, format string        (before the first entry using it)
+//   kEntryRecord   uint32_t id, uint8_t n, n type codes, arguments
+//   kTextRecord    uint32_t size, text                              (entries logged already formatted)
+constexpr char kBinaryLogMagic[8] = {'K', 'L', 'O', 'G', 'B', 'I', 'N', '1'};
+
+enum BinaryLogRecord : uint8_t { kFormatRecord = 1, kEntryRecord = 2, kTextRecord = 3 };
+
+// decodeBinaryLog - Write the entries of a binary log to out as text lines. Returns false if the log is
+// malformed, after writing the entries before the damage.
+inline bool decodeBinaryLog(std::istream& in, std::ostream& out) {
+    std::string data {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+    if (data.size() < sizeof(kBinaryLogMagic) || memcmp(data.data(), kBinaryLogMagic, sizeof(kBinaryLogMagic)) != 0) {
+        return false;
+    }
+    const char* p {data.data() + sizeof(kBinaryLogMagic)};
+    const char* end {data.data() + data.size()};
+    auto take = [&p, end](auto& value) { return readLogValue(p, end, value); };
+
+    std::unordered_map<uint32_t, std::string_view> formats;
+    fmt::memory_buffer line;
+    while (p != end) {
+        uint8_t tag {0};
+        uint32_t id {0}, size {0};
+        take(tag);
+        if (tag == kFormatRecord) {
+            if (!take(id) || !take(size) || static_cast<size_t>(end - p) < size) {
+                return false;
+            }
+            formats[id] = std::string_view {p, size};
+            p += size;
+        } else if (tag == kEntryRecord) {
+            uint8_t n {0};
+            if (!take(id) || !take(n) || static_cast<size_t>(end - p) < n || !formats.count(id)) {
+                return false;
+            }
+            auto types {reinterpret_cast<const uint8_t*>(p)};
+            fmt::dynamic_format_arg_store<fmt::format_context> store;
+            p = decodeLogArgs(types, n, p + n, end, store);
+            if (!p) {
+                return false;
+            }
+            line.clear();
+            try {
+                fmt::vformat_to(std::back_inserter(line), formats[id], store);
+            } catch (const fmt::format_error&) {
+                return false;
+            }
+            out.write(line.data(), line.size()).put('\n');
+        } else if (tag == kTextRecord) {
+            if (!take(size) || static_cast<size_t>(end - p) < size) {
+                return false;
+            }
+            out.write(p, size).put('\n');
+            p += size;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // BINARY_LOG_HPP
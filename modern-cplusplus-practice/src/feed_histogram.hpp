@@ -0,0 +1,107 @@
+#ifndef FEED_HISTOGRAM_HPP
+#define FEED_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram of intervals in microseconds, up to about 71 minutes.
+// Each power of two is split into kSubBuckets equal buckets, so a value is known to within 1/kSubBuckets of
+// itself. record() is a couple of relaxed atomic operations and may be called from any thread; readers see a
+// snapshot that may be mid-update.
+class FeedHistogram {
+public:
+    static constexpr unsigned kSubBits = 3;
+    static constexpr uint64_t kSubBuckets = 1u << kSubBits;
+    static constexpr size_t kBuckets = (32 - kSubBits + 1) * kSubBuckets;
+
+    void record(uint64_t us) {
+        counts_[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+        if (us > max_.load(std::memory_order_relaxed)) {
+            max_.store(us, std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (auto& count : counts_) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (auto& count : counts_) {
+            total += count.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // percentile - The value below which fraction p of the recorded values fall, or 0 if there are none.
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(std::ceil(p * total));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kBuckets; b++) {
+            seen += counts_[b].load(std::memory_order_relaxed);
+            if (seen >= rank && seen > 0) {
+                return std::min(middleOf(b), max());
+            }
+        }
+        return max();
+    }
+
+    // stddev - Standard deviation of the recorded values, taking each as the middle of its bucket.
+    double stddev() const {
+        double n = 0;
+        double sum = 0;
+        double squares = 0;
+        for (size_t b = 0; b < kBuckets; b++) {
+            double count = counts_[b].load(std::memory_order_relaxed);
+            double value = middleOf(b);
+            n += count;
+            sum += count * value;
+            squares += count * value * value;
+        }
+        if (n < 2) {
+            return 0;
+        }
+        double mean = sum / n;
+        return std::sqrt(std::max(0.0, squares / n - mean * mean));
+    }
+
+    static size_t bucketOf(uint64_t us) {
+        if (us < kSubBuckets) {
+            return us;
+        }
+        if (us > UINT32_MAX) {
+            us = UINT32_MAX;
+        }
+        unsigned msb = std::bit_width(us) - 1;
+        return (msb - kSubBits + 1) * kSubBuckets + ((us >> (msb - kSubBits)) & (kSubBuckets - 1));
+    }
+
+    static uint64_t middleOf(size_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        unsigned shift = bucket / kSubBuckets - 1;
+        uint64_t low = (kSubBuckets + bucket % kSubBuckets) << shift;
+        return low + ((uint64_t(1) << shift) >> 1);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> counts_ {};  // 32 bits would wrap within weeks at 1 kHz.
+    std::atomic<uint64_t> max_ {0};
+};
+
+#endif // FEED_HISTOGRAM_HPP
@@ -0,0 +1,471 @@
+#ifndef LOG_SEGMENT_HPP
+#define LOG_SEGMENT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/format.h>
+
+#include "log_sink.hpp"
+
+// A segmented log is a series of files path.000001, path.000002, ... Each is created at its full size and mapped
+// into memory, so appending to it is a memcpy. A header at the front of each segment tells readers how much of it
+// is committed and whether the writer has moved on to the next segment; readers map the same file and follow
+// these two words, without locks or syscalls.
+
+struct SegmentOptions {
+    // Data bytes per segment. Zero writes one plain file instead of segments.
+    size_t bytes {0};
+    // Move on to a new segment once the current one is this old. Zero rotates by size only.
+    std::chrono::milliseconds max_age {0};
+    // Delete the oldest segments once all of them, counting the active and spare ones, take more than this.
+    // Zero keeps everything.
+    uint64_t retain_bytes {0};
+};
+
+struct SegmentHeader {
+    char magic[8];
+    std::atomic<uint64_t> committed;  // Data bytes readers may read.
+    std::atomic<uint32_t> sealed;     // Nothing more will be written here; go on to the next segment.
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "segment headers are shared between processes");
+
+constexpr char kSegmentMagic[8] = {'K', 'L', 'O', 'G', 'S', 'E', 'G', '1'};
+constexpr size_t kSegmentHeaderSize {64};
+
+inline std::string segmentPath(const std::string& path, uint64_t index) {
+    return fmt::format("{}.{:06}", path, index);
+}
+
+// listSegments - Indices of the segments of path on disk, oldest first.
+inline std::vector<uint64_t> listSegments(const std::string& path) {
+    namespace fs = std::filesystem;
+    fs::path base {path};
+    fs::path dir {base.has_parent_path() ? base.parent_path() : fs::path {"."}};
+    std::string prefix {base.filename().string() + "."};
+    std::vector<uint64_t> indices;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator {dir, ec}) {
+        std::string name {entry.path().filename().string()};
+        if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+            name.find_first_not_of("0123456789", prefix.size()) == std::string::npos) {
+            indices.push_back(std::stoull(name.substr(prefix.size())));
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    return indices;
+}
+
+// LogSegment - One segment file, mapped.
+class LogSegment {
+public:
+    // create - Make segment index of path with room for bytes of data. Returns nullptr if that fails.
+    static std::unique_ptr<LogSegment> create(const std::string& path, uint64_t index, size_t bytes) {
+        std::unique_ptr<LogSegment> segment {new LogSegment {segmentPath(path, index), index}};
+        segment->fd_ = ::open(segment->path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (segment->fd_ < 0) {
+            return nullptr;
+        }
+        // Reserve the blocks up front, so a full disk shows up here rather than as SIGBUS in the middle of a copy.
+        // Only a file system that cannot reserve them gets a sparse file instead; any other error, ENOSPC above
+        // all, fails.
+        segment->length_ = kSegmentHeaderSize + bytes;
+        int err {::posix_fallocate(segment->fd_, 0, segment->length_)};
+        if (err == EOPNOTSUPP || err == EINVAL) {
+            err = ::ftruncate(segment->fd_, segment->length_) == 0 ? 0 : errno;
+        }
+        if (err != 0 || !segment->Map(PROT_READ | PROT_WRITE)) {
+            ::unlink(segment->path_.c_str());
+            return nullptr;
+        }
+        memcpy(segment->header()->magic, kSegmentMagic, sizeof(kSegmentMagic));
+        return segment;
+    }
+
+    // open - Map an existing segment for reading, or for writing to seal it. Returns nullptr if it is not one.
+    static std::unique_ptr<LogSegment> open(const std::string& path, uint64_t index, bool writable = false) {
+        std::unique_ptr<LogSegment> segment {new LogSegment {segmentPath(path, index), index}};
+        segment->fd_ = ::open(segment->path_.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+        struct stat st;
+        if (segment->fd_ < 0 || ::fstat(segment->fd_, &st) != 0 ||
+            static_cast<size_t>(st.st_size) < kSegmentHeaderSize) {
+            return nullptr;
+        }
+        segment->length_ = st.st_size;
+        if (!segment->Map(writable ? PROT_READ | PROT_WRITE : PROT_READ) ||
+            memcmp(segment->header()->magic, kSegmentMagic, sizeof(kSegmentMagic)) != 0) {
+            return nullptr;
+        }
+        return segment;
+    }
+
+    ~LogSegment() {
+        if (base_ != MAP_FAILED) {
+            ::munmap(base_, length_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    LogSegment(const LogSegment& src) = delete;
+    LogSegment& operator=(const LogSegment& rhs) = delete;
+
+    const std::string& path() const { return path_; }
+    uint64_t index() const { return index_; }
+    size_t capacity() const { return length_ - kSegmentHeaderSize; }
+    SegmentHeader* header() const { return static_cast<SegmentHeader*>(base_); }
+    char* data() const { return static_cast<char*>(base_) + kSegmentHeaderSize; }
+
+    // sync - Write the first bytes of data and the header back to disk.
+    void sync(size_t bytes) { ::msync(base_, kSegmentHeaderSize + bytes, MS_SYNC); }
+
+    // seal - Tell readers nothing more is coming and give back the disk space past the committed data.
+    // Returns the size the file is left with.
+    uint64_t seal() {
+        header()->sealed.store(1, std::memory_order_release);
+        uint64_t size {kSegmentHeaderSize + header()->committed.load(std::memory_order_relaxed)};
+        if (::ftruncate(fd_, size) != 0) {
+            return length_;
+        }
+        return size;
+    }
+
+private:
+    LogSegment(std::string path, uint64_t index) : path_(std::move(path)), index_(index) {}
+
+    bool Map(int prot) {
+        base_ = ::mmap(nullptr, length_, prot, MAP_SHARED, fd_, 0);
+        return base_ != MAP_FAILED;
+    }
+
+    std::string path_;
+    uint64_t index_;
+    int fd_ {-1};
+    size_t length_ {0};
+    void* base_ {MAP_FAILED};
+};
+
+// SegmentWriter - Appends to a segmented log.
+// When the active segment runs out of room or gets too old, the writer swaps in a spare segment that a helper
+// thread has already created and mapped, so the writer never waits on file creation. The helper then seals and
+// trims the old segment, makes the next spare and deletes segments past the retention cap.
+class SegmentWriter : public LogSink {
+public:
+    SegmentWriter(const std::string& path, SegmentOptions options)
+    : path_(path), options_(options) {
+        uint64_t last {0};
+        for (uint64_t index : listSegments(path_)) {
+            // Whoever wrote these is gone; make sure readers do not wait on them.
+            if (auto segment {LogSegment::open(path_, index, true)}) {
+                uint64_t size {segment->header()->sealed.load() ? segment->capacity() + kSegmentHeaderSize :
+                                                                  segment->seal()};
+                sealed_.emplace_back(segment->path(), size);
+            }
+            last = index;
+        }
+        next_index_ = last + 1;
+        active_ = LogSegment::create(path_, next_index_++, options_.bytes);
+        opened_ = std::chrono::steady_clock::now();
+        helper_ = std::thread {&SegmentWriter::Helper, this};
+    }
+
+    ~SegmentWriter() override {
+        commit();
+        {
+            std::lock_guard<std::mutex> lock {mtx_};
+            stop_ = true;
+        }
+        cv_.notify_all();
+        helper_.join();
+        for (auto& segment : retired_) {
+            segment->seal();
+        }
+        if (active_) {
+            active_->seal();
+        }
+        if (spare_) {
+            ::unlink(spare_->path().c_str());
+        }
+    }
+
+    bool is_open() const override { return active_ != nullptr; }
+    uint64_t size() const override { return used_; }
+    size_t pending() const override { return used_ - committed_; }
+    std::chrono::steady_clock::time_point staged_since() const override { return staged_since_; }
+
+    // reserve - Start a new segment if the entry would not fit in this one, or this one has got too old.
+    // Entries larger than a whole segment are split across segments. Without a segment, the entry is lost.
+    void reserve(size_t size) override {
+        entry_lost_ = false;
+        if (active_ && used_ > 0 && (size > active_->capacity() - used_ || Expired())) {
+            Rotate();
+        }
+        if (!active_ && !Resume()) {
+            Lost();
+        }
+    }
+
+    using LogSink::append;
+    void append(const char* data, size_t size) override {
+        if (pending() == 0 && size > 0) {
+            staged_since_ = std::chrono::steady_clock::now();
+        }
+        while (active_ && size > 0) {
+            if (used_ == active_->capacity()) {
+                Rotate();
+                continue;
+            }
+            size_t n {std::min(size, active_->capacity() - used_)};
+            memcpy(active_->data() + used_, data, n);
+            used_ += n;
+            data += n;
+            size -= n;
+        }
+        if (size > 0) {
+            Lost();
+        }
+    }
+
+    // commit - Publish the staged bytes to readers, and move on if the segment has got too old.
+    void commit() override {
+        if (!active_) {
+            return;
+        }
+        Publish();
+        if (used_ > 0 && Expired()) {
+            Rotate();
+        }
+    }
+
+    // sync - Make everything appended so far durable, including what went into segments that have been rotated
+    // out since and that the helper syncs before sealing them.
+    void sync() override {
+        auto start {std::chrono::steady_clock::now()};
+        if (active_) {
+            Publish();
+            active_->sync(used_);
+        }
+        {
+            std::unique_lock<std::mutex> lock {mtx_};
+            cv_.wait(lock, [this]() { return unsynced_ == 0; });
+        }
+        syncs_.fetch_add(1, std::memory_order_relaxed);
+        Waited(start);
+    }
+
+private:
+    bool Expired() const {
+        return options_.max_age.count() > 0 && std::chrono::steady_clock::now() - opened_ >= options_.max_age;
+    }
+
+    // Lost - Count the current entry as dropped, once.
+    void Lost() {
+        if (!entry_lost_) {
+            entry_lost_ = true;
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Resume - Carry on in the spare, if the helper has managed to make one since the writer ran out.
+    bool Resume() {
+        std::unique_lock<std::mutex> lock {mtx_};
+        if (!spare_) {
+            return false;
+        }
+        active_ = std::move(spare_);
+        lock.unlock();
+        cv_.notify_all();
+        used_ = 0;
+        committed_ = 0;
+        opened_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void Publish() {
+        committed_ = used_;
+        active_->header()->committed.store(used_, std::memory_order_release);
+    }
+
+    void Rotate() {
+        Publish();
+        // Seal right away so readers move on; trimming the file is left to the helper.
+        active_->header()->sealed.store(1, std::memory_order_release);
+        std::unique_lock<std::mutex> lock {mtx_};
+        // Only waits if segments fill faster than the helper can create them.
+        if (!spare_ && !spare_failed_) {
+            auto start {std::chrono::steady_clock::now()};
+            cv_.wait(lock, [this]() { return spare_ || spare_failed_; });
+            Waited(start);
+        }
+        retired_.push_back(std::move(active_));
+        ++unsynced_;
+        active_ = std::move(spare_);
+        lock.unlock();
+        cv_.notify_all();
+
+        if (!active_) {
+            std::cerr << "Failed to create log segment; dropping entries until one can be made." << std::endl;
+        }
+        used_ = 0;
+        committed_ = 0;
+        opened_ = std::chrono::steady_clock::now();
+    }
+
+    // Helper - After failing to make a spare, as on a full disk, try again after a delay that doubles up to a second.
+    void Helper() {
+        std::unique_lock<std::mutex> lock {mtx_};
+        std::chrono::milliseconds retry_delay {0};
+        std::chrono::steady_clock::time_point retry_at;
+        while (true) {
+            if (spare_failed_) {
+                cv_.wait_until(lock, retry_at, [this]() { return stop_ || !retired_.empty(); });
+            } else {
+                cv_.wait(lock, [this]() { return stop_ || !spare_ || !retired_.empty(); });
+            }
+            if (stop_) {
+                break;
+            }
+            auto retired {std::move(retired_)};
+            retired_.clear();
+            bool need_spare {!spare_ && (!spare_failed_ || std::chrono::steady_clock::now() >= retry_at)};
+            lock.unlock();
+
+            for (auto& segment : retired) {
+                segment->sync(segment->header()->committed.load(std::memory_order_relaxed));
+                syncs_.fetch_add(1, std::memory_order_relaxed);
+                sealed_.emplace_back(segment->path(), segment->seal());
+            }
+            size_t synced {retired.size()};
+            retired.clear();
+            std::unique_ptr<LogSegment> spare;
+            if (need_spare) {
+                spare = LogSegment::create(path_, next_index_, options_.bytes);
+                next_index_ += spare != nullptr;
+            }
+            Retain();
+
+            lock.lock();
+            if (synced > 0) {
+                unsynced_ -= synced;
+                cv_.notify_all();
+            }
+            if (need_spare) {
+                spare_failed_ = !spare;
+                spare_ = std::move(spare);
+                cv_.notify_all();
+                retry_delay = spare_failed_ ? std::clamp(2 * retry_delay, std::chrono::milliseconds {10},
+                                                         std::chrono::milliseconds {1000})
+                                            : std::chrono::milliseconds {0};
+                retry_at = std::chrono::steady_clock::now() + retry_delay;
+            }
+        }
+    }
+
+    // Retain - Delete the oldest sealed segments while everything takes more than retain_bytes. Helper only.
+    void Retain() {
+        if (options_.retain_bytes == 0) {
+            return;
+        }
+        uint64_t total {2 * (kSegmentHeaderSize + options_.bytes)};  // The active and spare segments.
+        for (const auto& [path, size] : sealed_) {
+            total += size;
+        }
+        while (total > options_.retain_bytes && !sealed_.empty()) {
+            ::unlink(sealed_.front().first.c_str());
+            total -= sealed_.front().second;
+            sealed_.pop_front();
+        }
+    }
+
+    std::string path_;
+    SegmentOptions options_;
+
+    // Writer thread only.
+    std::unique_ptr<LogSegment> active_;
+    size_t used_ {0};
+    size_t committed_ {0};
+    std::chrono::steady_clock::time_point opened_;
+    std::chrono::steady_clock::time_point staged_since_;
+    bool entry_lost_ {false};  // The current entry has been counted as dropped.
+
+    // Handed between the writer and the helper under mtx_.
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unique_ptr<LogSegment> spare_;
+    bool spare_failed_ {false};  // The last attempt failed; the helper tries again after a delay.
+    std::vector<std::unique_ptr<LogSegment>> retired_;
+    size_t unsynced_ {0};  // Segments rotated out that the helper has not synced and sealed yet.
+    bool stop_ {false};
+
+    // Helper thread only, once it is running.
+    uint64_t next_index_ {1};
+    std::deque<std::pair<std::string, uint64_t>> sealed_;  // Path and size on disk, oldest first.
+
+    std::thread helper_;
+};
+
+// LogTail - Follows a segmented log as it is written, from the oldest segment on disk.
+// Reads the segment headers the writer publishes, so it takes no locks and never blocks the writer.
+class LogTail {
+public:
+    explicit LogTail(const std::string& path) : path_(path) {}
+
+    // read - Append to out the bytes committed since the last call. Returns how many.
+    size_t read(std::string& out) {
+        size_t total {0};
+        while (segment_ || Next()) {
+            SegmentHeader* header {segment_->header()};
+            // Check sealed first: once it is set, committed is final.
+            bool sealed {header->sealed.load(std::memory_order_acquire) != 0};
+            uint64_t committed {header->committed.load(std::memory_order_acquire)};
+            out.append(segment_->data() + offset_, committed - offset_);
+            total += committed - offset_;
+            offset_ = committed;
+            if (!sealed || !Next()) {
+                break;
+            }
+        }
+        return total;
+    }
+
+private:
+    // Next - Open the segment after the current one, or the oldest if there is none yet. A reader that fell
+    // behind the retention cap skips to the oldest segment left.
+    bool Next() {
+        for (uint64_t index : listSegments(path_)) {
+            if (segment_ && index <= segment_->index()) {
+                continue;
+            }
+            if (auto next {LogSegment::open(path_, index)}) {
+                segment_ = std::move(next);
+                offset_ = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string path_;
+    std::unique_ptr<LogSegment> segment_;
+    uint64_t offset_ {0};
+};
+
+#endif // LOG_SEGMENT_HPP
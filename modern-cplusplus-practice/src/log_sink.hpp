@@ -0,0 +1,58 @@
+#ifndef LOG_SINK_HPP
+#define LOG_SINK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// LogSink - Where Logger's background thread puts entries.
+// Entries are staged with append() and become visible to readers on commit(); sync() also makes them durable.
+// Only the writer thread may call these, except for the counters.
+class LogSink {
+public:
+    virtual ~LogSink() = default;
+
+    virtual bool is_open() const = 0;
+    // size - Bytes in the file currently being written, counting what is still staged.
+    virtual uint64_t size() const = 0;
+    // pending - Bytes staged and not committed yet.
+    virtual size_t pending() const = 0;
+    // staged_since - When the oldest staged byte was appended. Only meaningful while pending() > 0.
+    virtual std::chrono::steady_clock::time_point staged_since() const = 0;
+
+    // reserve - Announce an entry of size bytes, so a sink that moves on to new files can do so before it rather
+    // than in the middle of it.
+    virtual void reserve(size_t size) = 0;
+    virtual void append(const char* data, size_t size) = 0;
+    void append(std::string_view data) { append(data.data(), data.size()); }
+    virtual void commit() = 0;
+    virtual void sync() = 0;
+
+    uint64_t writes() const { return writes_.load(std::memory_order_relaxed); }
+    uint64_t syncs() const { return syncs_.load(std::memory_order_relaxed); }
+    // dropped - Entries lost because there was nowhere to put them, such as after failing to make a new file.
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    // write_ns, max_write_ns - Total and longest time spent waiting on the file.
+    uint64_t write_ns() const { return write_ns_.load(std::memory_order_relaxed); }
+    uint64_t max_write_ns() const { return max_write_ns_.load(std::memory_order_relaxed); }
+
+protected:
+    // Waited - Account for a wait that started at since.
+    void Waited(std::chrono::steady_clock::time_point since) {
+        auto ns {static_cast<uint64_t>(std::chrono::nanoseconds {std::chrono::steady_clock::now() - since}.count())};
+        write_ns_.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > max_write_ns_.load(std::memory_order_relaxed)) {
+            max_write_ns_.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> writes_ {0};
+    std::atomic<uint64_t> syncs_ {0};
+    std::atomic<uint64_t> dropped_ {0};
+    std::atomic<uint64_t> write_ns_ {0};
+    std::atomic<uint64_t> max_write_ns_ {0};
+};
+
+#endif // LOG_SINK_HPP
@@ -1,5 +1,405 @@
 #include "logger.hpp"
 
-Logger::Logger() {
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+static std::atomic<uint64_t> next_logger_id {1};
+
+// ThreadBuffers - The buffers this thread has been given, by logger id. Closes them when the thread exits.
+struct Logger::ThreadBuffers {
+    ~ThreadBuffers() {
+        for (auto& [id, buffer] : list) {
+            buffer->closed.store(true, std::memory_order_release);
+        }
+    }
+
+    std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>> list;
+    // The last one looked up, so a thread logging to one logger finds its buffer straight away.
+    uint64_t last_id {0};
+    ThreadBuffer* last {nullptr};
+};
+
+Logger::Logger(const std::string& path, LoggerOptions options)
+: id_(next_logger_id.fetch_add(1)), path_(path), options_(options), ring_(options.capacity) {
+    if (options_.segments.bytes > 0) {
+        out_ = std::make_unique<SegmentWriter>(path_, options_.segments);
+    } else {
+        out_ = std::make_unique<BatchWriter>(path_, options_.flush_bytes);
+    }
+    if (!out_->is_open()) {
+        // Keep draining anyway, so producers never block on a full ring.
+        std::cerr << "Failed to open logfile." << std::endl;
+    } else {
+        BeginEntry(0);
+    }
     thread_ = std::thread {&Logger::ProcessEntries, this};
-}
\ No newline at end of file
+}
+
+Logger::~Logger() {
+    exit_.store(true);
+    WakeWriter();
+    thread_.join();
+}
+
+void Logger::log(LogLevel level, std::string_view entry) {
+    // Allocate before claiming a slot: the writer cannot get past a claimed slot until it is filled.
+    std::string* heap {entry.size() > Ring::kPayloadSize ? new std::string {entry} : nullptr};
+    bool pushed {Push(level, [entry, heap](auto& slot) {
+        if (heap) {
+            slot.kind = kHeap;
+            slot.size = sizeof(heap);
+            memcpy(slot.data, &heap, sizeof(heap));
+        } else {
+            slot.kind = kInline;
+            slot.size = static_cast<uint32_t>(entry.size());
+            memcpy(slot.data, entry.data(), entry.size());
+        }
+    })};
+    if (!pushed) {
+        delete heap;
+    }
+}
+
+void Logger::flush() {
+    uint64_t ticket {flush_tickets_.fetch_add(1) + 1};
+    Push(
+        LogLevel::kError,
+        [ticket](auto& slot) {
+            slot.kind = kFlush;
+            slot.size = sizeof(ticket);
+            memcpy(slot.data, &ticket, sizeof(ticket));
+        },
+        false);
+    for (uint64_t synced {synced_.load(std::memory_order_acquire)}; synced < ticket;
+         synced = synced_.load(std::memory_order_acquire)) {
+        synced_.wait(synced, std::memory_order_acquire);
+    }
+}
+
+LoggerStats Logger::stats() const {
+    LoggerStats stats;
+    // Entries the file had no room for count as dropped rather than written.
+    uint64_t lost {out_->dropped()};
+    stats.entries = entries_.load(std::memory_order_relaxed) - lost;
+    stats.dropped = rejected_.load(std::memory_order_relaxed) + evicted_.load(std::memory_order_relaxed) + lost;
+    stats.high_water = high_water_.load(std::memory_order_relaxed);
+    stats.writes = out_->writes();
+    stats.syncs = out_->syncs();
+    stats.write_ns = out_->write_ns();
+    stats.max_write_ns = out_->max_write_ns();
+    stats.thread_buffers = thread_buffers_.load(std::memory_order_relaxed);
+
+    uint64_t queued {0};
+    if (options_.per_thread) {
+        std::lock_guard<std::mutex> lock {registry_mtx_};
+        for (const auto& buffer : registry_) {
+            queued += buffer->ring.size();
+        }
+    } else {
+        queued = ring_.size();
+    }
+    stats.enqueued = stats.entries + lost + evicted_.load(std::memory_order_relaxed) + queued;
+    return stats;
+}
+
+Logger::Overflow Logger::OnFull(LogLevel level, bool droppable) {
+    if (!droppable) {
+        return Overflow::kWait;
+    }
+    switch (options_.overflow) {
+    case OverflowPolicy::kBlock:
+        return Overflow::kWait;
+    case OverflowPolicy::kDropOldest:
+        if (!options_.per_thread) {
+            if (ring_.tryPop([this](const Ring::Slot& slot) { Discard(slot.kind, slot.data); })) {
+                return Overflow::kRetry;
+            }
+            // The oldest entry is still being filled in; let its producer finish.
+            return Overflow::kWait;
+        }
+        break;
+    case OverflowPolicy::kSampleByLevel:
+        if (level >= options_.keep_level ||
+            overflows_.fetch_add(1, std::memory_order_relaxed) % std::max(options_.sample_every, 1u) == 0) {
+            return Overflow::kWait;
+        }
+        break;
+    case OverflowPolicy::kDropNewest:
+        break;
+    }
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return Overflow::kDrop;
+}
+
+void Logger::Discard(uint8_t kind, const char* data) {
+    if (kind == kHeap) {
+        std::string* entry;
+        memcpy(&entry, data, sizeof(entry));
+        delete entry;
+    } else if (kind == kFlush) {
+        // Everything queued before the marker has been taken by the writer already; have it sync for the flush.
+        uint64_t ticket;
+        memcpy(&ticket, data, sizeof(ticket));
+        for (uint64_t pending {pending_flush_.load()};
+             pending < ticket && !pending_flush_.compare_exchange_weak(pending, ticket);) {
+        }
+        return;
+    }
+    evicted_.fetch_add(1, std::memory_order_relaxed);
+}
+
+Logger::ThreadBuffer& Logger::LocalBuffer() {
+    thread_local ThreadBuffers buffers;
+    if (buffers.last_id == id_) {
+        return *buffers.last;
+    }
+
+    auto it {std::find_if(buffers.list.begin(), buffers.list.end(), [this](const auto& entry) { return entry.first == id_; })};
+    if (it == buffers.list.end()) {
+        // Forget buffers of loggers that are gone, then register a new one.
+        std::erase_if(buffers.list, [](const auto& entry) { return entry.second.use_count() == 1; });
+        auto buffer {std::make_shared<ThreadBuffer>(options_.thread_capacity)};
+        {
+            std::lock_guard<std::mutex> lock {registry_mtx_};
+            registry_.push_back(buffer);
+            registry_version_.fetch_add(1, std::memory_order_release);
+            thread_buffers_.store(registry_.size(), std::memory_order_relaxed);
+        }
+        it = buffers.list.emplace(buffers.list.end(), id_, std::move(buffer));
+    }
+    buffers.last_id = id_;
+    buffers.last = it->second.get();
+    return *buffers.last;
+}
+
+void Logger::WakeWriter() {
+    // Pairs with the fence in ProcessEntries: either the writer sees our entry before it sleeps, or we see it
+    // sleeping and wake it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        sleeping_.store(false, std::memory_order_relaxed);
+        wakeups_.fetch_add(1, std::memory_order_release);
+        wakeups_.notify_one();
+    }
+}
+
+void Logger::ProcessEntries() {
+    while (true) {
+        if (ProcessEntriesHelper()) {
+            continue;
+        }
+        if (uint64_t ticket {pending_flush_.load()}; ticket > synced_.load(std::memory_order_relaxed)) {
+            out_->sync();
+            Synced(ticket);
+        }
+        if (exit_.load() && Empty()) {
+            break;
+        }
+
+        if (out_->pending() > 0) {
+            // Group commit: give entries still trickling in a chance to share the write.
+            auto deadline {out_->staged_since() + options_.flush_interval};
+            if (std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_until(deadline);
+                continue;
+            }
+            out_->commit();
+        }
+        uint32_t epoch {wakeups_.load(std::memory_order_acquire)};
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!Empty() || exit_.load()) {
+            sleeping_.store(false, std::memory_order_relaxed);
+            if (options_.per_thread) {
+                // Entries can be held back behind a thread that is mid-push; let it finish.
+                std::this_thread::yield();
+            }
+            continue;
+        }
+        wakeups_.wait(epoch, std::memory_order_acquire);
+    }
+    out_->commit();
+}
+
+bool Logger::ProcessEntriesHelper() {
+    if (options_.per_thread) {
+        return DrainThreadBuffers();
+    }
+    NoteDepth(ring_.size());
+    bool wrote {false};
+    while (ring_.tryPop([this](const Ring::Slot& slot) { WriteEntry(slot.kind, slot.data, slot.size); })) {
+        wrote = true;
+        if (out_->pending() >= options_.flush_bytes) {
+            out_->commit();
+        }
+    }
+    return wrote;
+}
+
+bool Logger::DrainThreadBuffers() {
+    if (registry_version_.load(std::memory_order_acquire) != buffers_version_) {
+        std::lock_guard<std::mutex> lock {registry_mtx_};
+        buffers_ = registry_;
+        buffers_version_ = registry_version_.load(std::memory_order_relaxed);
+    }
+
+    // Merge the buffers by stamp. Whatever a thread pushes from now on is stamped later than now, because it
+    // raises busy before reading the clock; so an entry no later than now can be written once every thread that
+    // is mid-push is known to be stamping something later still. A busy thread with entries queued is, since
+    // the merge takes the earliest head first; a busy thread with none is stamping no earlier than its last.
+    uint64_t depth {0};
+    for (auto& buffer : buffers_) {
+        depth += buffer->ring.size();
+    }
+    NoteDepth(depth);
+
+    auto now {static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())};
+    bool wrote {false};
+    while (true) {
+        ThreadBuffer* next {nullptr};
+        const SpscRing<128>::Slot* next_slot {nullptr};
+        uint64_t limit {now};
+        for (auto& buffer : buffers_) {
+            // busy first: if it is clear, everything the thread pushed before clearing it is visible below.
+            bool busy {buffer->busy.load()};
+            const auto* slot {buffer->ring.front()};
+            if (!slot) {
+                if (busy) {
+                    limit = std::min(limit, buffer->last_stamp);
+                }
+            } else if (!next_slot || slot->stamp < next_slot->stamp) {
+                next = buffer.get();
+                next_slot = slot;
+            }
+        }
+        if (!next_slot || next_slot->stamp > limit) {
+            break;
+        }
+        WriteEntry(next_slot->kind, next_slot->data, next_slot->size);
+        next->last_stamp = next_slot->stamp;
+        next->ring.pop();
+        wrote = true;
+        if (out_->pending() >= options_.flush_bytes) {
+            out_->commit();
+        }
+    }
+
+    // Reclaim the buffers of threads that have exited, once drained.
+    auto drained = [](const std::shared_ptr<ThreadBuffer>& buffer) {
+        return buffer->closed.load(std::memory_order_acquire) && !buffer->ring.front();
+    };
+    if (std::any_of(buffers_.begin(), buffers_.end(), drained)) {
+        std::lock_guard<std::mutex> lock {registry_mtx_};
+        std::erase_if(registry_, drained);
+        buffers_ = registry_;
+        buffers_version_ = registry_version_.fetch_add(1, std::memory_order_relaxed) + 1;
+        thread_buffers_.store(registry_.size(), std::memory_order_relaxed);
+    }
+    return wrote;
+}
+
+bool Logger::Empty() {
+    if (!options_.per_thread) {
+        return ring_.empty();
+    }
+    if (registry_version_.load(std::memory_order_acquire) != buffers_version_) {
+        return false;
+    }
+    return std::none_of(buffers_.begin(), buffers_.end(), [](const auto& buffer) { return buffer->ring.front(); });
+}
+
+void Logger::Synced(uint64_t ticket) {
+    // Tickets can reach the ring out of order; everything before a later one is synced too.
+    if (ticket > synced_.load(std::memory_order_relaxed)) {
+        synced_.store(ticket, std::memory_order_release);
+    }
+    synced_.notify_all();
+}
+
+void Logger::NoteDepth(uint64_t depth) {
+    if (depth > high_water_.load(std::memory_order_relaxed)) {
+        high_water_.store(depth, std::memory_order_relaxed);
+    }
+}
+
+void Logger::BeginEntry(size_t size) {
+    if (options_.binary) {
+        size += sizeof(kBinaryLogMagic);
+    }
+    out_->reserve(size);
+    // Every file of a binary log stands on its own: it starts with the magic and repeats the formats it uses.
+    if (options_.binary && out_->size() == 0) {
+        out_->append(kBinaryLogMagic, sizeof(kBinaryLogMagic));
+        format_ids_.clear();
+    }
+}
+
+void Logger::WriteEntry(uint8_t kind, const char* data, uint32_t size) {
+    auto put = [this](const auto& value) {
+        out_->append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    if (kind == kFlush) {
+        uint64_t ticket;
+        memcpy(&ticket, data, sizeof(ticket));
+        out_->sync();
+        Synced(ticket);
+        return;
+    }
+    entries_.fetch_add(1, std::memory_order_relaxed);
+
+    auto record_size = [](size_t bytes) { return sizeof(BinaryLogRecord) + sizeof(uint32_t) + bytes; };
+    std::string_view text;
+    std::unique_ptr<std::string> heap;
+    if (kind == kInline) {
+        text = std::string_view {data, size};
+    } else if (kind == kHeap) {
+        std::string* entry;
+        memcpy(&entry, data, sizeof(entry));
+        heap.reset(entry);
+        text = *heap;
+    } else {
+        const char* format;
+        uint32_t format_size;
+        memcpy(&format, data, sizeof(format));
+        memcpy(&format_size, data + sizeof(format), sizeof(format_size));
+        auto n {static_cast<uint8_t>(data[sizeof(format) + sizeof(format_size)])};
+        const char* types {data + kDeferredHeaderSize};
+        const char* args {types + n};
+        const char* end {data + size};
+
+        if (options_.binary) {
+            BeginEntry(record_size(format_size) + sizeof(uint32_t) + record_size(sizeof(n) + (end - types)));
+            auto [it, added] {format_ids_.emplace(format, static_cast<uint32_t>(format_ids_.size()))};
+            if (added) {
+                put(kFormatRecord);
+                put(it->second);
+                put(format_size);
+                out_->append(format, format_size);
+            }
+            put(kEntryRecord);
+            put(it->second);
+            put(n);
+            out_->append(types, end - types);
+            return;
+        }
+
+        fmt::dynamic_format_arg_store<fmt::format_context> store;
+        decodeLogArgs(reinterpret_cast<const uint8_t*>(types), n, args, end, store);
+        line_.clear();
+        fmt::vformat_to(std::back_inserter(line_), fmt::string_view {format, format_size}, store);
+        text = std::string_view {line_.data(), line_.size()};
+    }
+
+    BeginEntry(options_.binary ? record_size(text.size()) : text.size() + 1);
+    if (options_.binary) {
+        put(kTextRecord);
+        put(static_cast<uint32_t>(text.size()));
+    }
+    out_->append(text);
+    if (!options_.binary) {
+        out_->append("\n", 1);
+    }
+}
@@ -1,25 +1,275 @@
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
-#include <string>
-#include <queue>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <mutex>
-#include <condition_variable>>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+
+#include "batch_writer.hpp"
+#include "binary_log.hpp"
+#include "log_segment.hpp"
+#include "mpsc_ring.hpp"
+#include "spsc_ring.hpp"
+
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarning, kError };
+
+// What log() does when the ring is full.
+enum class OverflowPolicy : uint8_t {
+    kBlock,          // Wait for room.
+    kDropNewest,     // Drop the entry being logged.
+    kDropOldest,     // Drop the oldest queued entry to make room. With per_thread, the same as kDropNewest.
+    kSampleByLevel,  // Wait for entries at keep_level or above; of the rest, wait for one in sample_every and
+                     // drop the others.
+};
+
+struct LoggerOptions {
+    // Entries that can wait to be written before log() blocks; a power of two.
+    size_t capacity {4096};
+    OverflowPolicy overflow {OverflowPolicy::kBlock};
+    LogLevel keep_level {LogLevel::kWarning};
+    uint32_t sample_every {100};
+    // Give each producer thread a buffer of its own instead of sharing one ring, and have the writer merge them
+    // by timestamp. Producers then share no cache lines while the writer keeps up.
+    bool per_thread {false};
+    // Entries each thread's buffer holds when per_thread is set; a power of two.
+    size_t thread_capacity {512};
+    // Write a binary log, to be turned into text by log_decode, instead of formatting entries as text.
+    bool binary {false};
+    // Staged bytes at which the writer issues a write even while entries keep coming.
+    size_t flush_bytes {64 * 1024};
+    // How long the writer may hold a partial batch once the ring runs dry, so that entries trickling in share a
+    // write. Zero writes the batch as soon as the ring is empty.
+    std::chrono::microseconds flush_interval {0};
+    // Write path.000001, path.000002, ... as memory-mapped segments instead of appending to path. See LogTail
+    // for following them as they are written.
+    SegmentOptions segments {};
+};
 
+struct LoggerStats {
+    uint64_t enqueued {0};        // Entries queued: written, dropped from the queue, or still in it.
+    uint64_t entries {0};         // Entries handed to the file.
+    uint64_t dropped {0};         // Entries lost to the overflow policy, or for want of a file to write them to.
+    uint64_t high_water {0};      // The most entries the writer has found queued at once.
+    uint64_t writes {0};          // write(2)/writev(2) calls; none for segments.
+    uint64_t syncs {0};           // fdatasync(2) and msync(2) calls.
+    uint64_t write_ns {0};        // Time the writer spent waiting on those calls and on new segments.
+    uint64_t max_write_ns {0};    // The longest single wait.
+    uint64_t thread_buffers {0};  // Per-thread buffers in use.
+
+    double syscallsPerEntry() const { return entries ? static_cast<double>(writes + syncs) / entries : 0.0; }
+};
+
+// Logger - Appends entries to a file from a background thread.
+// Producers copy each entry into a slot of a bounded lock-free ring; entries too long for a slot are moved to
+// the heap and the slot carries the pointer. With per_thread, each producer thread gets a ring of its own instead.
+// The background thread drains the ring into a LogSink, batching a burst of entries into one write, and sleeps
+// while the ring is empty. Producers only pay for waking it when it is actually asleep. The ring is bounded, so a
+// stalled disk costs no memory; what happens once it fills is up to the OverflowPolicy.
 class Logger {
 public:
-    Logger();
+    explicit Logger(const std::string& path = "log.txt", LoggerOptions options = {});
+    ~Logger();
     Logger(const Logger& src) = delete;
     Logger& operator=(const Logger& rhs) = delete;
-    void log(std::string entry);
+
+    // log - Queue one line. Only blocks while the ring is full, depending on the overflow policy.
+    void log(std::string_view entry) { log(LogLevel::kInfo, entry); }
+    void log(LogLevel level, std::string_view entry);
+
+    // logf - Queue the line fmt::format(format, args...), formatted later by the background thread. Only the
+    // address of the format string and the raw arguments are copied, so format must outlive the logger, as a
+    // string literal does. Entries whose arguments do not fit in a slot are formatted right away.
+    template <typename... Args>
+    void logf(fmt::format_string<Args...> format, Args&&... args) {
+        logf(LogLevel::kInfo, format, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    void logf(LogLevel level, fmt::format_string<Args...> format, Args&&... args);
+
+    // logf - A format string only known at run time is formatted right away.
+    template <typename... Args>
+    void logf(fmt::basic_runtime<char> format, Args&&... args) {
+        logf(LogLevel::kInfo, format, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    void logf(LogLevel level, fmt::basic_runtime<char> format, Args&&... args) {
+        log(level, fmt::vformat(format.str, fmt::make_format_args(args...)));
+    }
+
+    // flush - Block until every entry this thread logged before the call is written and on stable storage.
+    // Can take up to flush_interval longer while the writer holds a partial batch.
+    void flush();
+
+    // stats - Counters so far. Cheap, and callable from any thread.
+    LoggerStats stats() const;
 
 private:
+    using Ring = MpscRing<128>;
+    enum EntryKind : uint8_t { kInline, kHeap, kDeferred, kFlush };
+    // A deferred entry: format string address and size, argument count, type codes, then the arguments.
+    static constexpr size_t kDeferredHeaderSize {sizeof(const char*) + sizeof(uint32_t) + sizeof(uint8_t)};
+
+    // ThreadBuffer - A producer thread's own ring, with per_thread. Shared by the thread and the logger, so
+    // whichever goes away first leaves it to the other.
+    struct ThreadBuffer {
+        explicit ThreadBuffer(size_t capacity) : ring(capacity) {}
+
+        SpscRing<128> ring;
+        // A push is under way, stamped no earlier than what the thread pushed before.
+        alignas(64) std::atomic<bool> busy {false};
+        std::atomic<bool> closed {false};  // The thread has exited.
+        uint64_t last_stamp {0};           // Writer only: the stamp of the last entry taken out.
+    };
+
+    struct ThreadBuffers;
+
+    enum class Overflow { kRetry, kWait, kDrop };
+
+    // Push - Queue the entry fill(slot) writes, unless the overflow policy drops it. Flush markers are never
+    // dropped.
+    template <typename Fill>
+    bool Push(LogLevel level, Fill&& fill, bool droppable = true);
+    // OnFull - Decide what a push that found the ring full does next.
+    Overflow OnFull(LogLevel level, bool droppable);
+    // Discard - Free what a slot popped without being written holds.
+    void Discard(uint8_t kind, const char* data);
+    // LocalBuffer - This thread's buffer, registered on first use.
+    ThreadBuffer& LocalBuffer();
+
     void ProcessEntries();
-    void ProcessEntriesHelper(std::queue<std::string>& queue, std::ofstream& ofs) const;
-    std::mutex mutex_;
-    std::condition_variable cond_var_;
-    std::queue<std::string> queue_;
+    // ProcessEntriesHelper - Write out everything queued so far. Returns false if there was nothing.
+    bool ProcessEntriesHelper();
+    bool DrainThreadBuffers();
+    // Empty - Whether nothing is queued. Writer only.
+    bool Empty();
+    // Synced - Release flush() calls up to ticket.
+    void Synced(uint64_t ticket);
+    // NoteDepth - Record how many entries the writer found queued.
+    void NoteDepth(uint64_t depth);
+    // BeginEntry - Make room in the sink for an entry of size bytes.
+    void BeginEntry(size_t size);
+    void WriteEntry(uint8_t kind, const char* data, uint32_t size);
+    void WakeWriter();
+
+    const uint64_t id_;  // Tells loggers apart in threads' buffer lists, even if one reuses another's address.
+    std::string path_;
+    LoggerOptions options_;
+    Ring ring_;
+    std::unique_ptr<LogSink> out_;
+    std::atomic<bool> exit_ {false};
+    std::atomic<bool> sleeping_ {false};  // The writer is waiting on wakeups_.
+    std::atomic<uint32_t> wakeups_ {0};
+    std::atomic<uint64_t> flush_tickets_ {0};
+    std::atomic<uint64_t> synced_ {0};   // The last flush ticket the writer has synced for.
+    std::atomic<uint64_t> pending_flush_ {0};  // A flush ticket whose marker was dropped as the oldest entry.
+    std::atomic<uint64_t> entries_ {0};        // Written by the writer only.
+    std::atomic<uint64_t> high_water_ {0};     // Written by the writer only.
+    // Only touched once the ring is full.
+    std::atomic<uint64_t> rejected_ {0};
+    std::atomic<uint64_t> evicted_ {0};
+    std::atomic<uint64_t> overflows_ {0};
+
+    mutable std::mutex registry_mtx_;
+    std::vector<std::shared_ptr<ThreadBuffer>> registry_;
+    std::atomic<uint64_t> registry_version_ {0};
+    std::atomic<uint64_t> thread_buffers_ {0};
+
+    // Writer thread only.
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;  // A copy of registry_, refreshed when it changes.
+    uint64_t buffers_version_ {0};
+    fmt::memory_buffer line_;
+    std::unordered_map<const char*, uint32_t> format_ids_;  // Binary logs: formats already written out.
+
     std::thread thread_;
 };
 
+template <typename Fill>
+bool Logger::Push(LogLevel level, Fill&& fill, bool droppable) {
+    // Ask the overflow policy once per entry; once it says wait, wait.
+    auto full = [this, level, droppable, wait = false]() mutable {
+        if (!wait) {
+            switch (OnFull(level, droppable)) {
+            case Overflow::kRetry:
+                return true;
+            case Overflow::kWait:
+                wait = true;
+                break;
+            case Overflow::kDrop:
+                return false;
+            }
+        }
+        std::this_thread::yield();
+        return true;
+    };
+
+    if (options_.per_thread) {
+        ThreadBuffer& buffer {LocalBuffer()};
+        // Raise busy before reading the clock; see DrainThreadBuffers.
+        buffer.busy.store(true);
+        uint64_t stamp {static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())};
+        auto stamped = [stamp, &fill](auto& slot) {
+            slot.stamp = stamp;
+            fill(slot);
+        };
+        bool pushed {true};
+        while (!buffer.ring.tryPush(stamped)) {
+            if (!full()) {
+                pushed = false;
+                break;
+            }
+        }
+        buffer.busy.store(false, std::memory_order_release);
+        if (!pushed) {
+            return false;
+        }
+    } else {
+        while (!ring_.tryPush(fill)) {
+            if (!full()) {
+                return false;
+            }
+        }
+    }
+    WakeWriter();
+    return true;
+}
+
+template <typename... Args>
+void Logger::logf(LogLevel level, fmt::format_string<Args...> format, Args&&... args) {
+    constexpr size_t n {sizeof...(Args)};
+    static_assert(n < 256, "too many logf arguments");
+    constexpr uint8_t types[n + 1] {static_cast<uint8_t>(logArgType<std::decay_t<Args>>())..., 0};
+    size_t size {kDeferredHeaderSize + n + (size_t {0} + ... + logArgSize<std::decay_t<Args>>(args))};
+    if (size > Ring::kPayloadSize) {
+        log(level, fmt::format(format, std::forward<Args>(args)...));
+        return;
+    }
+
+    fmt::string_view text {format};
+    Push(level, [&](auto& slot) {
+        slot.kind = kDeferred;
+        slot.size = static_cast<uint32_t>(size);
+        char* p {slot.data};
+        const char* data {text.data()};
+        auto text_size {static_cast<uint32_t>(text.size())};
+        memcpy(p, &data, sizeof(data));
+        memcpy(p + sizeof(data), &text_size, sizeof(text_size));
+        p += sizeof(data) + sizeof(text_size);
+        *p++ = static_cast<char>(n);
+        memcpy(p, types, n);
+        p += n;
+        ((p = encodeLogArg<std::decay_t<Args>>(p, args)), ...);
+    });
+}
+
 #endif // LOGGER_HPP
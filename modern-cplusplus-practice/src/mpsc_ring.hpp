@@ -0,0 +1,110 @@
+#ifndef MPSC_RING_HPP
+#define MPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// Bounded multi-producer/single-consumer ring of fixed-size slots, after Dmitry Vyukov's bounded queue.
+// Each slot carries a sequence number saying whose turn it is: equal to a position, the slot is free for the
+// producer that claims that position; one past it, the entry is ready for the consumer. A producer claims a
+// position with a single CAS on tail_ and fills the slot in place, so nothing is allocated and producers only
+// contend on tail_. Popping claims a position on head_ the same way, so a producer finding the ring full can also
+// pop, to throw away the oldest entry.
+template <size_t SlotSize = 128>
+class MpscRing {
+public:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> seq;
+        uint32_t size;
+        uint8_t kind;
+        char data[SlotSize - 16];
+    };
+    static constexpr size_t kPayloadSize = sizeof(Slot::data);
+    static_assert(sizeof(Slot) == SlotSize, "SlotSize must be a multiple of 64");
+
+    // capacity must be a power of two.
+    explicit MpscRing(size_t capacity)
+    : mask_(capacity - 1), slots_(new Slot[capacity]) {
+        if (capacity == 0 || (capacity & mask_) != 0) {
+            throw std::invalid_argument {"MpscRing capacity must be a power of two"};
+        }
+        for (size_t i {0}; i < capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing& src) = delete;
+    MpscRing& operator=(const MpscRing& rhs) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // tryPush - Claim a slot and let fill(Slot&) write the entry into it. Returns false if the ring is full.
+    template <typename Fill>
+    bool tryPush(Fill&& fill) {
+        uint64_t pos {tail_.load(std::memory_order_relaxed)};
+        while (true) {
+            Slot& slot {slots_[pos & mask_]};
+            uint64_t seq {slot.seq.load(std::memory_order_acquire)};
+            auto diff {static_cast<int64_t>(seq - pos)};
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(slot);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The consumer has not freed this slot from the previous lap yet.
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // tryPop - Hand the oldest entry to consume(const Slot&) and free its slot. Returns false if it is not ready.
+    template <typename Consume>
+    bool tryPop(Consume&& consume) {
+        uint64_t pos {head_.load(std::memory_order_relaxed)};
+        while (true) {
+            Slot& slot {slots_[pos & mask_]};
+            uint64_t seq {slot.seq.load(std::memory_order_acquire)};
+            auto diff {static_cast<int64_t>(seq - (pos + 1))};
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    consume(static_cast<const Slot&>(slot));
+                    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // empty - Whether the next entry is not ready yet.
+    bool empty() const {
+        uint64_t pos {head_.load(std::memory_order_relaxed)};
+        return slots_[pos & mask_].seq.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    // size - Entries claimed and not popped yet. Only a snapshot.
+    size_t size() const {
+        uint64_t head {head_.load(std::memory_order_relaxed)};
+        uint64_t tail {tail_.load(std::memory_order_relaxed)};
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    // On lines of their own: producers hammer tail_, and the consumer should not pay for that on every pop.
+    alignas(64) std::atomic<uint64_t> tail_ {0};
+    alignas(64) std::atomic<uint64_t> head_ {0};
+};
+
+#endif // MPSC_RING_HPP
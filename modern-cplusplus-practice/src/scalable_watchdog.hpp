@@ -0,0 +1,304 @@
+#ifndef SCALABLE_WATCHDOG_HPP
+#define SCALABLE_WATCHDOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// TaskHandle - A task registered with a ScalableWatchdog: the slot it lives in (low 32 bits) and the generation
+// of that slot (high 32 bits), so a handle stops working once its task is unregistered. 0 is never a handle.
+typedef uint64_t TaskHandle;
+constexpr TaskHandle kNoTask = 0;
+
+struct ScalableWatchdogOptions {
+    uint32_t shards = 0;               // Monitor threads; 0 for one per hardware thread.
+    uint32_t max_tasks = 1u << 22;
+    uint32_t tick_ms = 10;             // How finely deadlines are tracked.
+    uint32_t wheel_size = 1024;        // Ticks per revolution of a shard's timing wheel; a power of two.
+    uint32_t check_interval_ms = 100;  // How often a task that stays stale is reported again.
+};
+
+// ScalableWatchdog - Watchdog for hundreds of thousands of tasks.
+// Tasks are spread over shards by handle, each with its own lock, monitor thread and hashed timing wheel of
+// deadlines, so registering and unregistering are O(1) and shards never wait on each other. As in Watchdog, feed()
+// only stores the time in the task's slot, lock-free: the monitor looks at a task when the wheel reaches its
+// deadline, and files it under last feed + threshold if it has been fed since. Misses go to the handler on the
+// shard's monitor thread, outside the shard lock.
+class ScalableWatchdog {
+public:
+    typedef std::function<void(TaskHandle id, std::chrono::milliseconds overdue)> MissHandler;
+
+private:
+    static constexpr uint32_t kChunkBits = 12;
+    static constexpr uint32_t kChunkSize = 1u << kChunkBits;
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Slot {
+        std::atomic<int64_t> last_feed;    // ns since epoch_.
+        std::atomic<uint32_t> generation;  // Odd while the slot holds a task.
+        uint32_t threshold_ms;
+        // Wheel bucket links (shard-local indexes) and the tick the task is filed under; guarded by the shard lock.
+        uint32_t next;
+        uint32_t prev;
+        int64_t when;
+    };
+
+    struct alignas(64) Shard {
+        uint32_t index = 0;
+        std::mutex mtx;
+        std::condition_variable cv;
+        // Slots are allocated a chunk at a time and never move; directory lets feed() find them without the lock.
+        std::vector<std::unique_ptr<Slot[]>> chunks;
+        std::unique_ptr<std::atomic<Slot*>[]> directory;
+        std::vector<uint32_t> free;
+        uint32_t used = 0;
+        std::vector<uint32_t> wheel;  // First task in each bucket.
+        int64_t tick = 0;             // Next tick to process.
+        size_t tasks = 0;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    const std::chrono::steady_clock::time_point epoch_;
+    MissHandler on_miss_;
+    uint32_t shard_count_;
+    uint32_t capacity_;  // Tasks per shard.
+    int64_t tick_ns_;
+    int64_t check_interval_ns_;
+    uint32_t wheel_mask_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<uint32_t> next_shard_;
+    std::atomic<size_t> tasks_;
+
+public:
+    explicit ScalableWatchdog(MissHandler on_miss = nullptr, ScalableWatchdogOptions options = {})
+    : epoch_(std::chrono::steady_clock::now()), on_miss_(std::move(on_miss)), next_shard_(0), tasks_(0) {
+        if (options.wheel_size == 0 || (options.wheel_size & (options.wheel_size - 1)) != 0) {
+            throw std::invalid_argument {"ScalableWatchdog wheel_size must be a power of two"};
+        }
+        if (!on_miss_) {
+            on_miss_ = [](TaskHandle id, std::chrono::milliseconds) {
+                std::cout << "[Watchdog] Task " << id << " feed not received in time!\n";
+            };
+        }
+        shard_count_ = options.shards != 0 ? options.shards : std::max(1u, std::thread::hardware_concurrency());
+        capacity_ = options.max_tasks / shard_count_;
+        tick_ns_ = int64_t(std::max(1u, options.tick_ms)) * 1000000;
+        check_interval_ns_ = int64_t(options.check_interval_ms) * 1000000;
+        wheel_mask_ = options.wheel_size - 1;
+
+        uint32_t chunks = (capacity_ + kChunkSize - 1) / kChunkSize;
+        shards_.reset(new Shard[shard_count_]);
+        for (uint32_t s = 0; s < shard_count_; s++) {
+            Shard& shard = shards_[s];
+            shard.index = s;
+            shard.directory.reset(new std::atomic<Slot*>[chunks]());
+            shard.wheel.assign(options.wheel_size, kNil);
+            shard.thread = std::thread(&ScalableWatchdog::monitor, this, std::ref(shard));
+        }
+    }
+
+    ~ScalableWatchdog() {
+        for (uint32_t s = 0; s < shard_count_; s++) {
+            {
+                std::lock_guard<std::mutex> lock(shards_[s].mtx);
+                shards_[s].stop = true;
+            }
+            shards_[s].cv.notify_one();
+        }
+        for (uint32_t s = 0; s < shard_count_; s++) {
+            shards_[s].thread.join();
+        }
+    }
+
+    // registerTask - Start watching a task that must be fed every threshold_ms. Returns kNoTask if its shard is
+    // full.
+    TaskHandle registerTask(uint32_t threshold_ms) {
+        Shard& shard = shards_[next_shard_.fetch_add(1, std::memory_order_relaxed) % shard_count_];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        uint32_t local;
+        if (!shard.free.empty()) {
+            local = shard.free.back();
+            shard.free.pop_back();
+        } else {
+            if (shard.used == capacity_) {
+                return kNoTask;
+            }
+            if ((shard.used & (kChunkSize - 1)) == 0) {
+                shard.chunks.emplace_back(new Slot[kChunkSize]());
+                shard.directory[shard.used >> kChunkBits].store(shard.chunks.back().get(), std::memory_order_release);
+            }
+            local = shard.used++;
+        }
+        Slot& slot = at(shard, local);
+        int64_t now = nowNs();
+        slot.last_feed.store(now, std::memory_order_relaxed);
+        slot.threshold_ms = threshold_ms;
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed) + 1;
+        slot.generation.store(generation, std::memory_order_relaxed);
+
+        bool idle = shard.tasks++ == 0;
+        if (idle) {
+            shard.tick = now / tick_ns_;
+        }
+        schedule(shard, local, now + int64_t(threshold_ms) * 1000000);
+        tasks_.fetch_add(1, std::memory_order_relaxed);
+        if (idle) {
+            shard.cv.notify_one();
+        }
+        return (uint64_t(generation) << 32) | (uint64_t(local) * shard_count_ + shard.index);
+    }
+
+    // unregisterTask - Stop watching id. Returns false if it is not registered.
+    bool unregisterTask(TaskHandle id) {
+        Slot* slot = locate(id);
+        if (slot == nullptr) {
+            return false;
+        }
+        Shard& shard = shards_[uint32_t(id) % shard_count_];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (!live(*slot, id)) {
+            return false;
+        }
+        uint32_t local = uint32_t(id) / shard_count_;
+        unlink(shard, local);
+        slot->generation.store(uint32_t(id >> 32) + 1, std::memory_order_relaxed);
+        shard.free.push_back(local);
+        shard.tasks--;
+        tasks_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // feed - Mark id alive. Lock-free; feeding a handle that is no longer registered has no effect.
+    void feed(TaskHandle id) {
+        Slot* slot = locate(id);
+        if (slot != nullptr && live(*slot, id)) {
+            slot->last_feed.store(nowNs(), std::memory_order_relaxed);
+        }
+    }
+
+    size_t size() const { return tasks_.load(std::memory_order_relaxed); }
+    uint32_t shards() const { return shard_count_; }
+
+private:
+    int64_t nowNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    static bool live(const Slot& slot, TaskHandle id) {
+        uint32_t generation = uint32_t(id >> 32);
+        return (generation & 1) != 0 && slot.generation.load(std::memory_order_relaxed) == generation;
+    }
+
+    Slot& at(Shard& shard, uint32_t local) { return shard.chunks[local >> kChunkBits][local & (kChunkSize - 1)]; }
+
+    // locate - The slot id points at, or nullptr if there is none. Does not take the lock.
+    Slot* locate(TaskHandle id) const {
+        uint32_t local = uint32_t(id) / shard_count_;
+        if (local >= capacity_) {
+            return nullptr;
+        }
+        Slot* chunk = shards_[uint32_t(id) % shard_count_].directory[local >> kChunkBits].load(std::memory_order_acquire);
+        return chunk == nullptr ? nullptr : &chunk[local & (kChunkSize - 1)];
+    }
+
+    // schedule - File task local under the first tick at or after due (ns), and no earlier than the next tick to
+    // process. Called with the shard lock held, as are link and unlink.
+    void schedule(Shard& shard, uint32_t local, int64_t due) {
+        at(shard, local).when = std::max((due + tick_ns_ - 1) / tick_ns_, shard.tick);
+        link(shard, local);
+    }
+
+    void link(Shard& shard, uint32_t local) {
+        Slot& slot = at(shard, local);
+        uint32_t& head = shard.wheel[slot.when & wheel_mask_];
+        slot.prev = kNil;
+        slot.next = head;
+        if (head != kNil) {
+            at(shard, head).prev = local;
+        }
+        head = local;
+    }
+
+    void unlink(Shard& shard, uint32_t local) {
+        Slot& slot = at(shard, local);
+        if (slot.prev != kNil) {
+            at(shard, slot.prev).next = slot.next;
+        } else {
+            shard.wheel[slot.when & wheel_mask_] = slot.next;
+        }
+        if (slot.next != kNil) {
+            at(shard, slot.next).prev = slot.prev;
+        }
+    }
+
+    void monitor(Shard& shard) {
+        std::vector<std::pair<TaskHandle, std::chrono::milliseconds>> missed;
+        std::unique_lock<std::mutex> lock(shard.mtx);
+        while (!shard.stop) {
+            if (shard.tasks == 0) {
+                shard.cv.wait(lock);
+                continue;
+            }
+            int64_t now = nowNs();
+            int64_t now_tick = now / tick_ns_;
+            if (now_tick < shard.tick) {
+                shard.cv.wait_until(lock, epoch_ + std::chrono::nanoseconds(shard.tick * tick_ns_));
+                continue;
+            }
+            // After falling more than a revolution behind, each bucket needs only one visit.
+            shard.tick = std::max(shard.tick, now_tick - int64_t(wheel_mask_));
+            while (shard.tick <= now_tick) {
+                expire(shard, shard.tick++, now, now_tick, missed);
+            }
+            if (!missed.empty()) {
+                lock.unlock();
+                for (auto& [id, overdue] : missed) {
+                    on_miss_(id, overdue);
+                }
+                missed.clear();
+                lock.lock();
+            }
+        }
+    }
+
+    // expire - Go through the bucket of tick: re-file the tasks fed since they were filed, and collect the ones
+    // that are overdue.
+    void expire(Shard& shard, int64_t tick, int64_t now, int64_t now_tick,
+                std::vector<std::pair<TaskHandle, std::chrono::milliseconds>>& missed) {
+        uint32_t& head = shard.wheel[tick & wheel_mask_];
+        uint32_t local = head;
+        head = kNil;
+        while (local != kNil) {
+            Slot& slot = at(shard, local);
+            uint32_t next = slot.next;
+            if (slot.when > now_tick) {
+                link(shard, local);  // Due in a later revolution.
+            } else {
+                int64_t due = slot.last_feed.load(std::memory_order_relaxed) + int64_t(slot.threshold_ms) * 1000000;
+                if (due > now) {
+                    schedule(shard, local, due);
+                } else {
+                    TaskHandle id = (uint64_t(slot.generation.load(std::memory_order_relaxed)) << 32)
+                                    | (uint64_t(local) * shard_count_ + shard.index);
+                    missed.emplace_back(id, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                std::chrono::nanoseconds(now - due)));
+                    schedule(shard, local, now + check_interval_ns_);
+                }
+            }
+            local = next;
+        }
+    }
+};
+
+#endif // SCALABLE_WATCHDOG_HPP
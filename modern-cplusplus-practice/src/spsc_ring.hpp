@@ -0,0 +1,86 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// Bounded single-producer/single-consumer ring of fixed-size slots, each stamped with the time it was logged.
+// Each side owns its index and keeps a cached copy of the other's, so in the common case a push or pop touches
+// only the slot and lines private to its own thread.
+template <size_t SlotSize = 128>
+class SpscRing {
+public:
+    struct alignas(64) Slot {
+        uint64_t stamp;
+        uint32_t size;
+        uint8_t kind;
+        char data[SlotSize - 16];
+    };
+    static constexpr size_t kPayloadSize = sizeof(Slot::data);
+    static_assert(sizeof(Slot) == SlotSize, "SlotSize must be a multiple of 64");
+
+    // capacity must be a power of two.
+    explicit SpscRing(size_t capacity)
+    : mask_(capacity - 1), slots_(new Slot[capacity]) {
+        if (capacity == 0 || (capacity & mask_) != 0) {
+            throw std::invalid_argument {"SpscRing capacity must be a power of two"};
+        }
+    }
+
+    SpscRing(const SpscRing& src) = delete;
+    SpscRing& operator=(const SpscRing& rhs) = delete;
+
+    // tryPush - Let fill(Slot&) write the next entry in place. Returns false if the ring is full. Producer only.
+    template <typename Fill>
+    bool tryPush(Fill&& fill) {
+        uint64_t tail {tail_.load(std::memory_order_relaxed)};
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        fill(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // front - The oldest entry, or nullptr if there is none. Consumer only.
+    const Slot* front() {
+        uint64_t head {head_.load(std::memory_order_relaxed)};
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return nullptr;
+            }
+        }
+        return &slots_[head & mask_];
+    }
+
+    // size - Entries pushed and not popped yet. Only a snapshot.
+    size_t size() const {
+        uint64_t head {head_.load(std::memory_order_relaxed)};
+        uint64_t tail {tail_.load(std::memory_order_relaxed)};
+        return tail > head ? tail - head : 0;
+    }
+
+    // pop - Free the slot front() returned. Consumer only.
+    void pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    // Written by the producer.
+    alignas(64) std::atomic<uint64_t> tail_ {0};
+    uint64_t head_cache_ {0};
+    // Written by the consumer.
+    alignas(64) std::atomic<uint64_t> head_ {0};
+    uint64_t tail_cache_ {0};
+};
+
+#endif // SPSC_RING_HPP
@@ -1,101 +1,400 @@
 #ifndef WATCHDOG_HPP
 #define WATCHDOG_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <cstdint>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <queue>
 #include <thread>
 #include <vector>
 
+#include "feed_histogram.hpp"
+
 typedef uint8_t TaskID;
 
 struct TaskInfo {
-    std::chrono::steady_clock::time_point last_feed;
     uint32_t threshold_ms;
+    uint32_t generation;  // Bumped on every registerTask, retiring the deadlines queued before it.
+};
+
+// FeedStats - How far apart a task's feeds have been since it was registered.
+struct FeedStats {
+    uint64_t count;                   // Intervals recorded.
+    std::chrono::microseconds p50;
+    std::chrono::microseconds p99;
+    std::chrono::microseconds max;
+    std::chrono::microseconds jitter;  // Standard deviation of the interval.
+    double headroom;                  // 1 - max / threshold: negative once an interval has exceeded the threshold.
 };
 
+// Watchdog - Reports tasks that are not fed within their threshold.
+// The monitor keeps one deadline per task in a min-heap and sleeps until the earliest one, so it detects a miss
+// when it happens rather than on the next poll, and does no work while nothing is due. feed() only stores the
+// time in the task's slot, without taking the lock: a deadline that comes up for a task fed since is pushed back to
+// last feed + threshold then. A task that stays stale is reported again every check interval.
+// Dependencies are compiled into per-task bitsets of everything a task depends on, directly or not, so finding
+// which stale tasks a missed one waits on is a few word-wide ANDs, and a stale task that others wait on is named
+// once as the root cause rather than once per dependent.
+// Recovery handlers run on a thread of their own. The monitor only queues a call; a task has at most one call of
+// each kind queued, and one that ran within its handler's min interval is not queued again. So a slow handler
+// holds up neither detection nor feed().
+// feed() also records the time since the previous feed in a per-task histogram, read with feedStats().
 class Watchdog {
+public:
+    typedef std::function<void(TaskID id)> TimeoutHandler;
+    // root - A stale task id depends on, directly or not, that is not itself waiting on a stale task.
+    typedef std::function<void(TaskID id, TaskID root)> DependencyHandler;
+
 private:
-    std::map<TaskID, TaskInfo> tasks_;
-    std::map<TaskID, std::vector<TaskID>> dependency_graph_;
+    struct Deadline {
+        std::chrono::steady_clock::time_point when;
+        TaskID id;
+        uint32_t generation;
+
+        bool operator>(const Deadline& rhs) const { return when > rhs.when; }
+    };
+
+    // One line per task, so tasks fed from different threads never write to the same one.
+    struct alignas(64) FeedSlot {
+        std::atomic<std::chrono::steady_clock::rep> last_feed;
+    };
+    static constexpr size_t kMaxTasks = size_t(std::numeric_limits<TaskID>::max()) + 1;
+    typedef std::bitset<kMaxTasks> TaskSet;
+
+    std::array<FeedSlot, kMaxTasks> feeds_;
+    std::unique_ptr<FeedHistogram[]> intervals_;
+
+    std::array<TaskInfo, kMaxTasks> tasks_;  // generation 0: never registered.
+    std::array<TaskSet, kMaxTasks> depends_on_;
+    std::array<TaskSet, kMaxTasks> closure_;  // Everything each task depends on, directly or not.
+    TaskSet stale_;                           // Tasks found overdue and not seen fed since.
+    TaskSet reported_roots_;                  // Stale tasks already named as a root cause.
+    struct Recovery {
+        TaskID id;
+        bool dependency;
+        TaskID root;
+    };
+
+    struct RecoveryHandler {
+        TimeoutHandler on_timeout;
+        DependencyHandler on_violation;
+        uint32_t timeout_interval_ms;
+        uint32_t violation_interval_ms;
+        std::chrono::steady_clock::time_point last_timeout;
+        std::chrono::steady_clock::time_point last_violation;
+        bool timeout_queued;
+        bool violation_queued;
+    };
+
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines_;
     uint32_t check_interval_ms_;
     std::mutex mtx_;
+    std::condition_variable cv_;
     std::thread watchdog_thread_;
-    volatile bool stop_flag_;
+    bool stop_flag_;
+
+    // Guarded by recovery_mtx_, which the monitor takes only to queue a call, and never while a handler runs.
+    std::array<RecoveryHandler, kMaxTasks> handlers_;
+    std::deque<Recovery> recoveries_;
+    std::mutex recovery_mtx_;
+    std::condition_variable recovery_cv_;
+    std::thread recovery_thread_;
+    bool recovery_stop_;
 public:
     Watchdog(uint32_t check_interval_ms = 100)
-    : check_interval_ms_(check_interval_ms), stop_flag_(false) {
+    : intervals_(new FeedHistogram[kMaxTasks]), tasks_(), check_interval_ms_(check_interval_ms), stop_flag_(false), handlers_(), recovery_stop_(false) {
+        recovery_thread_ = std::thread(&Watchdog::recover, this);
         watchdog_thread_ = std::thread(&Watchdog::monitor, this);
     }
 
     ~Watchdog() {
-        stop_flag_ = true;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_flag_ = true;
+        }
+        cv_.notify_one();
         if (watchdog_thread_.joinable()) {
             watchdog_thread_.join();
         }
+        // Calls still queued are dropped.
+        {
+            std::lock_guard<std::mutex> lock(recovery_mtx_);
+            recovery_stop_ = true;
+        }
+        recovery_cv_.notify_one();
+        if (recovery_thread_.joinable()) {
+            recovery_thread_.join();
+        }
     }
 
     void registerTask(TaskID id, uint32_t threshold_ms) {
         std::lock_guard<std::mutex> lock(mtx_);
-        TaskInfo info;
-        info.last_feed = std::chrono::steady_clock::now();
+        auto now = std::chrono::steady_clock::now();
+        feeds_[id].last_feed.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        intervals_[id].reset();
+        TaskInfo& info = tasks_[id];
         info.threshold_ms = threshold_ms;
-        tasks_[id] = info;
+        info.generation++;
+        stale_.reset(id);
+        reported_roots_.reset(id);
+        deadlines_.push({now + std::chrono::milliseconds(threshold_ms), id, info.generation});
+        // The new deadline may come before the one the monitor is sleeping until.
+        cv_.notify_one();
     }
 
-    void addDependency(TaskID task, TaskID dependsOn) {
+    // addDependency - Make task depend on dependsOn. Returns false, leaving the graph unchanged, if that would
+    // close a cycle.
+    bool addDependency(TaskID task, TaskID dependsOn) {
         std::lock_guard<std::mutex> lock(mtx_);
-        dependency_graph_[task].push_back(dependsOn);
+        if (task == dependsOn || closure_[dependsOn].test(task)) {
+            return false;
+        }
+        depends_on_[task].set(dependsOn);
+        compile();
+        return true;
+    }
+
+    // onTimeout - Call handler when task id misses its deadline, at most once every min_interval_ms.
+    void onTimeout(TaskID id, TimeoutHandler handler, uint32_t min_interval_ms = 1000) {
+        std::lock_guard<std::mutex> lock(recovery_mtx_);
+        handlers_[id].on_timeout = std::move(handler);
+        handlers_[id].timeout_interval_ms = min_interval_ms;
     }
 
+    // onDependencyViolation - Call handler when task id misses its deadline while a task it depends on is stale,
+    // instead of the timeout handler, at most once every min_interval_ms.
+    void onDependencyViolation(TaskID id, DependencyHandler handler, uint32_t min_interval_ms = 1000) {
+        std::lock_guard<std::mutex> lock(recovery_mtx_);
+        handlers_[id].on_violation = std::move(handler);
+        handlers_[id].violation_interval_ms = min_interval_ms;
+    }
+
+    // feed - Mark task id alive. Lock-free, so it may be called at any rate from any thread; feeding a task that
+    // is not registered has no effect. With several threads feeding the same task an interval may be lost.
     void feed(TaskID id) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        auto it = tasks_.find(id);
-        if (it != tasks_.end()) {
-            it->second.last_feed = std::chrono::steady_clock::now();
-            std::cout << "[Watchdog] Task " << id << "fed.\n";
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto last = feeds_[id].last_feed.load(std::memory_order_relaxed);
+        feeds_[id].last_feed.store(now, std::memory_order_relaxed);
+        if (now > last) {
+            auto interval = std::chrono::steady_clock::duration(now - last);
+            intervals_[id].record(std::chrono::duration_cast<std::chrono::microseconds>(interval).count());
         }
     }
 
+    // feedStats - Snapshot of the intervals between feeds of task id since it was registered.
+    FeedStats feedStats(TaskID id) {
+        uint32_t threshold_ms;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            threshold_ms = tasks_[id].threshold_ms;
+        }
+        const FeedHistogram& intervals = intervals_[id];
+        FeedStats stats;
+        stats.count = intervals.count();
+        stats.p50 = std::chrono::microseconds(intervals.percentile(0.50));
+        stats.p99 = std::chrono::microseconds(intervals.percentile(0.99));
+        stats.max = std::chrono::microseconds(intervals.max());
+        stats.jitter = std::chrono::microseconds(std::llround(intervals.stddev()));
+        stats.headroom = threshold_ms == 0 ? 0 : 1 - stats.max.count() / (threshold_ms * 1000.0);
+        return stats;
+    }
+
 private:
     void monitor() {
+        std::unique_lock<std::mutex> lock(mtx_);
         while (!stop_flag_) {
-            {
-                std::lock_guard<std::mutex> lock(mtx_);
-                auto now = std::chrono::steady_clock::now();
-                for (const auto& pair : tasks_) {
-                    TaskID id = pair.first;
-                    const TaskInfo& info = pair.second;
-                    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - info.last_feed).count();
-                    if (elapsed_ms > info.threshold_ms) {
-                        bool dependency_ok = true;
-                        auto dep_it = dependency_graph_.find(id);
-                        if (dep_it != dependency_graph_.end()) {
-                            for (TaskID dep : dep_it->second) {
-                                auto it_dep = tasks_.find(dep);
-                                if (it_dep != tasks_.end()) {
-                                    auto dep_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - it_dep->second.last_feed).count();
-                                    if (dep_elapsed > it_dep->second.threshold_ms) {
-                                        dependency_ok = false;
-                                        std::cout << "[Watchdog] Dependency violation: Task " << id
-                                        << " depends on task " << dep << "but it is stale.\n";
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        if (!dependency_ok) {
-                            std::cout << "[Watchdog] Task " << id << "feed not received in time (dependency check)!\n";
-                        } else {
-                            std::cout << "[Watchdog] Task " << id << "feed not received in time!\n";
-                        }
-                        // In the real system, this area has the reset or safety change mode over here.
+            if (deadlines_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (deadlines_.top().when > now) {
+                cv_.wait_until(lock, deadlines_.top().when);
+                continue;
+            }
+
+            TaskSet missed;
+            while (!deadlines_.empty() && deadlines_.top().when <= now) {
+                Deadline next = deadlines_.top();
+                deadlines_.pop();
+                if (tasks_[next.id].generation != next.generation) {
+                    continue;
+                }
+                auto due = lastFeed(next.id) + std::chrono::milliseconds(tasks_[next.id].threshold_ms);
+                if (due > now) {
+                    // Fed since this deadline was set.
+                    stale_.reset(next.id);
+                    reported_roots_.reset(next.id);
+                    deadlines_.push({due, next.id, next.generation});
+                    continue;
+                }
+                missed.set(next.id);
+                // At least a millisecond on, or with an interval of 0 this pass would pop it again forever.
+                auto again = std::chrono::milliseconds(std::max<uint32_t>(check_interval_ms_, 1));
+                deadlines_.push({now + again, next.id, next.generation});
+            }
+            if (missed.any()) {
+                report(missed, now);
+            }
+        }
+    }
+
+    std::chrono::steady_clock::time_point lastFeed(TaskID id) const {
+        auto ticks = feeds_[id].last_feed.load(std::memory_order_relaxed);
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(ticks));
+    }
+
+    // compile - Work out closure_ from depends_on_, visiting the tasks in topological order so that everything a
+    // task depends on is complete before it. depends_on_ must be acyclic. Called with mtx_ held.
+    void compile() {
+        TaskSet pending;
+        for (size_t id = 0; id < kMaxTasks; id++) {
+            closure_[id].reset();
+            if (depends_on_[id].any()) {
+                pending.set(id);
+            }
+        }
+        while (pending.any()) {
+            for (size_t id = 0; id < kMaxTasks; id++) {
+                if (!pending.test(id) || (depends_on_[id] & pending).any()) {
+                    continue;
+                }
+                closure_[id] = depends_on_[id];
+                for (size_t dep = 0; dep < kMaxTasks; dep++) {
+                    if (depends_on_[id].test(dep)) {
+                        closure_[id] |= closure_[dep];
                     }
                 }
+                pending.reset(id);
+            }
+        }
+    }
+
+    // report - Print the tasks in missed, which have just missed their deadlines, and the stale tasks they wait on
+    // that are not themselves waiting on a stale task. Called with mtx_ held.
+    void report(const TaskSet& missed, std::chrono::steady_clock::time_point now) {
+        TaskSet waited_on;
+        for (size_t id = 0; id < kMaxTasks; id++) {
+            if (missed.test(id)) {
+                waited_on |= closure_[id];
+            }
+        }
+        // The missed tasks are stale; bring stale_ up to date for the ones they wait on, whose deadlines may not
+        // have come up yet.
+        stale_ |= missed;
+        TaskSet check = waited_on & ~missed;
+        for (size_t id = 0; id < kMaxTasks; id++) {
+            if (!check.test(id) || tasks_[id].generation == 0) {
+                continue;
+            }
+            if (lastFeed(TaskID(id)) + std::chrono::milliseconds(tasks_[id].threshold_ms) > now) {
+                stale_.reset(id);
+                reported_roots_.reset(id);
+            } else {
+                stale_.set(id);
+            }
+        }
+
+        TaskSet roots = waited_on & stale_ & ~reported_roots_;
+        for (size_t root = 0; root < kMaxTasks; root++) {
+            if (!roots.test(root) || (closure_[root] & stale_).any()) {
+                continue;
+            }
+            std::cout << "[Watchdog] Dependency violation: Task " << root << " is stale, blocking task(s)";
+            for (size_t id = 0; id < kMaxTasks; id++) {
+                if (missed.test(id) && closure_[id].test(root)) {
+                    std::cout << " " << id;
+                }
+            }
+            std::cout << ".\n";
+            reported_roots_.set(root);
+        }
+        for (size_t id = 0; id < kMaxTasks; id++) {
+            if (!missed.test(id)) {
+                continue;
+            }
+            TaskSet blocking = closure_[id] & stale_;
+            if (blocking.any()) {
+                std::cout << "[Watchdog] Task " << id << " feed not received in time (dependency check)!\n";
+                dispatch({TaskID(id), true, rootOf(blocking)});
+            } else {
+                std::cout << "[Watchdog] Task " << id << " feed not received in time!\n";
+                dispatch({TaskID(id), false, TaskID(id)});
+            }
+        }
+    }
+
+    // rootOf - A task in blocking, a set of stale tasks, that waits on no stale task. Called with mtx_ held.
+    TaskID rootOf(const TaskSet& blocking) const {
+        for (size_t id = 0; id < kMaxTasks; id++) {
+            if (blocking.test(id) && (closure_[id] & stale_).none()) {
+                return TaskID(id);
+            }
+        }
+        return 0;  // Unreachable: the graph is acyclic.
+    }
+
+    // dispatch - Queue a call to the handler for recovery, unless there is none, one is queued already or it ran
+    // too recently.
+    void dispatch(const Recovery& recovery) {
+        {
+            std::lock_guard<std::mutex> lock(recovery_mtx_);
+            RecoveryHandler& handler = handlers_[recovery.id];
+            auto now = std::chrono::steady_clock::now();
+            if (recovery.dependency) {
+                if (!handler.on_violation || handler.violation_queued
+                    || now - handler.last_violation < std::chrono::milliseconds(handler.violation_interval_ms)) {
+                    return;
+                }
+                handler.violation_queued = true;
+            } else {
+                if (!handler.on_timeout || handler.timeout_queued
+                    || now - handler.last_timeout < std::chrono::milliseconds(handler.timeout_interval_ms)) {
+                    return;
+                }
+                handler.timeout_queued = true;
+            }
+            recoveries_.push_back(recovery);
+        }
+        recovery_cv_.notify_one();
+    }
+
+    void recover() {
+        std::unique_lock<std::mutex> lock(recovery_mtx_);
+        while (true) {
+            recovery_cv_.wait(lock, [this] { return recovery_stop_ || !recoveries_.empty(); });
+            if (recovery_stop_) {
+                break;
+            }
+            Recovery recovery = recoveries_.front();
+            recoveries_.pop_front();
+            RecoveryHandler& handler = handlers_[recovery.id];
+            auto now = std::chrono::steady_clock::now();
+            if (recovery.dependency) {
+                handler.violation_queued = false;
+                handler.last_violation = now;
+                DependencyHandler call = handler.on_violation;
+                lock.unlock();
+                call(recovery.id, recovery.root);
+            } else {
+                handler.timeout_queued = false;
+                handler.last_timeout = now;
+                TimeoutHandler call = handler.on_timeout;
+                lock.unlock();
+                call(recovery.id);
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(check_interval_ms_));
+            lock.lock();
         }
     }
 };
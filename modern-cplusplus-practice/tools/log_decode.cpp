@@ -0,0 +1,22 @@
+#include <fstream>
+#include <iostream>
+
+#include "binary_log.hpp"
+
+// log_decode - Print a binary log written by Logger as text, one entry per line.
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "usage: log_decode <binary log>" << std::endl;
+        return 1;
+    }
+    std::ifstream ifs {argv[1], std::ios_base::binary};
+    if (ifs.fail()) {
+        std::cerr << "Failed to open " << argv[1] << "." << std::endl;
+        return 1;
+    }
+    if (!decodeBinaryLog(ifs, std::cout)) {
+        std::cerr << argv[1] << ": malformed binary log." << std::endl;
+        return 1;
+    }
+    return 0;
+}
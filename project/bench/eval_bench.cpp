@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "evaluator.hpp"
+#include "jit.hpp"
+#include "lexer.hpp"
+#include "module.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "symbol.hpp"
+#include "vm.hpp"
+
+// Compares the tree-walking evaluator, the register VM and the JIT on the same definitions, with and without the
+// AST optimizer, then the batch evaluator against a per-row loop over whole columns.
+// Usage: eval_bench [iterations]
+
+static const char *kProgram = R"(
+def sq(x) x*x;
+def poly(x y) sq(x)*3 + sq(y)*2 - x*y + 1;
+def mix(a b c) poly(a, b) * (a < c) + poly(c, b) * (c < a);
+def f(x y) mix(x, y, x*y) + poly(y - x, x + y) * 0.5;
+)";
+
+template <typename Fn>
+static double timeCalls(const char *label, size_t iterations, Fn &&call) {
+    double checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        double args[2] = {static_cast<double>(i % 1000) * 0.01, static_cast<double>(i % 37)};
+        checksum += call(args);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    fmt::print("{:<8} {:>10.1f} ns/call   (checksum {})\n", label, elapsed / iterations, checksum);
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+
+    MemorySource source{kProgram};
+    Lexer lexer{source};
+    Parser parser{lexer};
+    parser.installStandardBinops();
+    parser.getNextToken();
+
+    Module module;
+    BytecodeCompiler compiler{module};
+    VM vm{module};
+    JIT jit{module};
+    while (parser.curTok() != static_cast<int>(Token::tok_eof)) {
+        if (parser.curTok() != static_cast<int>(Token::tok_def)) {
+            parser.getNextToken();
+            continue;
+        }
+        auto fn = parser.parseDefinition();
+        auto code = fn ? compiler.compile(*fn) : nullptr;
+        if (!code) {
+            return 1;
+        }
+        void *native = jit.compile(*fn);
+        uint32_t slot = module.addFunction(std::move(fn));
+        vm.define(slot, std::move(code));
+        jit.define(slot, native);
+    }
+
+    uint32_t f = *module.findSlot(symbols().intern("f"));
+    const AST::FunctionAST &fn = *module.getSlot(f).function;
+    TreeEvaluator tree{module};
+
+    double tree_ns = timeCalls("tree", iterations, [&](const double *args) { return tree.call(fn, args); });
+    double vm_ns = timeCalls("vm", iterations, [&](const double *args) { return vm.call(f, args); });
+    fmt::print("vm speedup: {:.2f}x\n", tree_ns / vm_ns);
+
+    if (auto native = reinterpret_cast<double (*)(double, double)>(jit.lookup(f))) {
+        double jit_ns = timeCalls("jit", iterations, [&](const double *args) { return native(args[0], args[1]); });
+        fmt::print("jit speedup: {:.2f}x\n", tree_ns / jit_ns);
+    } else {
+        fmt::print("jit: not available on this target\n");
+    }
+
+    // The same engines again, running optimized copies of every definition.
+    Optimizer optimizer{module};
+    VM opt_vm{module};
+    JIT opt_jit{module};
+    for (uint32_t slot = 0; slot < module.numSlots(); ++slot) {
+        auto optimized = optimizer.optimize(*module.getSlot(slot).function);
+        opt_vm.define(slot, compiler.compile(*optimized));
+        opt_jit.define(slot, opt_jit.compile(*optimized));
+    }
+    timeCalls("vm+opt", iterations, [&](const double *args) { return opt_vm.call(f, args); });
+    if (auto native = reinterpret_cast<double (*)(double, double)>(opt_jit.lookup(f))) {
+        timeCalls("jit+opt", iterations, [&](const double *args) { return native(args[0], args[1]); });
+    }
+
+    // Columns: the same rows the per-call loops above used.
+    std::vector<double> xs(iterations), ys(iterations), out(iterations);
+    for (size_t i = 0; i < iterations; ++i) {
+        xs[i] = static_cast<double>(i % 1000) * 0.01;
+        ys[i] = static_cast<double>(i % 37);
+    }
+    const double *columns[2] = {xs.data(), ys.data()};
+    BatchEvaluator batch{module};
+    auto start = std::chrono::steady_clock::now();
+    batch.evaluate(fn, columns, iterations, out.data());
+    double batch_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double checksum = 0;
+    for (double v : out) {
+        checksum += v;
+    }
+    fmt::print("{:<8} {:>10.1f} ns/row    (checksum {})\n", "batch", batch_ns / iterations, checksum);
+    fmt::print("batch speedup: {:.2f}x over vm\n", vm_ns / batch_ns);
+    return 0;
+}
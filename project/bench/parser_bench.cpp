@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "session.hpp"
+#include "stats.hpp"
+
+// Measures the lexer, the parser and the session (optimizer, bytecode compiler and JIT) on synthetic programs of
+// three shapes: deeply nested expressions, calls with many arguments, and many small definitions. The programs
+// are generated from a seed, so runs with the same seed see the same input. Built with KALEIDOSCOPE_STATS, which
+// supplies the token and node counts.
+// Usage: parser_bench [kilobytes per shape] [seed] [repetitions]
+
+// With glibc, every heap allocation of the process is counted by interposing its allocation functions in this
+// executable only; operator new and the arenas both end up in them, and the calls are passed on to glibc's own
+// allocator. Elsewhere only the blocks arenas allocate are counted, through Stats.
+#ifdef __GLIBC__
+static uint64_t heap_allocs = 0;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+extern "C" void *malloc(size_t size) noexcept {
+    ++heap_allocs;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) noexcept {
+    ++heap_allocs;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, size_t size) noexcept {
+    ++heap_allocs;
+    return __libc_realloc(p, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    ++heap_allocs;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) noexcept {
+    ++heap_allocs;
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **out, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    ++heap_allocs;
+    void *p = __libc_memalign(alignment, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+
+static uint64_t allocations() { return heap_allocs; }
+#else
+static uint64_t allocations() { return stats().arena_blocks; }
+#endif
+
+//-----------------------
+// Corpus
+//-----------------------
+
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(uint32_t seed) : rng_{seed} {}
+
+    // deep - Definitions whose bodies nest 64 to 256 levels deep, with a top-level call now and then.
+    std::string deep(size_t bytes) {
+        std::string out;
+        for (size_t n = 0; out.size() < bytes; ++n) {
+            out += fmt::format("def deep{}(a b c) ", n);
+            expression(out, uniform(64, 256));
+            out += ";\n";
+            if (n % 16 == 15) {
+                out += fmt::format("deep{}({}, {}, {});\n", n, uniform(0, 9), uniform(0, 9), uniform(0, 9));
+            }
+        }
+        return out;
+    }
+
+    // wide - Definitions of 16 to 48 parameters, each called by the next with an expression for every argument.
+    std::string wide(size_t bytes) {
+        std::string out;
+        size_t prev_arity = 0;
+        for (size_t n = 0; out.size() < bytes; ++n) {
+            size_t arity = uniform(16, 48);
+            out += fmt::format("def wide{}(", n);
+            for (size_t i = 0; i < arity; ++i) {
+                out += fmt::format("{}p{}", i ? " " : "", i);
+            }
+            out += ") ";
+            if (prev_arity) {
+                out += fmt::format("wide{}(", n - 1);
+                for (size_t i = 0; i < prev_arity; ++i) {
+                    out += fmt::format("{}p{} * {} + p{}", i ? ", " : "", uniform(0, arity - 1), uniform(1, 99),
+                                       uniform(0, arity - 1));
+                }
+                out += ") + ";
+            }
+            out += fmt::format("p0 * p{}", arity - 1);
+            out += ";\n";
+            prev_arity = arity;
+        }
+        return out;
+    }
+
+    // many - Small definitions, each calling one or two earlier ones, with a top-level call now and then.
+    std::string many(size_t bytes) {
+        std::string out = "def many0(x y) x * y + 1;\n";
+        for (size_t n = 1; out.size() < bytes; ++n) {
+            out += fmt::format("def many{}(x y) many{}(x + {}, y) * (x < y) + many{}(y, x - 1) - {}.25;\n", n,
+                               uniform(0, n - 1), uniform(1, 9), uniform(0, n - 1), uniform(0, 99));
+            if (n % 64 == 0) {
+                out += fmt::format("many{}(0.5, 2);\n", n);
+            }
+        }
+        return out;
+    }
+
+private:
+    size_t uniform(size_t lo, size_t hi) { return std::uniform_int_distribution<size_t>{lo, hi}(rng_); }
+
+    void leaf(std::string &out) {
+        static const char *const kVars[] = {"a", "b", "c"};
+        if (uniform(0, 2) == 0) {
+            out += fmt::format("{}.{}", uniform(0, 99), uniform(0, 9));
+        } else {
+            out += kVars[uniform(0, 2)];
+        }
+    }
+
+    // expression - depth operators, each with a leaf on one side and the rest, in parentheses, on the other.
+    void expression(std::string &out, size_t depth) {
+        static const char kOps[] = {'+', '-', '*', '<'};
+        for (size_t i = 0; i < depth; ++i) {
+            char op = kOps[uniform(0, 3)];
+            if (uniform(0, 1)) {
+                leaf(out);
+                out += fmt::format(" {} (", op);
+            } else {
+                out += '(';
+            }
+            closers_.push_back(op);
+        }
+        leaf(out);
+        while (!closers_.empty()) {
+            char op = closers_.back();
+            closers_.pop_back();
+            out += ')';
+            if (uniform(0, 1)) {
+                out += fmt::format(" {} ", op);
+                leaf(out);
+            } else {
+                out += " + 1";
+            }
+        }
+    }
+
+    std::mt19937 rng_;
+    std::vector<char> closers_;
+};
+
+//-----------------------
+// Phases
+//-----------------------
+
+struct Measurement {
+    double seconds;
+    uint64_t bytes, tokens, nodes, allocs;
+};
+
+// measure - Run prepare then, timed, phase, reps times over, and keep the fastest run. Counters cover the phase
+// only.
+template <typename Prepare, typename Phase>
+static Measurement measure(size_t reps, Prepare &&prepare, Phase &&phase) {
+    Measurement best{};
+    for (size_t r = 0; r < reps; ++r) {
+        prepare();
+        Stats before = stats();
+        uint64_t allocs_before = allocations();
+        auto start = std::chrono::steady_clock::now();
+        phase();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Stats const &after = stats();
+        Measurement m{seconds, after.bytes - before.bytes, after.tokens - before.tokens, after.nodes - before.nodes,
+                      allocations() - allocs_before};
+        if (r == 0 || m.seconds < best.seconds) {
+            best = m;
+        }
+    }
+    return best;
+}
+
+// report - Throughput of a phase that took `timed`, over the input described by `input`.
+static void report(const char *shape, const char *phase, const Measurement &timed, const Measurement &input) {
+    double s = timed.seconds;
+    fmt::print("{:<6} {:<8} {:>8.1f} MB/s {:>8.2f} Mtok/s {:>8.2f} Mnode/s {:>8.3f} allocs/node\n", shape, phase,
+               input.bytes / s / 1e6, input.tokens / s / 1e6, input.nodes / s / 1e6,
+               input.nodes ? static_cast<double>(timed.allocs) / input.nodes : 0.0);
+}
+
+static std::vector<ParsedItem> parseAll(const std::string &text) {
+    MemorySource source{text};
+    Lexer lexer{source};
+    Parser parser{lexer};
+    parser.installStandardBinops();
+    std::vector<ParsedItem> items;
+    parser.getNextToken();
+    while (parser.curTok() != static_cast<int>(Token::tok_eof)) {
+        if (parser.curTok() == ';') {
+            parser.getNextToken();
+            continue;
+        }
+        ParsedItem item = parser.parseItem();
+        if (!item.parsed()) {
+            fmt::print(stderr, "Error: the corpus does not parse\n");
+            exit(1);
+        }
+        items.push_back(std::move(item));
+    }
+    return items;
+}
+
+static void benchShape(const char *shape, const std::string &text, size_t reps) {
+    std::vector<ParsedItem> items;
+    std::unique_ptr<Session> session;
+    auto nothing = [] {};
+
+    // lex: tokens only.
+    auto lex = measure(reps, nothing, [&] {
+        MemorySource source{text};
+        Lexer lexer{source};
+        while (lexer.getTok() != static_cast<int>(Token::tok_eof)) {
+        }
+    });
+    report(shape, "lex", lex, lex);
+
+    // parse: lexing and building the AST.
+    auto parse = measure(reps, [&] { items.clear(); }, [&] { items = parseAll(text); });
+    report(shape, "parse", parse, parse);
+
+    // define: what the main loop does with each parsed item - optimize, compile and JIT definitions, and run
+    // top-level expressions.
+    auto define = measure(
+        reps,
+        [&] {
+            session.reset();
+            items = parseAll(text);
+            session = std::make_unique<Session>();
+        },
+        [&] {
+            for (auto &item : items) {
+                if (item.kind == ParsedItem::Kind::Definition) {
+                    session->define(std::move(item.function));
+                } else if (item.kind == ParsedItem::Kind::TopLevelExpr) {
+                    session->evaluate(*item.function);
+                }
+            }
+        });
+    report(shape, "define", define, parse);
+}
+
+int main(int argc, char *argv[]) {
+    size_t kilobytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024;
+    uint32_t seed = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 1;
+    size_t reps = argc > 3 ? std::max<size_t>(1, strtoull(argv[3], nullptr, 10)) : 5;
+
+    CorpusGenerator generator{seed};
+    std::pair<const char *, std::string> corpora[] = {
+        {"deep", generator.deep(kilobytes * 1024)},
+        {"wide", generator.wide(kilobytes * 1024)},
+        {"many", generator.many(kilobytes * 1024)},
+    };
+    fmt::print("{} KB per shape, seed {}, best of {}\n", kilobytes, seed, reps);
+    for (auto const &corpus : corpora) {
+        benchShape(corpus.first, corpus.second, reps);
+    }
+    return 0;
+}
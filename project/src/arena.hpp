@@ -0,0 +1,114 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "stats.hpp"
+
+//-----------------------
+// Arena
+//-----------------------
+
+// Arena - A bump allocator that owns everything allocated from it and releases it all at once.
+// Objects placed in an arena never have their destructors run, so only trivially destructible types are allowed.
+class Arena
+{
+public:
+    explicit Arena(size_t first_block_size = 4096) : next_block_size_{first_block_size} {}
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena()
+    {
+        while (head_)
+        {
+            Block *next = head_->next;
+            free(head_);
+            head_ = next;
+        }
+    }
+
+    void *allocate(size_t size, size_t align)
+    {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t)(align - 1);
+        if (!cur_ || p + size > reinterpret_cast<uintptr_t>(end_))
+        {
+            grow(size + align);
+            p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        cur_ = reinterpret_cast<char *>(p + size);
+        return reinterpret_cast<void *>(p);
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // copyArray - Copy n trivially copyable elements into the arena.
+    template <typename T>
+    T *copyArray(const T *src, size_t n)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "arena arrays are copied bytewise");
+        if (n == 0)
+        {
+            return nullptr;
+        }
+        T *dst = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+        memcpy(dst, src, sizeof(T) * n);
+        return dst;
+    }
+
+    std::string_view copyString(std::string_view s)
+    {
+        return std::string_view(copyArray(s.data(), s.size()), s.size());
+    }
+
+    size_t blockCount() const { return block_count_; }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    void grow(size_t min_size)
+    {
+        // Blocks double in size, so a function with n nodes costs O(log n) mallocs and usually just one.
+        size_t size = next_block_size_;
+        while (size < min_size + sizeof(Block))
+        {
+            size *= 2;
+        }
+        next_block_size_ = size * 2;
+
+        Block *block = static_cast<Block *>(malloc(size));
+        if (!block)
+        {
+            throw std::bad_alloc();
+        }
+        block->next = head_;
+        head_ = block;
+        ++block_count_;
+        STATS_ADD(arena_blocks, 1);
+        cur_ = reinterpret_cast<char *>(block + 1);
+        end_ = reinterpret_cast<char *>(block) + size;
+    }
+
+    Block *head_ = nullptr;
+    char *cur_ = nullptr;
+    char *end_ = nullptr;
+    size_t next_block_size_;
+    size_t block_count_ = 0;
+};
+
+#endif // ARENA_HPP
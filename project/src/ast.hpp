@@ -0,0 +1,258 @@
+#ifndef AST_HPP
+#define AST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Abstract Syntax Tree (aka Parse Tree)
+//-----------------------
+
+// RelPtr - A pointer kept as the distance from its own address to its target. Nodes linked this way stay valid
+// wherever their bytes are copied as a block, so a tree can be written to a file and mapped back in as it is.
+template <typename T>
+class RelPtr
+{
+public:
+    RelPtr(T *p = nullptr) { set(p); }
+    RelPtr(const RelPtr &other) { set(other.get()); }
+    RelPtr &operator=(const RelPtr &other)
+    {
+        set(other.get());
+        return *this;
+    }
+
+    T *get() const
+    {
+        return offset_ ? reinterpret_cast<T *>(reinterpret_cast<intptr_t>(this) + offset_) : nullptr;
+    }
+    int64_t offset() const { return offset_; }
+
+private:
+    void set(T *p) { offset_ = p ? reinterpret_cast<intptr_t>(p) - reinterpret_cast<intptr_t>(this) : 0; }
+
+    int64_t offset_;
+};
+
+// Expression nodes live in the Arena owned by their FunctionAST, or in a mapped module file. They are trivially
+// destructible and refer to each other with RelPtrs, so a whole tree is freed in one step. Names are symbols.
+class AST
+{
+public:
+    // ExprAST - Base class for all expression nodes.
+    class ExprAST
+    {
+    public:
+        enum class Kind : unsigned char { Number, Variable, Binary, Call };
+
+        Kind getKind() const { return kind_; }
+
+    protected:
+        explicit ExprAST(Kind kind) : kind_{kind} {}
+
+    private:
+        Kind kind_;
+    };
+
+    // ExprList - A read-only view of the arguments of a call.
+    class ExprList
+    {
+    public:
+        class iterator
+        {
+        public:
+            explicit iterator(const RelPtr<ExprAST> *p) : p_{p} {}
+
+            ExprAST *operator*() const { return p_->get(); }
+            iterator &operator++()
+            {
+                ++p_;
+                return *this;
+            }
+            bool operator!=(const iterator &other) const { return p_ != other.p_; }
+
+        private:
+            const RelPtr<ExprAST> *p_;
+        };
+
+        ExprList(const RelPtr<ExprAST> *data, size_t size) : data_{data}, size_{size} {}
+
+        iterator begin() const { return iterator(data_); }
+        iterator end() const { return iterator(data_ + size_); }
+        size_t size() const { return size_; }
+        ExprAST *operator[](size_t i) const { return data_[i].get(); }
+        // link - The i-th pointer itself, for checking where it leads without following it.
+        const RelPtr<ExprAST> &link(size_t i) const { return data_[i]; }
+
+    private:
+        const RelPtr<ExprAST> *data_;
+        size_t size_;
+    };
+
+    // NumberExprAST - Expression class for numeric literals like "1.0".
+    class NumberExprAST : public ExprAST
+    {
+    private:
+        double val_;
+
+    public:
+        NumberExprAST(double val) : ExprAST{Kind::Number}, val_{val} {}
+
+        double getVal() const { return val_; }
+    };
+
+    // VariableExprAST - Expression class for referencing a variable, like "a".
+    // The parser resolves the name to the position of the enclosing function's argument, so evaluating a variable
+    // is an index into the argument list.
+    class VariableExprAST : public ExprAST
+    {
+    private:
+        Symbol name_;
+        uint32_t index_;
+
+    public:
+        VariableExprAST(Symbol name, uint32_t index) : ExprAST{Kind::Variable}, name_{name}, index_{index} {}
+
+        Symbol getName() const { return name_; }
+        void setName(Symbol name) { name_ = name; }
+        uint32_t getIndex() const { return index_; }
+    };
+
+    // BinaryExprAST - Expression class for a binary operator.
+    class BinaryExprAST : public ExprAST
+    {
+    private:
+        char op_;
+        RelPtr<ExprAST> lhs_, rhs_; // Adjacent, so getOperands() can view them as a list.
+
+    public:
+        BinaryExprAST(char op, ExprAST *lhs, ExprAST *rhs)
+            : ExprAST{Kind::Binary}, op_{op}, lhs_{lhs}, rhs_{rhs} {}
+
+        char getOp() const { return op_; }
+        ExprAST *getLHS() const { return lhs_.get(); }
+        ExprAST *getRHS() const { return rhs_.get(); }
+        // getOperands - Both operands as a list, lhs first.
+        ExprList getOperands() const { return ExprList(&lhs_, 2); }
+    };
+
+    // CallExprAST - Expression class for function calls. The arguments are stored right after the node.
+    class alignas(RelPtr<ExprAST>) CallExprAST : public ExprAST
+    {
+    private:
+        Symbol callee_;
+        uint32_t num_args_;
+
+        CallExprAST(Symbol callee, uint32_t num_args) : ExprAST{Kind::Call}, callee_{callee}, num_args_{num_args} {}
+
+        const RelPtr<ExprAST> *argSlots() const { return reinterpret_cast<const RelPtr<ExprAST> *>(this + 1); }
+
+    public:
+        // create - Allocate a call and its arguments from anything with an Arena-style allocate().
+        template <typename Alloc>
+        static CallExprAST *create(Alloc &alloc, Symbol callee, ExprAST *const *args, size_t num_args)
+        {
+            auto call = new (alloc.allocate(allocSize(num_args), alignof(CallExprAST)))
+                CallExprAST(callee, static_cast<uint32_t>(num_args));
+            auto slots = const_cast<RelPtr<ExprAST> *>(call->argSlots());
+            for (size_t i = 0; i < num_args; ++i)
+            {
+                new (&slots[i]) RelPtr<ExprAST>(args[i]);
+            }
+            return call;
+        }
+
+        static size_t allocSize(size_t num_args) { return sizeof(CallExprAST) + num_args * sizeof(RelPtr<ExprAST>); }
+
+        Symbol getCallee() const { return callee_; }
+        // setCallee - Rebind the call to another symbol for the same function, as when loading a module file.
+        void setCallee(Symbol callee) { callee_ = callee; }
+        ExprList getArgs() const { return ExprList(argSlots(), num_args_); }
+    };
+
+    // PrototypeAST - This class represents the "prototype" for a function,
+    // which captures its name, and its argument names (thus implicitly the number of arguments the function takes).
+    class PrototypeAST
+    {
+    private:
+        Symbol name_;
+        std::vector<Symbol> args_;
+
+    public:
+        PrototypeAST(Symbol name, std::vector<Symbol> args)
+            : name_{name}, args_{std::move(args)} {}
+
+        Symbol getName() const { return name_; }
+        std::vector<Symbol> const &getArgs() const { return args_; }
+    };
+
+    // FunctionAST - This class represents a function definition itself.
+    // It owns the arena that holds every node of its body, or shares the mapped file the body was loaded from.
+    class FunctionAST
+    {
+    private:
+        std::unique_ptr<PrototypeAST> proto_;
+        std::unique_ptr<Arena> arena_;
+        std::shared_ptr<const void> image_;
+        ExprAST *body_;
+
+    public:
+        FunctionAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<Arena> arena, ExprAST *body)
+            : proto_{std::move(proto)}, arena_{std::move(arena)}, body_{body} {}
+        FunctionAST(std::unique_ptr<PrototypeAST> proto, std::shared_ptr<const void> image, ExprAST *body)
+            : proto_{std::move(proto)}, image_{std::move(image)}, body_{body} {}
+
+        PrototypeAST const &getProto() const { return *proto_; }
+        ExprAST *getBody() const { return body_; }
+    };
+};
+
+//-----------------------
+// AST utilities
+//-----------------------
+
+// countUses - How many parents refer to each node reachable from root. After CSE a tree becomes a DAG, and a
+// node with more than one use only needs to be computed once.
+inline void countUses(const AST::ExprAST *root, std::unordered_map<const AST::ExprAST *, uint32_t> &uses)
+{
+    if (uses[root]++ > 0)
+    {
+        return;
+    }
+    switch (root->getKind())
+    {
+    case AST::ExprAST::Kind::Binary:
+    {
+        auto bin = static_cast<const AST::BinaryExprAST *>(root);
+        countUses(bin->getLHS(), uses);
+        countUses(bin->getRHS(), uses);
+        break;
+    }
+    case AST::ExprAST::Kind::Call:
+        for (auto arg : static_cast<const AST::CallExprAST *>(root)->getArgs())
+        {
+            countUses(arg, uses);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// countNodes - The number of distinct nodes reachable from root.
+inline size_t countNodes(const AST::ExprAST *root)
+{
+    std::unordered_map<const AST::ExprAST *, uint32_t> uses;
+    countUses(root, uses);
+    return uses.size();
+}
+
+#endif // AST_HPP
@@ -0,0 +1,443 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "module.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KALEIDOSCOPE_AVX2 1
+#else
+#define KALEIDOSCOPE_AVX2 0
+#endif
+
+//-----------------------
+// Batch programs
+//-----------------------
+
+// A BatchProgram evaluates one function over a block of rows at a time. Every register names a whole block of
+// values, so each instruction is a tight loop over the block and interpretation overhead is paid once per block
+// rather than once per row. Calls to user definitions are inlined at compile time; calls to externs remain and
+// run lane by lane.
+enum class BatchOp : uint8_t {
+    Const,  // r[a] = broadcast consts[b]
+    Copy,   // r[a] = r[b]
+    Add,    // r[a] = r[b] + r[c]
+    Sub,    // r[a] = r[b] - r[c]
+    Mul,    // r[a] = r[b] * r[c]
+    Lt,     // r[a] = r[b] < r[c] ? 1.0 : 0.0
+    Native, // r[a] = natives[b](r[native_args[c + 1]], ...) with native_args[c] arguments, per lane
+};
+
+struct BatchInstr
+{
+    BatchOp op;
+    uint16_t a = 0, b = 0, c = 0;
+};
+
+struct BatchProgram
+{
+    size_t num_params = 0;
+    uint16_t num_regs = 0;
+    uint16_t result = 0;
+    std::vector<BatchInstr> code;
+    std::vector<double> consts;
+    std::vector<void *> natives;
+    std::vector<uint16_t> native_args;
+};
+
+//-----------------------
+// Batch compiler
+//-----------------------
+
+// BatchCompiler - Flattens a definition and everything it calls into one BatchProgram.
+// Parameters of an inlined callee simply alias the registers holding its arguments. Recursive definitions and
+// programs that would grow past kMaxInstrs cannot be flattened; compile() returns nullptr for them.
+class BatchCompiler
+{
+public:
+    explicit BatchCompiler(const Module &module) : module_{module} {}
+
+    std::unique_ptr<BatchProgram> compile(const AST::FunctionAST &fn)
+    {
+        auto out = std::make_unique<BatchProgram>();
+        prog_ = out.get();
+        auto const &params = fn.getProto().getArgs();
+        out->num_params = params.size();
+        if (params.size() >= kMaxRegs)
+        {
+            return nullptr;
+        }
+
+        std::vector<uint16_t> regs(params.size());
+        for (size_t i = 0; i < regs.size(); ++i)
+        {
+            regs[i] = static_cast<uint16_t>(i);
+        }
+        next_reg_ = max_reg_ = params.size();
+        depth_ = 0;
+
+        int result = compileExpr(fn.getBody(), regs);
+        if (result < 0)
+        {
+            return nullptr;
+        }
+        out->result = static_cast<uint16_t>(result);
+        out->num_regs = static_cast<uint16_t>(max_reg_);
+        return out;
+    }
+
+private:
+    static constexpr size_t kMaxRegs = UINT16_MAX;
+    static constexpr size_t kMaxInstrs = 1 << 16;
+    static constexpr size_t kMaxInlineDepth = 64;
+
+    int allocReg()
+    {
+        if (next_reg_ >= kMaxRegs)
+        {
+            return -1;
+        }
+        int reg = static_cast<int>(next_reg_++);
+        if (next_reg_ > max_reg_)
+        {
+            max_reg_ = next_reg_;
+        }
+        return reg;
+    }
+
+    bool emit(BatchOp op, int a, int b = 0, int c = 0)
+    {
+        if (prog_->code.size() >= kMaxInstrs)
+        {
+            return false;
+        }
+        BatchInstr in;
+        in.op = op;
+        in.a = static_cast<uint16_t>(a);
+        in.b = static_cast<uint16_t>(b);
+        in.c = static_cast<uint16_t>(c);
+        prog_->code.push_back(in);
+        return true;
+    }
+
+    // compileExpr - Emit code for e, whose variables live in `regs`. Returns the result register or -1.
+    int compileExpr(const AST::ExprAST *e, const std::vector<uint16_t> &regs)
+    {
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+        {
+            int dst = allocReg();
+            prog_->consts.push_back(static_cast<const AST::NumberExprAST *>(e)->getVal());
+            if (dst < 0 || prog_->consts.size() > kMaxRegs ||
+                !emit(BatchOp::Const, dst, static_cast<int>(prog_->consts.size() - 1)))
+            {
+                return -1;
+            }
+            return dst;
+        }
+        case AST::ExprAST::Kind::Variable:
+            return regs[static_cast<const AST::VariableExprAST *>(e)->getIndex()];
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            BatchOp op;
+            switch (bin->getOp())
+            {
+            case '+': op = BatchOp::Add; break;
+            case '-': op = BatchOp::Sub; break;
+            case '*': op = BatchOp::Mul; break;
+            case '<': op = BatchOp::Lt; break;
+            default: return -1;
+            }
+            size_t mark = next_reg_;
+            int l = compileExpr(bin->getLHS(), regs);
+            int r = l < 0 ? -1 : compileExpr(bin->getRHS(), regs);
+            if (r < 0)
+            {
+                return -1;
+            }
+            next_reg_ = mark;
+            int dst = allocReg();
+            return dst >= 0 && emit(op, dst, l, r) ? dst : -1;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            auto slot = module_.findSlot(call->getCallee());
+            auto args = call->getArgs();
+            if (!slot || args.size() != module_.getSlot(*slot).arity())
+            {
+                return -1;
+            }
+
+            size_t mark = next_reg_;
+            std::vector<uint16_t> arg_regs;
+            arg_regs.reserve(args.size());
+            for (auto arg : args)
+            {
+                int r = compileExpr(arg, regs);
+                if (r < 0)
+                {
+                    return -1;
+                }
+                // Keep each argument live while the rest (and an inlined body) are computed.
+                if (static_cast<size_t>(r) >= next_reg_)
+                {
+                    next_reg_ = r + 1;
+                }
+                arg_regs.push_back(static_cast<uint16_t>(r));
+            }
+
+            auto const &target = module_.getSlot(*slot);
+            int result;
+            if (target.native)
+            {
+                prog_->natives.push_back(target.native);
+                size_t site = prog_->native_args.size();
+                prog_->native_args.push_back(static_cast<uint16_t>(arg_regs.size()));
+                prog_->native_args.insert(prog_->native_args.end(), arg_regs.begin(), arg_regs.end());
+                next_reg_ = mark;
+                int dst = allocReg();
+                if (dst < 0 || site > UINT16_MAX ||
+                    !emit(BatchOp::Native, dst, static_cast<int>(prog_->natives.size() - 1), static_cast<int>(site)))
+                {
+                    return -1;
+                }
+                return dst;
+            }
+
+            if (++depth_ > kMaxInlineDepth)
+            {
+                return -1;
+            }
+            result = compileExpr(target.function->getBody(), arg_regs);
+            --depth_;
+            if (result < 0)
+            {
+                return -1;
+            }
+            next_reg_ = mark;
+            int dst = allocReg();
+            if (dst < 0)
+            {
+                return -1;
+            }
+            if (dst != result && !emit(BatchOp::Copy, dst, result))
+            {
+                return -1;
+            }
+            return dst;
+        }
+        }
+        return -1;
+    }
+
+    const Module &module_;
+    BatchProgram *prog_ = nullptr;
+    size_t next_reg_ = 0;
+    size_t max_reg_ = 0;
+    size_t depth_ = 0;
+};
+
+//-----------------------
+// Block kernels
+//-----------------------
+
+// Each kernel applies one operation to n lanes. The AVX2 versions handle eight lanes per iteration (two 4-wide
+// vectors) and are selected at run time; the scalar versions are the fallback on other CPUs.
+struct BatchKernels
+{
+    void (*add)(double *, const double *, const double *, size_t);
+    void (*sub)(double *, const double *, const double *, size_t);
+    void (*mul)(double *, const double *, const double *, size_t);
+    void (*lt)(double *, const double *, const double *, size_t);
+
+    static void addScalar(double *d, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            d[i] = a[i] + b[i];
+        }
+    }
+    static void subScalar(double *d, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            d[i] = a[i] - b[i];
+        }
+    }
+    static void mulScalar(double *d, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            d[i] = a[i] * b[i];
+        }
+    }
+    static void ltScalar(double *d, const double *a, const double *b, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            d[i] = a[i] < b[i] ? 1.0 : 0.0;
+        }
+    }
+
+#if KALEIDOSCOPE_AVX2
+#define BATCH_AVX2_KERNEL(name, expr, scalar)                                              \
+    __attribute__((target("avx2"))) static void name(double *d, const double *a, const double *b, size_t n) \
+    {                                                                                      \
+        size_t i = 0;                                                                      \
+        for (; i + 8 <= n; i += 8)                                                         \
+        {                                                                                  \
+            __m256d x0 = _mm256_loadu_pd(a + i), y0 = _mm256_loadu_pd(b + i);              \
+            __m256d x1 = _mm256_loadu_pd(a + i + 4), y1 = _mm256_loadu_pd(b + i + 4);      \
+            _mm256_storeu_pd(d + i, expr(x0, y0));                                         \
+            _mm256_storeu_pd(d + i + 4, expr(x1, y1));                                     \
+        }                                                                                  \
+        scalar(d + i, a + i, b + i, n - i);                                                \
+    }
+
+    __attribute__((target("avx2"))) static __m256d ltMask(__m256d x, __m256d y)
+    {
+        return _mm256_and_pd(_mm256_cmp_pd(x, y, _CMP_LT_OQ), _mm256_set1_pd(1.0));
+    }
+
+    BATCH_AVX2_KERNEL(addAvx2, _mm256_add_pd, addScalar)
+    BATCH_AVX2_KERNEL(subAvx2, _mm256_sub_pd, subScalar)
+    BATCH_AVX2_KERNEL(mulAvx2, _mm256_mul_pd, mulScalar)
+    BATCH_AVX2_KERNEL(ltAvx2, ltMask, ltScalar)
+#undef BATCH_AVX2_KERNEL
+#endif
+
+    static const BatchKernels &select()
+    {
+        static const BatchKernels kernels = [] {
+#if KALEIDOSCOPE_AVX2
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return BatchKernels{addAvx2, subAvx2, mulAvx2, ltAvx2};
+            }
+#endif
+            return BatchKernels{addScalar, subScalar, mulScalar, ltScalar};
+        }();
+        return kernels;
+    }
+};
+
+//-----------------------
+// Batch evaluator
+//-----------------------
+
+// BatchEvaluator - Runs a function over columns of arguments, kBlock rows at a time.
+// A register is a pointer to a block of values: parameters point straight into the input columns and constants
+// into blocks broadcast once per run, so only arithmetic results are ever written, into per-register scratch.
+class BatchEvaluator
+{
+public:
+    static constexpr size_t kBlock = 256;
+
+    explicit BatchEvaluator(const Module &module) : module_{module}, compiler_{module} {}
+
+    // evaluate - out[i] = fn(columns[0][i], columns[1][i], ...) for every row. Definitions that cannot be
+    // flattened are evaluated row by row instead.
+    void evaluate(const AST::FunctionAST &fn, const double *const *columns, size_t rows, double *out)
+    {
+        if (auto prog = compiler_.compile(fn))
+        {
+            run(*prog, columns, rows, out);
+            return;
+        }
+        TreeEvaluator scalar{module_};
+        std::vector<double> args(fn.getProto().getArgs().size());
+        for (size_t i = 0; i < rows; ++i)
+        {
+            for (size_t p = 0; p < args.size(); ++p)
+            {
+                args[p] = columns[p][i];
+            }
+            out[i] = scalar.call(fn, args.data());
+        }
+    }
+
+    void run(const BatchProgram &prog, const double *const *columns, size_t rows, double *out)
+    {
+        const BatchKernels &k = BatchKernels::select();
+        scratch_.resize(static_cast<size_t>(prog.num_regs) * kBlock);
+        consts_.resize(prog.consts.size() * kBlock);
+        for (size_t c = 0; c < prog.consts.size(); ++c)
+        {
+            std::fill_n(consts_.data() + c * kBlock, kBlock, prog.consts[c]);
+        }
+        regs_.assign(prog.num_regs, nullptr);
+
+        for (size_t base = 0; base < rows; base += kBlock)
+        {
+            size_t n = rows - base < kBlock ? rows - base : kBlock;
+            for (size_t p = 0; p < prog.num_params; ++p)
+            {
+                regs_[p] = columns[p] + base;
+            }
+
+            for (const BatchInstr &in : prog.code)
+            {
+                double *dst = scratch_.data() + static_cast<size_t>(in.a) * kBlock;
+                switch (in.op)
+                {
+                case BatchOp::Const:
+                    regs_[in.a] = consts_.data() + static_cast<size_t>(in.b) * kBlock;
+                    continue;
+                case BatchOp::Copy:
+                    // Scratch blocks get reused, so only aliases of immutable blocks may be shared.
+                    if (regs_[in.b] == scratch_.data() + static_cast<size_t>(in.b) * kBlock)
+                    {
+                        memcpy(dst, regs_[in.b], n * sizeof(double));
+                        regs_[in.a] = dst;
+                    }
+                    else
+                    {
+                        regs_[in.a] = regs_[in.b];
+                    }
+                    continue;
+                case BatchOp::Add: k.add(dst, regs_[in.b], regs_[in.c], n); break;
+                case BatchOp::Sub: k.sub(dst, regs_[in.b], regs_[in.c], n); break;
+                case BatchOp::Mul: k.mul(dst, regs_[in.b], regs_[in.c], n); break;
+                case BatchOp::Lt: k.lt(dst, regs_[in.b], regs_[in.c], n); break;
+                case BatchOp::Native:
+                {
+                    const uint16_t *site = prog.native_args.data() + in.c;
+                    double argv[kMaxNativeArgs];
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        for (size_t a = 0; a < site[0]; ++a)
+                        {
+                            argv[a] = regs_[site[1 + a]][i];
+                        }
+                        dst[i] = callNative(prog.natives[in.b], argv, site[0]);
+                    }
+                    break;
+                }
+                }
+                regs_[in.a] = dst;
+            }
+            memcpy(out + base, regs_[prog.result], n * sizeof(double));
+        }
+    }
+
+private:
+    const Module &module_;
+    BatchCompiler compiler_;
+    std::vector<double> scratch_;
+    std::vector<double> consts_;
+    std::vector<const double *> regs_;
+};
+
+#endif // BATCH_HPP
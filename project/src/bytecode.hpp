@@ -0,0 +1,294 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fmt/core.h>
+
+#include "ast.hpp"
+#include "module.hpp"
+
+//-----------------------
+// Bytecode
+//-----------------------
+
+// A function compiles to straight-line register code. Registers are doubles in a per-call frame:
+// r0..rN-1 hold the parameters and the rest are temporaries.
+enum class Op : uint8_t {
+    LoadK, // r[a] = consts[b]
+    Move,  // r[a] = r[b]
+    Add,   // r[a] = r[b] + r[c]
+    Sub,   // r[a] = r[b] - r[c]
+    Mul,   // r[a] = r[b] * r[c]
+    Lt,    // r[a] = r[b] < r[c] ? 1.0 : 0.0
+    Call,  // r[a] = callees[b](r[call_args[c + 1]], ...) with call_args[c] arguments
+    Ret,   // return r[a]
+};
+
+struct Instr
+{
+    Op op;
+    uint8_t unused = 0;
+    uint16_t a = 0, b = 0, c = 0;
+};
+static_assert(sizeof(Instr) == 8, "instructions are packed into one word");
+
+// BytecodeFunction - The compiled form of one FunctionAST.
+struct BytecodeFunction
+{
+    Symbol name;
+    uint16_t num_params = 0;
+    uint16_t num_regs = 0;
+    std::vector<Instr> code;
+    std::vector<double> consts;
+    std::vector<uint16_t> call_args; // Per call site: argument count, then the argument registers.
+    std::vector<uint32_t> callees;   // Module slots called by this function.
+};
+
+//-----------------------
+// Bytecode compiler
+//-----------------------
+
+// BytecodeCompiler - Lowers an expression tree (or DAG, after CSE) to register code.
+// Temporaries are handed out stack-wise: once a node's operands have been consumed their registers are free again,
+// so a frame needs as many registers as the tree is deep rather than as many as it has nodes. A node with several
+// parents gets a register of its own, right after the parameters, and is computed only at its first use.
+class BytecodeCompiler
+{
+public:
+    explicit BytecodeCompiler(const Module &module) : module_{module} {}
+
+    std::unique_ptr<BytecodeFunction> compile(const AST::FunctionAST &fn)
+    {
+        auto out = std::make_unique<BytecodeFunction>();
+        auto const &params = fn.getProto().getArgs();
+        out->name = fn.getProto().getName();
+        out->num_params = static_cast<uint16_t>(params.size());
+
+        fn_ = out.get();
+        failed_ = false;
+
+        uses_.clear();
+        shared_.clear();
+        countUses(fn.getBody(), uses_);
+        size_t num_shared = 0;
+        for (auto const &use : uses_)
+        {
+            num_shared += isShared(use.first) ? 1 : 0;
+        }
+        next_shared_ = out->num_params;
+        next_reg_ = max_reg_ = out->num_params + num_shared;
+        if (max_reg_ >= kMaxRegs)
+        {
+            logError("expression needs too many registers");
+            return nullptr;
+        }
+
+        int result = compileExpr(fn.getBody());
+        if (failed_ || result < 0)
+        {
+            return nullptr;
+        }
+        emit(Op::Ret, static_cast<uint16_t>(result));
+        out->num_regs = static_cast<uint16_t>(max_reg_);
+        return out;
+    }
+
+private:
+    static constexpr size_t kMaxRegs = UINT16_MAX;
+
+    int logError(const char *str)
+    {
+        if (!failed_)
+        {
+            fmt::print(stderr, "Error: {}\n", str);
+        }
+        failed_ = true;
+        return -1;
+    }
+
+    void emit(Op op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0)
+    {
+        Instr in;
+        in.op = op;
+        in.a = a;
+        in.b = b;
+        in.c = c;
+        fn_->code.push_back(in);
+    }
+
+    int allocReg()
+    {
+        if (next_reg_ >= kMaxRegs)
+        {
+            return logError("expression needs too many registers");
+        }
+        int reg = static_cast<int>(next_reg_++);
+        if (next_reg_ > max_reg_)
+        {
+            max_reg_ = next_reg_;
+        }
+        return reg;
+    }
+
+    bool isShared(const AST::ExprAST *e) const
+    {
+        auto kind = e->getKind();
+        return (kind == AST::ExprAST::Kind::Binary || kind == AST::ExprAST::Kind::Call) && uses_.at(e) > 1;
+    }
+
+    // compileExpr - Emit code for e and return the register that holds its value, or -1 on error.
+    int compileExpr(const AST::ExprAST *e)
+    {
+        if (!isShared(e))
+        {
+            return compileNode(e, -1);
+        }
+        auto it = shared_.find(e);
+        if (it != shared_.end())
+        {
+            return it->second;
+        }
+        int reg = compileNode(e, static_cast<int>(next_shared_++));
+        shared_.emplace(e, reg);
+        return reg;
+    }
+
+    // compileNode - Emit code for e into register dst, or into a fresh temporary if dst is -1.
+    int compileNode(const AST::ExprAST *e, int dst)
+    {
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+        {
+            dst = dst >= 0 ? dst : allocReg();
+            if (dst < 0)
+            {
+                return -1;
+            }
+            emit(Op::LoadK, static_cast<uint16_t>(dst), static_cast<uint16_t>(constant(
+                static_cast<const AST::NumberExprAST *>(e)->getVal())));
+            return dst;
+        }
+        case AST::ExprAST::Kind::Variable:
+            return static_cast<int>(static_cast<const AST::VariableExprAST *>(e)->getIndex());
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            Op op;
+            switch (bin->getOp())
+            {
+            case '+': op = Op::Add; break;
+            case '-': op = Op::Sub; break;
+            case '*': op = Op::Mul; break;
+            case '<': op = Op::Lt; break;
+            default: return logError("invalid binary operator");
+            }
+
+            size_t mark = next_reg_;
+            int l = compileExpr(bin->getLHS());
+            int r = l < 0 ? -1 : compileExpr(bin->getRHS());
+            if (r < 0)
+            {
+                return -1;
+            }
+            next_reg_ = mark;
+            dst = dst >= 0 ? dst : allocReg();
+            if (dst < 0)
+            {
+                return -1;
+            }
+            emit(op, static_cast<uint16_t>(dst), static_cast<uint16_t>(l), static_cast<uint16_t>(r));
+            return dst;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            auto slot = module_.findSlot(call->getCallee());
+            if (!slot)
+            {
+                return logError("Unknown function referenced");
+            }
+            auto args = call->getArgs();
+            if (args.size() != module_.getSlot(*slot).arity())
+            {
+                return logError("Incorrect # arguments passed");
+            }
+
+            // Arguments stay wherever they were computed; the call site lists their registers.
+            size_t mark = next_reg_;
+            std::vector<uint16_t> regs;
+            regs.reserve(args.size());
+            for (auto arg : args)
+            {
+                int r = compileExpr(arg);
+                if (r < 0)
+                {
+                    return -1;
+                }
+                regs.push_back(static_cast<uint16_t>(r));
+            }
+            next_reg_ = mark;
+            dst = dst >= 0 ? dst : allocReg();
+            if (dst < 0)
+            {
+                return -1;
+            }
+
+            size_t site = fn_->call_args.size();
+            if (site > UINT16_MAX)
+            {
+                return logError("too many call sites");
+            }
+            fn_->call_args.push_back(static_cast<uint16_t>(regs.size()));
+            fn_->call_args.insert(fn_->call_args.end(), regs.begin(), regs.end());
+            emit(Op::Call, static_cast<uint16_t>(dst), callee(*slot), static_cast<uint16_t>(site));
+            return dst;
+        }
+        }
+        return logError("unknown expression kind");
+    }
+
+    size_t constant(double val)
+    {
+        // Compare bit patterns: 0.0 and -0.0 are different constants, and a NaN still matches itself.
+        for (size_t i = 0; i < fn_->consts.size(); ++i)
+        {
+            if (memcmp(&fn_->consts[i], &val, sizeof(double)) == 0)
+            {
+                return i;
+            }
+        }
+        fn_->consts.push_back(val);
+        return fn_->consts.size() - 1;
+    }
+
+    uint16_t callee(uint32_t slot)
+    {
+        for (size_t i = 0; i < fn_->callees.size(); ++i)
+        {
+            if (fn_->callees[i] == slot)
+            {
+                return static_cast<uint16_t>(i);
+            }
+        }
+        fn_->callees.push_back(slot);
+        return static_cast<uint16_t>(fn_->callees.size() - 1);
+    }
+
+    const Module &module_;
+    BytecodeFunction *fn_ = nullptr;
+    size_t next_reg_ = 0;
+    size_t max_reg_ = 0;
+    size_t next_shared_ = 0;
+    bool failed_ = false;
+    std::unordered_map<const AST::ExprAST *, uint32_t> uses_;
+    std::unordered_map<const AST::ExprAST *, int> shared_;
+};
+
+#endif // BYTECODE_HPP
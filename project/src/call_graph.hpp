@@ -0,0 +1,114 @@
+#ifndef CALL_GRAPH_HPP
+#define CALL_GRAPH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ast.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Call graph
+//-----------------------
+
+// CallGraph - Which definitions call which names, taken from the calls in each body as parsed.
+// Edges are kept in both directions, by symbol, so a name can have callers before it is defined. Everything
+// compiled for a definition - its inlined callees, its direct calls into their native code, the arity it was
+// checked against - depends only on names it reaches through these edges, so after a name is rebound only its
+// dependents need compiling again.
+class CallGraph
+{
+public:
+    // setCallees - Replace the names that fn calls, as when it is (re)defined. An extern calls nothing.
+    void setCallees(Symbol fn, std::vector<Symbol> callees)
+    {
+        std::sort(callees.begin(), callees.end());
+        callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+
+        grow(fn);
+        for (Symbol callee : callees_[fn])
+        {
+            auto &callers = callers_[callee];
+            callers.erase(std::find(callers.begin(), callers.end(), fn));
+        }
+        for (Symbol callee : callees)
+        {
+            grow(callee);
+            callers_[callee].push_back(fn);
+        }
+        callees_[fn] = std::move(callees);
+    }
+
+    // dependents - name, followed by every definition that calls it directly or indirectly. Takes time in
+    // proportion to the answer, not to the size of the graph.
+    std::vector<Symbol> dependents(Symbol name)
+    {
+        grow(name);
+        if (++epoch_ == 0)
+        {
+            std::fill(seen_.begin(), seen_.end(), 0);
+            epoch_ = 1;
+        }
+        std::vector<Symbol> out{name};
+        seen_[name] = epoch_;
+        for (size_t i = 0; i < out.size(); ++i)
+        {
+            for (Symbol caller : callers_[out[i]])
+            {
+                if (seen_[caller] != epoch_)
+                {
+                    seen_[caller] = epoch_;
+                    out.push_back(caller);
+                }
+            }
+        }
+        return out;
+    }
+
+    // collectCallees - Append the name of every call in body to out.
+    static void collectCallees(const AST::ExprAST *body, std::vector<Symbol> &out)
+    {
+        switch (body->getKind())
+        {
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(body);
+            collectCallees(bin->getLHS(), out);
+            collectCallees(bin->getRHS(), out);
+            break;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(body);
+            out.push_back(call->getCallee());
+            for (auto arg : call->getArgs())
+            {
+                collectCallees(arg, out);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+private:
+    void grow(Symbol sym)
+    {
+        if (sym >= callees_.size())
+        {
+            callees_.resize(sym + 1);
+            callers_.resize(sym + 1);
+            seen_.resize(sym + 1, 0);
+        }
+    }
+
+    std::vector<std::vector<Symbol>> callees_; // By caller.
+    std::vector<std::vector<Symbol>> callers_; // By callee.
+    std::vector<uint32_t> seen_;               // Equal to epoch_ for names already visited by dependents().
+    uint32_t epoch_ = 0;
+};
+
+#endif // CALL_GRAPH_HPP
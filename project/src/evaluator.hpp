@@ -0,0 +1,112 @@
+#ifndef EVALUATOR_HPP
+#define EVALUATOR_HPP
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "ast.hpp"
+#include "module.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Tree-walking evaluator
+//-----------------------
+
+// TreeEvaluator - Runs a FunctionAST by walking its body directly.
+// Callees are looked up in the module at every call, so this is the simple reference the compiled engines are
+// checked and measured against.
+class TreeEvaluator
+{
+public:
+    explicit TreeEvaluator(const Module &module) : module_{module} {}
+
+    double call(const AST::FunctionAST &fn, const double *args)
+    {
+        DepthGuard guard{depth_};
+        if (depth_ > kMaxDepth)
+        {
+            throw std::runtime_error("call depth exceeded");
+        }
+        return eval(fn.getBody(), args);
+    }
+
+private:
+    static constexpr size_t kMaxDepth = 10000;
+
+    struct DepthGuard
+    {
+        size_t &depth;
+        explicit DepthGuard(size_t &d) : depth{d} { ++depth; }
+        ~DepthGuard() { --depth; }
+    };
+
+    double eval(const AST::ExprAST *e, const double *args)
+    {
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+            return static_cast<const AST::NumberExprAST *>(e)->getVal();
+        case AST::ExprAST::Kind::Variable:
+            return args[static_cast<const AST::VariableExprAST *>(e)->getIndex()];
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            double l = eval(bin->getLHS(), args);
+            double r = eval(bin->getRHS(), args);
+            switch (bin->getOp())
+            {
+            case '+': return l + r;
+            case '-': return l - r;
+            case '*': return l * r;
+            case '<': return l < r ? 1.0 : 0.0;
+            default: throw std::runtime_error(std::string("invalid binary operator ") + bin->getOp());
+            }
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call_expr = static_cast<const AST::CallExprAST *>(e);
+            auto slot = module_.findSlot(call_expr->getCallee());
+            if (!slot)
+            {
+                throw std::runtime_error("Unknown function referenced " +
+                                         std::string(symbols().name(call_expr->getCallee())));
+            }
+            auto const &target = module_.getSlot(*slot);
+            auto call_args = call_expr->getArgs();
+            if (call_args.size() != target.arity())
+            {
+                throw std::runtime_error("Incorrect # arguments passed");
+            }
+
+            double values[kMaxInlineArgs];
+            std::unique_ptr<double[]> spill;
+            double *argv = values;
+            if (call_args.size() > kMaxInlineArgs)
+            {
+                spill.reset(new double[call_args.size()]);
+                argv = spill.get();
+            }
+            for (size_t i = 0; i < call_args.size(); ++i)
+            {
+                argv[i] = eval(call_args[i], args);
+            }
+
+            if (target.native)
+            {
+                return callNative(target.native, argv, call_args.size());
+            }
+            return call(*target.function, argv);
+        }
+        }
+        return 0.0;
+    }
+
+    static constexpr size_t kMaxInlineArgs = 8;
+
+    const Module &module_;
+    size_t depth_ = 0;
+};
+
+#endif // EVALUATOR_HPP
@@ -0,0 +1,478 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ast.hpp"
+#include "module.hpp"
+
+#if defined(__x86_64__) && defined(__linux__) || defined(__x86_64__) && defined(__APPLE__)
+#define KALEIDOSCOPE_JIT 1
+#else
+#define KALEIDOSCOPE_JIT 0
+#endif
+
+//-----------------------
+// Executable memory
+//-----------------------
+
+// CodeRegion - One reserved range of address space that all JIT'd code is bump-allocated from.
+// Keeping every function in the same range lets them call each other with 32-bit relative calls. Pages are
+// writable only while code is being copied in and read+execute otherwise.
+class CodeRegion
+{
+public:
+    explicit CodeRegion(size_t reserve = 64 << 20) : size_{reserve}
+    {
+        void *p = mmap(nullptr, size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        base_ = p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
+        page_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+    CodeRegion(const CodeRegion &) = delete;
+    CodeRegion &operator=(const CodeRegion &) = delete;
+
+    ~CodeRegion()
+    {
+        if (base_)
+        {
+            munmap(base_, size_);
+        }
+    }
+
+    // cursor - Where the next function will be placed.
+    uint8_t *cursor() const { return base_ ? base_ + used_ : nullptr; }
+
+    // commit - Copy code in at the cursor and make it executable. Returns its address, or nullptr when full.
+    void *commit(const std::vector<uint8_t> &code)
+    {
+        if (!base_ || used_ + code.size() > size_)
+        {
+            return nullptr;
+        }
+        uint8_t *dst = base_ + used_;
+        uint8_t *first = pageDown(dst);
+        uint8_t *last = pageUp(dst + code.size());
+        if (mprotect(first, last - first, PROT_READ | PROT_WRITE) != 0)
+        {
+            return nullptr;
+        }
+        memcpy(dst, code.data(), code.size());
+        mprotect(first, last - first, PROT_READ | PROT_EXEC);
+        used_ = (used_ + code.size() + 15) & ~size_t(15);
+        return dst;
+    }
+
+    // rewind - Give back everything placed after `mark` (a previous cursor()).
+    void rewind(uint8_t *mark)
+    {
+        if (mark >= base_ && mark <= base_ + used_)
+        {
+            used_ = mark - base_;
+        }
+    }
+
+private:
+    uint8_t *pageDown(uint8_t *p) const { return base_ + ((p - base_) & ~(page_ - 1)); }
+    uint8_t *pageUp(uint8_t *p) const { return base_ + (((p - base_) + page_ - 1) & ~(page_ - 1)); }
+
+    uint8_t *base_ = nullptr;
+    size_t size_;
+    size_t used_ = 0;
+    size_t page_;
+};
+
+//-----------------------
+// x86-64 assembler
+//-----------------------
+
+// X64Assembler - Just the SSE2 scalar-double and frame instructions the JIT needs.
+// Only xmm0-xmm7 are used, so no REX prefix is needed except for 64-bit moves.
+class X64Assembler
+{
+public:
+    const std::vector<uint8_t> &bytes() const { return buf_; }
+
+    void pushRbp() { byte(0x55); }
+    void movRbpRsp() { bytes3(0x48, 0x89, 0xE5); }
+    // sub rsp, imm32. Returns the offset of the immediate.
+    size_t subRsp(int32_t n)
+    {
+        bytes3(0x48, 0x81, 0xEC);
+        imm32(n);
+        return buf_.size() - 4;
+    }
+    void patch32(size_t at, int32_t v) { memcpy(&buf_[at], &v, sizeof(v)); }
+    void leave() { byte(0xC9); }
+    void ret() { byte(0xC3); }
+
+    // movsd [rbp+disp], xmm
+    void storeSd(int32_t disp, int xmm) { sse(0xF2, 0x11); memRbp(xmm, disp); }
+    // movsd xmm, [rbp+disp]
+    void loadSd(int xmm, int32_t disp) { sse(0xF2, 0x10); memRbp(xmm, disp); }
+    // addsd/subsd/mulsd xmm, [rbp+disp]
+    void arithSdMem(char op, int xmm, int32_t disp) { sse(0xF2, arithOpcode(op)); memRbp(xmm, disp); }
+    // addsd/subsd/mulsd dst, src
+    void arithSd(char op, int dst, int src) { sse(0xF2, arithOpcode(op)); regReg(dst, src); }
+    // cmpltsd dst, src: dst = dst < src ? all ones : 0
+    void cmpLtSd(int dst, int src) { sse(0xF2, 0xC2); regReg(dst, src); byte(0x01); }
+    // andpd dst, src
+    void andPd(int dst, int src) { sse(0x66, 0x54); regReg(dst, src); }
+    // movapd dst, src
+    void movApd(int dst, int src) { sse(0x66, 0x28); regReg(dst, src); }
+
+    // Load a double constant through rax.
+    void loadConst(int xmm, double val)
+    {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        bytes2(0x48, 0xB8); // mov rax, imm64
+        for (int i = 0; i < 8; ++i)
+        {
+            byte(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+        byte(0x66); // movq xmm, rax
+        bytes3(0x48, 0x0F, 0x6E);
+        regReg(xmm, 0);
+    }
+
+    // call rel32 to an absolute address; resolved by relocate() once the code's final address is known.
+    void callRel(const void *target)
+    {
+        byte(0xE8);
+        relocs_.push_back(Reloc{buf_.size(), target});
+        imm32(0);
+    }
+
+    // relocate - Fill in relative calls for code placed at `at`. Fails if a target is out of rel32 range.
+    bool relocate(const uint8_t *at)
+    {
+        for (const Reloc &r : relocs_)
+        {
+            int64_t rel = static_cast<const uint8_t *>(r.target) - (at + r.offset + 4);
+            if (!at || rel < INT32_MIN || rel > INT32_MAX)
+            {
+                return false;
+            }
+            patch32(r.offset, static_cast<int32_t>(rel));
+        }
+        return true;
+    }
+
+    // mov rax, imm64; call rax
+    void callAbs(const void *target)
+    {
+        uint64_t addr = reinterpret_cast<uint64_t>(target);
+        bytes2(0x48, 0xB8);
+        for (int i = 0; i < 8; ++i)
+        {
+            byte(static_cast<uint8_t>(addr >> (8 * i)));
+        }
+        bytes2(0xFF, 0xD0);
+    }
+
+private:
+    static uint8_t arithOpcode(char op) { return op == '+' ? 0x58 : op == '-' ? 0x5C : 0x59; }
+
+    void byte(uint8_t b) { buf_.push_back(b); }
+    void bytes2(uint8_t a, uint8_t b) { byte(a); byte(b); }
+    void bytes3(uint8_t a, uint8_t b, uint8_t c) { byte(a); byte(b); byte(c); }
+    void imm32(int32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            byte(static_cast<uint8_t>(static_cast<uint32_t>(v) >> (8 * i)));
+        }
+    }
+    void sse(uint8_t prefix, uint8_t opcode) { bytes3(prefix, 0x0F, opcode); }
+    void regReg(int reg, int rm) { byte(static_cast<uint8_t>(0xC0 | (reg << 3) | rm)); }
+    void memRbp(int reg, int32_t disp)
+    {
+        byte(static_cast<uint8_t>(0x80 | (reg << 3) | 5)); // [rbp + disp32]
+        imm32(disp);
+    }
+
+    struct Reloc
+    {
+        size_t offset;
+        const void *target;
+    };
+
+    std::vector<uint8_t> buf_;
+    std::vector<Reloc> relocs_;
+};
+
+//-----------------------
+// JIT
+//-----------------------
+
+// JIT - Template compiler from FunctionAST to native code that follows the System V calling convention, so a
+// compiled definition of n parameters can be called as a double(*)(double...) of arity n.
+// The body is generated with xmm0 as an accumulator: a binary node whose right operand is a leaf applies it
+// directly, anything else spills the left value to a frame slot. A node shared by several parents (after CSE) is
+// stored to a slot of its own at first use and reloaded afterwards. Calls to other JIT'd definitions are direct
+// relative calls and calls to externs go through their absolute address. compile() returns nullptr for anything
+// it does not handle (too many parameters, callees that only exist as bytecode, an unsupported CPU), and the
+// caller falls back to the interpreter.
+class JIT
+{
+public:
+    static constexpr size_t kMaxArgs = 8; // xmm0-xmm7
+
+    explicit JIT(const Module &module) : module_{module} {}
+
+    // compile - Generate native code for fn. Returns its entry point or nullptr.
+    void *compile(const AST::FunctionAST &fn)
+    {
+#if KALEIDOSCOPE_JIT
+        auto const &params = fn.getProto().getArgs();
+        if (params.size() > kMaxArgs)
+        {
+            return nullptr;
+        }
+
+        params_ = &params;
+        next_temp_ = max_temps_ = 0;
+        uses_.clear();
+        shared_.clear();
+        countUses(fn.getBody(), uses_);
+        num_shared_ = 0;
+        for (auto const &use : uses_)
+        {
+            num_shared_ += isShared(use.first) ? 1 : 0;
+        }
+        X64Assembler code;
+        asm_ = &code;
+
+        code.pushRbp();
+        code.movRbpRsp();
+        size_t frame_at = code.subRsp(0); // Patched once the number of temporaries is known.
+        for (size_t i = 0; i < params.size(); ++i)
+        {
+            code.storeSd(paramSlot(i), static_cast<int>(i));
+        }
+        if (!genExpr(fn.getBody()))
+        {
+            return nullptr;
+        }
+        code.leave();
+        code.ret();
+
+        size_t slots = params.size() + num_shared_ + max_temps_;
+        code.patch32(frame_at, static_cast<int32_t>((slots * 8 + 15) & ~size_t(15)));
+        if (!code.relocate(region_.cursor()))
+        {
+            return nullptr;
+        }
+        return region_.commit(code.bytes());
+#else
+        (void)fn;
+        return nullptr;
+#endif
+    }
+
+    // define - Record the native code for a module slot so later definitions can call it directly. Defining it
+    // as nullptr forgets the slot's code; that stays mapped, but is no longer called.
+    void define(uint32_t slot, void *code)
+    {
+        if (slot >= code_.size())
+        {
+            code_.resize(slot + 1, nullptr);
+        }
+        code_[slot] = code;
+    }
+
+    void *lookup(uint32_t slot) const { return slot < code_.size() ? code_[slot] : nullptr; }
+
+    // mark/rewind - Reclaim code for one-off functions such as top-level expressions.
+    uint8_t *mark() const { return region_.cursor(); }
+    void rewind(uint8_t *mark) { region_.rewind(mark); }
+
+private:
+    static int32_t paramSlot(size_t i) { return -8 * static_cast<int32_t>(i + 1); }
+    int32_t sharedSlot(size_t k) const { return -8 * static_cast<int32_t>(params_->size() + k + 1); }
+    int32_t tempSlot(size_t t) const { return -8 * static_cast<int32_t>(params_->size() + num_shared_ + t + 1); }
+
+    bool isShared(const AST::ExprAST *e) const
+    {
+        auto kind = e->getKind();
+        return (kind == AST::ExprAST::Kind::Binary || kind == AST::ExprAST::Kind::Call) && uses_.at(e) > 1;
+    }
+
+    size_t allocTemp()
+    {
+        size_t t = next_temp_++;
+        if (next_temp_ > max_temps_)
+        {
+            max_temps_ = next_temp_;
+        }
+        return t;
+    }
+
+    static int paramIndex(const AST::ExprAST *e)
+    {
+        return static_cast<int>(static_cast<const AST::VariableExprAST *>(e)->getIndex());
+    }
+
+    // genLeaf - Put a leaf into xmm, or return false if e is not a leaf.
+    bool genLeaf(const AST::ExprAST *e, int xmm)
+    {
+        if (e->getKind() == AST::ExprAST::Kind::Number)
+        {
+            asm_->loadConst(xmm, static_cast<const AST::NumberExprAST *>(e)->getVal());
+            return true;
+        }
+        if (e->getKind() == AST::ExprAST::Kind::Variable)
+        {
+            asm_->loadSd(xmm, paramSlot(paramIndex(e)));
+            return true;
+        }
+        return false;
+    }
+
+    // genExpr - Emit code leaving the value of e in xmm0.
+    bool genExpr(const AST::ExprAST *e)
+    {
+        if (!isShared(e))
+        {
+            return genNode(e);
+        }
+        auto it = shared_.find(e);
+        if (it != shared_.end())
+        {
+            asm_->loadSd(0, sharedSlot(it->second));
+            return true;
+        }
+        if (!genNode(e))
+        {
+            return false;
+        }
+        size_t k = shared_.size();
+        shared_.emplace(e, k);
+        asm_->storeSd(sharedSlot(k), 0);
+        return true;
+    }
+
+    bool genNode(const AST::ExprAST *e)
+    {
+        if (genLeaf(e, 0))
+        {
+            return true;
+        }
+
+        if (e->getKind() == AST::ExprAST::Kind::Binary)
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            char op = bin->getOp();
+            if (op != '+' && op != '-' && op != '*' && op != '<')
+            {
+                return false;
+            }
+            if (!genExpr(bin->getLHS()))
+            {
+                return false;
+            }
+
+            const AST::ExprAST *rhs = bin->getRHS();
+            if (rhs->getKind() == AST::ExprAST::Kind::Variable && op != '<')
+            {
+                asm_->arithSdMem(op, 0, paramSlot(paramIndex(rhs)));
+                return true;
+            }
+
+            if (!genLeaf(rhs, 1))
+            {
+                size_t t = allocTemp();
+                asm_->storeSd(tempSlot(t), 0);
+                bool rhs_ok = genExpr(rhs);
+                --next_temp_;
+                if (!rhs_ok)
+                {
+                    return false;
+                }
+                asm_->movApd(1, 0);
+                asm_->loadSd(0, tempSlot(t));
+            }
+
+            if (op == '<')
+            {
+                asm_->cmpLtSd(0, 1);
+                asm_->loadConst(1, 1.0);
+                asm_->andPd(0, 1);
+            }
+            else
+            {
+                asm_->arithSd(op, 0, 1);
+            }
+            return true;
+        }
+
+        if (e->getKind() == AST::ExprAST::Kind::Call)
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            auto slot = module_.findSlot(call->getCallee());
+            auto args = call->getArgs();
+            if (!slot || args.size() > kMaxArgs || args.size() != module_.getSlot(*slot).arity())
+            {
+                return false;
+            }
+            const void *target = module_.getSlot(*slot).native;
+            bool direct = false;
+            if (!target)
+            {
+                target = lookup(*slot);
+                direct = true;
+            }
+            if (!target)
+            {
+                return false;
+            }
+
+            // Every argument is spilled, since evaluating a later one may itself make calls.
+            size_t first = next_temp_;
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                if (!genExpr(args[i]))
+                {
+                    return false;
+                }
+                asm_->storeSd(tempSlot(allocTemp()), 0);
+            }
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                asm_->loadSd(static_cast<int>(i), tempSlot(first + i));
+            }
+            next_temp_ = first;
+
+            if (direct)
+            {
+                asm_->callRel(target);
+                return true;
+            }
+            asm_->callAbs(target);
+            return true;
+        }
+        return false;
+    }
+
+    const Module &module_;
+    CodeRegion region_;
+    std::vector<void *> code_;
+
+    // Per-compile state.
+    X64Assembler *asm_ = nullptr;
+    const std::vector<Symbol> *params_ = nullptr;
+    size_t next_temp_ = 0;
+    size_t max_temps_ = 0;
+    size_t num_shared_ = 0;
+    std::unordered_map<const AST::ExprAST *, uint32_t> uses_;
+    std::unordered_map<const AST::ExprAST *, size_t> shared_;
+};
+
+#endif // JIT_HPP
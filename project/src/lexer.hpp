@@ -0,0 +1,485 @@
+#ifndef LEXER_HPP
+#define LEXER_HPP
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Input sources
+//-----------------------
+
+// Source - A window of contiguous input bytes that the lexer scans in place.
+// refill() is called once the lexer has consumed the current window. Every byte from `keep` to the end of the
+// current window must reappear at the start of the returned window, so a token straddling a read boundary stays
+// contiguous. A returned window that is no longer than the kept tail means end of input.
+class Source
+{
+public:
+    virtual ~Source() = default;
+    virtual std::string_view refill(const char *keep) = 0;
+};
+
+// MemorySource - The whole input is already in memory; the first refill hands out all of it.
+class MemorySource : public Source
+{
+public:
+    MemorySource() = default;
+    explicit MemorySource(std::string_view data) : data_{data} {}
+
+    // data - All of the input.
+    std::string_view data() const { return data_; }
+
+    std::string_view refill(const char *keep) override
+    {
+        if (!handed_out_)
+        {
+            handed_out_ = true;
+            return data_;
+        }
+        const char *end = data_.data() + data_.size();
+        return keep ? std::string_view(keep, end - keep) : std::string_view(end, 0);
+    }
+
+protected:
+    std::string_view data_;
+    bool handed_out_ = false;
+};
+
+// MappedFileSource - Maps a file read-only so that the lexer scans the page cache directly.
+class MappedFileSource : public MemorySource
+{
+public:
+    explicit MappedFileSource(const char *path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+        {
+            open_ = true;
+            if (st.st_size > 0)
+            {
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    madvise(p, st.st_size, MADV_SEQUENTIAL);
+                    data_ = std::string_view(static_cast<const char *>(p), st.st_size);
+                }
+                else
+                {
+                    open_ = false;
+                }
+            }
+        }
+        close(fd);
+    }
+    MappedFileSource(const MappedFileSource &) = delete;
+    MappedFileSource &operator=(const MappedFileSource &) = delete;
+
+    ~MappedFileSource() override
+    {
+        if (!data_.empty())
+        {
+            munmap(const_cast<char *>(data_.data()), data_.size());
+        }
+    }
+
+    bool isOpen() const { return open_; }
+
+private:
+    bool open_ = false;
+};
+
+// StreamSource - Reads a file descriptor (stdin by default) in large chunks.
+// Each refill issues a single read(), so an interactive terminal still gets an answer per line.
+class StreamSource : public Source
+{
+public:
+    explicit StreamSource(int fd = STDIN_FILENO, size_t chunk_size = 64 * 1024)
+        : fd_{fd}, buf_(chunk_size) {}
+
+    std::string_view refill(const char *keep) override
+    {
+        size_t tail = keep ? window_end_ - keep : 0;
+        if (tail > 0 && keep != buf_.data())
+        {
+            memmove(buf_.data(), keep, tail);
+        }
+        if (tail == buf_.size())
+        {
+            // A single token filled the whole buffer.
+            buf_.resize(buf_.size() * 2);
+        }
+
+        ssize_t n;
+        do
+        {
+            n = read(fd_, buf_.data() + tail, buf_.size() - tail);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+        {
+            n = 0;
+        }
+
+        window_end_ = buf_.data() + tail + n;
+        return std::string_view(buf_.data(), tail + n);
+    }
+
+private:
+    int fd_;
+    std::vector<char> buf_;
+    const char *window_end_ = nullptr;
+};
+
+//-----------------------
+// Lexer
+//-----------------------
+
+// The lexer returns tokens [0-255] if it is an unknown character, otherwise one of these for known things.
+enum class Token : int {
+    tok_eof = -1,
+
+    // commands
+    tok_def = -2,
+    tok_extern = -3,
+
+    // primary
+    tok_identifier = -4,
+    tok_number = -5
+};
+
+// identifierToken - The token for an identifier: a keyword's own token, or tok_identifier.
+inline int identifierToken(Symbol sym)
+{
+    if (sym == SymbolTable::kDef)
+    {
+        return static_cast<int>(Token::tok_def);
+    }
+    else if (sym == SymbolTable::kExtern)
+    {
+        return static_cast<int>(Token::tok_extern);
+    }
+    return static_cast<int>(Token::tok_identifier);
+}
+
+inline double parseNumber(std::string_view text)
+{
+    // strtod wants a terminated string; numbers are short, so copy onto the stack.
+    char buf[64];
+    if (text.size() < sizeof(buf))
+    {
+        memcpy(buf, text.data(), text.size());
+        buf[text.size()] = '\0';
+        return strtod(buf, nullptr);
+    }
+    return strtod(std::string(text).c_str(), nullptr);
+}
+
+// TokenStream - Where the parser gets its tokens from.
+class TokenStream
+{
+public:
+    virtual ~TokenStream() = default;
+
+    // getTok - Return the next token, filling in identifier or num_val for the kinds that carry a value.
+    virtual int getTok() = 0;
+
+    Symbol identifier; // Filled in if tok_identifier
+    double num_val;    // Filled in if tok_number
+};
+
+// Lexer - Pulls input from a Source as the parser asks for tokens.
+class Lexer : public TokenStream
+{
+public:
+    explicit Lexer(Source &source) : source_{source} {}
+    Lexer(const Lexer &) = delete;
+    Lexer &operator=(const Lexer &) = delete;
+
+    // getTok: Return the next token from the source.
+    int getTok() override
+    {
+        int c = skipSpaceAndComments();
+        tok_start_ = cur_;
+        STATS_ADD(tokens, 1);
+
+        // Check for end of file. Don't eat the EOF.
+        if (c == EOF)
+        {
+            return static_cast<int>(Token::tok_eof);
+        }
+
+        if (isalpha(c))
+        { // identifier: [a-zA-Z][a-zA-Z0-9]*
+            ++cur_;
+            while (isalnum(peekChar()))
+            {
+                ++cur_;
+            }
+            identifier = symbol_cache_.intern(std::string_view(tok_start_, cur_ - tok_start_));
+            return identifierToken(identifier);
+        }
+
+        if (isdigit(c) || c == '.')
+        { // Number: [0-9.]+
+            ++cur_;
+            while (isdigit(peekChar()) || peekChar() == '.')
+            {
+                ++cur_;
+            }
+            num_val = parseNumber(std::string_view(tok_start_, cur_ - tok_start_));
+            return static_cast<int>(Token::tok_number);
+        }
+
+        // Otherwise, just return the character as its ascii value.
+        ++cur_;
+        return c;
+    }
+
+private:
+    // peekChar - Look at the next byte without consuming it, pulling more input when the window runs dry.
+    int peekChar()
+    {
+        if (cur_ == end_ && !fill())
+        {
+            return EOF;
+        }
+        return static_cast<unsigned char>(*cur_);
+    }
+
+    // fill - Ask the source for more bytes, keeping the token under construction intact.
+    bool fill()
+    {
+        if (at_eof_)
+        {
+            return false;
+        }
+        size_t tok_len = cur_ - tok_start_;
+        std::string_view window = source_.refill(tok_start_);
+        tok_start_ = window.data();
+        cur_ = tok_start_ + tok_len;
+        end_ = tok_start_ + window.size();
+        if (window.size() <= tok_len)
+        {
+            at_eof_ = true;
+            return false;
+        }
+        STATS_ADD(bytes, window.size() - tok_len);
+        return true;
+    }
+
+    int skipSpaceAndComments()
+    {
+        while (true)
+        {
+            tok_start_ = cur_;
+            int c = peekChar();
+            if (isspace(c))
+            {
+                ++cur_;
+            }
+            else if (c == '#')
+            {
+                // Comment until end of line.
+                do
+                {
+                    tok_start_ = ++cur_;
+                    c = peekChar();
+                } while (c != EOF && c != '\n' && c != '\r');
+            }
+            else
+            {
+                return c;
+            }
+        }
+    }
+
+    Source &source_;
+    SymbolCache symbol_cache_;
+    const char *tok_start_ = nullptr; // First byte of the token being scanned.
+    const char *cur_ = nullptr;       // Next unread byte.
+    const char *end_ = nullptr;       // End of the current window.
+    bool at_eof_ = false;
+};
+
+//-----------------------
+// Push lexer
+//-----------------------
+
+// BufferedToken - A token together with the value the lexer filled in for it.
+struct BufferedToken
+{
+    int tok;
+    Symbol identifier;
+    double num_val;
+};
+
+// PushLexer - Tokenizes input handed to it in arbitrary chunks, instead of pulling it from a Source.
+// A token or comment cut off by the end of a chunk is carried over to the next one: the scanned part of an
+// identifier or number is kept (at most kMaxTokenBytes of it), a comment just remembers it is open. Tokens are
+// only emitted once they are known to be complete, i.e. when the byte after them has arrived or at finish().
+class PushLexer
+{
+public:
+    static constexpr size_t kMaxTokenBytes = 4096;
+
+    // feed - Scan the next chunk, appending every token it completes to out.
+    void feed(std::string_view chunk, std::vector<BufferedToken> &out)
+    {
+        const char *p = chunk.data();
+        const char *end = p + chunk.size();
+
+        // Finish whatever the previous chunk left open.
+        if (state_ == State::Comment)
+        {
+            p = skipComment(p, end);
+        }
+        else if (state_ != State::Space)
+        {
+            const char *start = p;
+            p = scanToken(p, end);
+            appendPartial(start, p);
+            if (p == end)
+            {
+                return;
+            }
+            emitPartial(out);
+        }
+
+        while (p != end)
+        {
+            int c = static_cast<unsigned char>(*p);
+            if (isspace(c))
+            {
+                ++p;
+            }
+            else if (c == '#')
+            {
+                p = skipComment(p + 1, end);
+            }
+            else if (isalpha(c) || isdigit(c) || c == '.')
+            {
+                state_ = isalpha(c) ? State::Identifier : State::Number;
+                const char *start = p;
+                p = scanToken(p + 1, end);
+                if (p == end)
+                {
+                    appendPartial(start, p);
+                    return;
+                }
+                emit(std::string_view(start, p - start), out);
+                state_ = State::Space;
+            }
+            else
+            {
+                // Otherwise, just return the character as its ascii value.
+                out.push_back(BufferedToken{c, 0, 0});
+                ++p;
+            }
+        }
+    }
+
+    // finish - End of input: emit a token the last chunk left open.
+    void finish(std::vector<BufferedToken> &out)
+    {
+        if (state_ == State::Identifier || state_ == State::Number)
+        {
+            emitPartial(out);
+        }
+        state_ = State::Space;
+    }
+
+private:
+    enum class State : unsigned char { Space, Comment, Identifier, Number };
+
+    const char *skipComment(const char *p, const char *end)
+    {
+        while (p != end && *p != '\n' && *p != '\r')
+        {
+            ++p;
+        }
+        state_ = p == end ? State::Comment : State::Space;
+        return p;
+    }
+
+    // scanToken - Skip the rest of an identifier or number; identifier: [a-zA-Z][a-zA-Z0-9]*, number: [0-9.]+
+    const char *scanToken(const char *p, const char *end) const
+    {
+        if (state_ == State::Identifier)
+        {
+            while (p != end && isalnum(static_cast<unsigned char>(*p)))
+            {
+                ++p;
+            }
+        }
+        else
+        {
+            while (p != end && (isdigit(static_cast<unsigned char>(*p)) || *p == '.'))
+            {
+                ++p;
+            }
+        }
+        return p;
+    }
+
+    void appendPartial(const char *begin, const char *end)
+    {
+        size_t room = kMaxTokenBytes - partial_.size();
+        size_t n = static_cast<size_t>(end - begin);
+        overlong_ |= n > room;
+        partial_.append(begin, n > room ? room : n);
+    }
+
+    void emitPartial(std::vector<BufferedToken> &out)
+    {
+        if (overlong_)
+        {
+            fmt::print(stderr, "Error: token longer than {} bytes\n", kMaxTokenBytes);
+        }
+        else
+        {
+            emit(partial_, out);
+        }
+        partial_.clear();
+        overlong_ = false;
+        state_ = State::Space;
+    }
+
+    void emit(std::string_view text, std::vector<BufferedToken> &out)
+    {
+        if (state_ == State::Identifier)
+        {
+            Symbol sym = symbol_cache_.intern(text);
+            out.push_back(BufferedToken{identifierToken(sym), sym, 0});
+        }
+        else
+        {
+            out.push_back(BufferedToken{static_cast<int>(Token::tok_number), 0, parseNumber(text)});
+        }
+    }
+
+    State state_ = State::Space;
+    SymbolCache symbol_cache_;
+    std::string partial_; // Start of a token cut off by the end of the last chunk.
+    bool overlong_ = false;
+};
+
+#endif // LEXER_HPP
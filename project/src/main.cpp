@@ -1,534 +1,283 @@
-#include <cctype>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
-#include <map>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <fmt/core.h>
 
+#include "lexer.hpp"
+#include "module_file.hpp"
+#include "parallel_parser.hpp"
+#include "parser.hpp"
+#include "push_parser.hpp"
+#include "session.hpp"
+#include "stats.hpp"
+#include "symbol.hpp"
+
 //-----------------------
-// Lexer
-//-----------------------
+// Top-Level parsing and evaluation
+// ----------------------
 
-// The lexer returns tokens [0-255] if it is an unknown character, otherwise one of these for known things.
-enum class Token : int {
-    tok_eof = -1,
+// When set, the node count before and after each optimizer pass is printed for every definition.
+static bool print_opt_stats = false;
 
-    // commands
-    tok_def = -2,
-    tok_extern = -3,
+static void printOptStats(Session &session, std::string_view name) {
+    if (!print_opt_stats) {
+        return;
+    }
+    for (auto const &stat : session.optStats()) {
+        fmt::print(stderr, "  {}: {:<8} {} -> {} nodes\n", name, stat.pass, stat.before, stat.after);
+    }
+}
 
-    // primary
-    tok_identifier = -4,
-    tok_number = -5
-};
+static void handleDefinition(Session &session, std::unique_ptr<AST::FunctionAST> fn) {
+    Symbol name = fn->getProto().getName();
+    if (session.define(std::move(fn))) {
+        fmt::print(stderr, "Parsed a function definition.\n");
+        printOptStats(session, symbols().name(name));
+    }
+}
 
-class Lexer
-{
-public:
-    // getTok: Return the next token from standard input.
-    int getTok()
-    {
-        static int last_char = ' ';
+static void handleExtern(Session &session, std::unique_ptr<AST::PrototypeAST> proto) {
+    if (session.declareExtern(std::move(proto))) {
+        fmt::print(stderr, "Parsed an extern.\n");
+    } else {
+        fmt::print(stderr, "Error: Unknown extern\n");
+    }
+}
 
-        // Skip any whitespace.
-        while (isspace(last_char))
-        {
-            last_char = getchar();
-        }
+static void handleTopLevelExpression(Session &session, std::unique_ptr<AST::FunctionAST> fn) {
+    // Evaluate a top-level expression into an anonymous function.
+    if (auto result = session.evaluate(*fn)) {
+        fmt::print(stderr, "Evaluated to {}\n", *result);
+    }
+}
 
-        if (isalpha(last_char))
-        { // identifier: [a-zA-Z][a-zA-Z0-9]*
-            identifier_str = last_char;
-            while (isalnum((last_char = getchar())))
-            {
-                identifier_str += last_char;
-            }
+static void handleItem(Session &session, ParsedItem &item) {
+    switch (item.kind) {
+    case ParsedItem::Kind::Definition:
+        handleDefinition(session, std::move(item.function));
+        break;
+    case ParsedItem::Kind::Extern:
+        handleExtern(session, std::move(item.proto));
+        break;
+    case ParsedItem::Kind::TopLevelExpr:
+        handleTopLevelExpression(session, std::move(item.function));
+        break;
+    case ParsedItem::Kind::Error:
+        fmt::print(stderr, "Error: {}\n", item.message);
+        break;
+    }
+}
 
-            if (identifier_str == "def")
-            {
-                return static_cast<int>(Token::tok_def);
-            }
-            else if (identifier_str == "extern")
+// top ::= definition | external | expression | ';'
+static void mainLoop(Parser &parser, Session &session) {
+    while (true) {
+        fmt::print("ready> ");
+        switch (parser.curTok()) {
+        case static_cast<int>(Token::tok_eof):
+            return;
+        case ';': // ignore top-level semicolons.
+            parser.getNextToken();
+            break;
+        default: {
+            ParsedItem item{};
             {
-                return static_cast<int>(Token::tok_extern);
+                PhaseTimer timer{&Stats::parse_ns};
+                item = parser.parseItem();
             }
-            return static_cast<int>(Token::tok_identifier);
-        }
-
-        if (isdigit(last_char) || last_char == '.')
-        { // Number: [0-9.]+
-            std::string num_str;
-            do
-            {
-                num_str += last_char;
-                last_char = getchar();
-            } while (isdigit(last_char) || last_char == '.');
-
-            num_val = strtod(num_str.c_str(), nullptr);
-            return static_cast<int>(Token::tok_number);
-        }
-
-        if (last_char == '#')
-        {
-            // Comment until end of line.
-            do
-                last_char = getchar();
-            while (last_char != EOF && last_char != '\n' && last_char != '\r');
-
-            if (last_char != EOF)
-            {
-                return getTok();
+            if (item.parsed()) {
+                PhaseTimer timer{&Stats::eval_ns};
+                handleItem(session, item);
+            } else {
+                parser.recover();
             }
+            break;
         }
-
-        // Check for end of file. Don't eat the EOF.
-        if (last_char == EOF)
-        {
-            return static_cast<int>(Token::tok_eof);
         }
-
-        // Otherwise, just return the character as its ascii value.
-        int this_char = last_char;
-        last_char = getchar();
-        return this_char;
     }
-
-    std::string identifier_str; // Filled in if tok_identifier
-    double num_val;             // Filled in if tok_number
-private:
-};
+}
 
 //-----------------------
-// Abstract Syntax Tree (aka Parse Tree)
+// Main driver code.
 //-----------------------
 
-class AST
-{
-public:
-    // ExprAST - Base class for all expression nodes.
-    class ExprAST
-    {
-    public:
-        virtual ~ExprAST() = default;
-    };
+static int run(Source &source, Session &session) {
+    Lexer lexer{source};
+    Parser parser{lexer};
 
-    // NumberExprAST - Expression class for numeric literals like "1.0".
-    class NumberExprAST : public ExprAST
-    {
-    private:
-        double val_;
-
-    public:
-        NumberExprAST(double val) : val_{val} {}
-    };
-
-    // VariableExprAST - Expression class for referencing a variable, like "a".
-    class VariableExprAST : public ExprAST
-    {
-    private:
-        std::string name_;
-
-    public:
-        VariableExprAST(std::string const &name) : name_{name} {}
-    };
-
-    // BinaryExprAST - Expression class for a binary operator.
-    class BinaryExprAST : public ExprAST
-    {
-    private:
-        char op_;
-        std::unique_ptr<ExprAST> lhs_, rhs_;
-
-    public:
-        BinaryExprAST(char op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs)
-            : op_{op}, lhs_{std::move(lhs)}, rhs_{std::move(rhs)} {}
-    };
-
-    // CallExprAST - Expression class for function calls.
-    class CallExprAST : public ExprAST
-    {
-    private:
-        std::string callee_;
-        std::vector<std::unique_ptr<ExprAST>> args_;
+    // Install standard binary operators.
+    parser.installStandardBinops();
 
-    public:
-        CallExprAST(std::string callee, std::vector<std::unique_ptr<ExprAST>> args)
-            : callee_{callee}, args_{std::move(args)} {}
-    };
+    // Prime the first token.
+    fmt::print("ready> ");
+    parser.getNextToken();
 
-    // PrototypeAST - This class represents the "prototype" for a function,
-    // which captures its name, and its argument names (thus implicitly the number of arguments the function takes).
-    class PrototypeAST
-    {
-    private:
-        std::string name_;
-        std::vector<std::string> args_;
+    // Run the main "interpreter loop" now.
+    mainLoop(parser, session);
 
-    public:
-        PrototypeAST(std::string name, std::vector<std::string> args)
-            : name_{name}, args_{std::move(args)} {}
+    return 0;
+}
 
-        std::string const &getName() const { return name_; }
-    };
+// runParallel - Parse all of the input on `jobs` threads, then evaluate the items in source order.
+static int runParallel(const MemorySource &source, size_t jobs, Session &session) {
+    ParallelParser parser{jobs};
+    parser.installStandardBinops();
 
-    // FunctionAST - This class represents a function definition itself.
-    class FunctionAST
+    fmt::print("ready> ");
+    std::vector<ParsedItem> items;
     {
-    private:
-        std::unique_ptr<PrototypeAST> proto_;
-        std::unique_ptr<ExprAST> body_;
+        PhaseTimer timer{&Stats::parse_ns};
+        items = parser.parse(source.data());
+    }
+    for (auto &item : items) {
+        PhaseTimer timer{&Stats::eval_ns};
+        handleItem(session, item);
+        fmt::print("ready> ");
+    }
+    return 0;
+}
 
-    public:
-        FunctionAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<ExprAST> body)
-            : proto_{std::move(proto)}, body_{std::move(body)} {}
-    };
-};
+// runPush - Read file in chunks and push them through a PushParser, evaluating every item as soon as it is
+// complete. This is how a server multiplexing many sessions parses; here it is one session on one stream.
+static int runPush(FILE *file, Session &session) {
+    PushParser parser;
+    parser.parser().installStandardBinops();
 
-//-----------------------
-// Parser
-//-----------------------
-class Parser
-{
-public:
-    // GetTokPrecedence - Get the precedence of the pending binary operator token.
-    int getTokPrecedence()
-    {
-        if (!isascii(cur_tok))
+    fmt::print("ready> ");
+    std::vector<char> chunk(64 * 1024);
+    std::vector<ParsedItem> items;
+    bool eof = false;
+    while (!eof) {
         {
-            return -1;
+            PhaseTimer timer{&Stats::parse_ns};
+            size_t n = fread(chunk.data(), 1, chunk.size(), file);
+            if (n == 0) {
+                parser.finish(items);
+                eof = true;
+            } else {
+                parser.feed(std::string_view(chunk.data(), n), items);
+            }
         }
-
-        // Make sure it's a declared binop.
-        int tok_prec = binop_precedence[cur_tok];
-        if (tok_prec <= 0)
-        {
-            return -1;
+        for (auto &item : items) {
+            PhaseTimer timer{&Stats::eval_ns};
+            handleItem(session, item);
+            fmt::print("ready> ");
         }
-        return tok_prec;
+        items.clear();
     }
+    return 0;
+}
 
-    // LogError* - These are little helper functions for error handling.
-    std::unique_ptr<AST::ExprAST> logError(const char *str)
-    {
-        fmt::print(stderr, "Error: {}\n", str);
-        return nullptr;
-    }
-    std::unique_ptr<AST::PrototypeAST> logErrorP(const char *str)
-    {
-        logError(str);
-        return nullptr;
+// loadLibrary - Define everything in a file of definitions and externs. The file is compiled to a module file
+// next to it (path + ".kbc"), which later runs map in instead of parsing the file again for as long as it is
+// unchanged.
+static bool loadLibrary(Session &session, const char *path) {
+    MappedFileSource source{path};
+    if (!source.isOpen()) {
+        fmt::print(stderr, "Error: cannot open {}\n", path);
+        return false;
     }
-
-    std::unique_ptr<AST::ExprAST> parseExpression();
-
-    // numberexpr ::= number
-    std::unique_ptr<AST::ExprAST> parseNumberExpr()
-    {
-        auto result = std::make_unique<AST::NumberExprAST>(lexer.num_val);
-        getNextToken(); // consume the number
-        return std::move(result);
+    uint64_t hash = fnv1a(source.data());
+    std::string module_path = std::string(path) + ".kbc";
+    if (auto file = ModuleFile::open(module_path, hash)) {
+        return session.defineAll(file->items());
     }
 
-    // parenexpr ::= '(' expression ')'
-    std::unique_ptr<AST::ExprAST> parseParenExpr()
-    {
-        getNextToken(); // consume '('
-        auto v = parseExpression();
-        if (!v)
-        {
-            return nullptr;
-        }
-
-        if (cur_tok != ')')
-        {
-            return logError("expected ')'");
+    ParallelParser parser{1};
+    parser.installStandardBinops();
+    std::vector<ParsedItem> items = parser.parse(source.data());
+    std::vector<Symbol> names;
+    bool ok = true;
+    for (auto &item : items) {
+        if (item.kind == ParsedItem::Kind::Definition) {
+            names.push_back(item.function->getProto().getName());
+        } else if (item.kind == ParsedItem::Kind::Extern) {
+            names.push_back(item.proto->getName());
+        } else if (item.kind == ParsedItem::Kind::TopLevelExpr) {
+            fmt::print(stderr, "Error: {}: a library cannot contain top-level expressions\n", path);
+            ok = false;
+        } else {
+            fmt::print(stderr, "Error: {}\n", item.message);
+            ok = false;
         }
-        getNextToken(); // consume ')'
-        return v;
     }
-
-    // identifierexpr
-    // ::= identifier
-    // ::= identifier '(' expression* ')'
-    std::unique_ptr<AST::ExprAST> parseIdentifierExpr()
-    {
-        std::string id_name = lexer.identifier_str;
-
-        getNextToken(); // consume identifier
-
-        if (cur_tok != '(')
-        { // Simple variable ref.
-            return std::make_unique<AST::VariableExprAST>(id_name);
-        }
-
-        // Call.
-        getNextToken(); // consume '('
-        std::vector<std::unique_ptr<AST::ExprAST>> args;
-        if (cur_tok != ')')
-        {
-            while (true)
-            {
-                if (auto arg = parseExpression())
-                {
-                    args.push_back(std::move(arg));
-                }
-                else
-                {
-                    return nullptr;
-                }
-
-                if (cur_tok == ')')
-                {
-                    break;
-                }
-
-                if (cur_tok != ',')
-                {
-                    return logError("Expected ')' or ',' in argument list");
-                }
-                getNextToken();
+    ok = session.defineAll(std::move(items)) && ok;
+
+    // Only a library that loaded cleanly is cached, so that its errors are reported again next time.
+    if (ok) {
+        std::vector<uint32_t> slots;
+        for (Symbol name : names) {
+            auto slot = session.module().findSlot(name);
+            if (slot && std::find(slots.begin(), slots.end(), *slot) == slots.end()) {
+                slots.push_back(*slot);
             }
         }
-
-        // Eat the ')'.
-        getNextToken();
-
-        return std::make_unique<AST::CallExprAST>(id_name, std::move(args));
-    }
-
-    // primary
-    // ::= identifierexpr
-    // ::= numberexpr
-    // ::= parenexpr
-    std::unique_ptr<AST::ExprAST> parsePrimary()
-    {
-        switch (cur_tok)
-        {
-        default:
-            return logError("unknown token when expecting an expression");
-        case static_cast<int>(Token::tok_identifier):
-            return parseIdentifierExpr();
-        case static_cast<int>(Token::tok_number):
-            return parseNumberExpr();
-        case '(':
-            return parseParenExpr();
+        if (!writeModuleFile(module_path, session.module(), slots, hash)) {
+            fmt::print(stderr, "Error: cannot write {}\n", module_path);
         }
     }
+    return ok;
+}
 
-    // binoprhs
-    // ::= ('+' primary)*
-    std::unique_ptr<AST::ExprAST> parseBinOpRHS(int expr_prec, std::unique_ptr<AST::ExprAST> lhs)
-    {
-        // If this is a binop, find its precedence.
-        while (true)
-        {
-            int tok_prec = getTokPrecedence();
-
-            // If this is a binop that binds at least as tightly as the current binop,
-            // consume it, otherwise we are done.
-            if (tok_prec < expr_prec)
-            {
-                return lhs;
-            }
-
-            // Okay, we know this is a binop.
-            int binop = cur_tok;
-            getNextToken(); // consume binop
-
-            // Parse the primary expression after the binary operator.
-            auto rhs = parsePrimary();
-            if (!rhs)
-            {
-                return nullptr;
+// Usage: parser [--opt-stats] [--jobs N] [--push] [--lib library]... [file]. Libraries are loaded first, from their
+// module files when up to date. A file is memory-mapped and lexed in place; with --jobs it is parsed on N threads
+// (0 for one per core) before anything is evaluated. Without a file, stdin is read in chunks. With --push, the
+// file or stdin is read in chunks and fed to a PushParser instead.
+int main(int argc, char *argv[]) {
+    Session session;
+    size_t jobs = 1;
+    bool push = false;
+    int arg = 1;
+    for (; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--opt-stats") == 0) {
+            print_opt_stats = true;
+        } else if (strcmp(argv[arg], "--push") == 0) {
+            push = true;
+        } else if (strcmp(argv[arg], "--lib") == 0 && arg + 1 < argc) {
+            if (!loadLibrary(session, argv[++arg])) {
+                return 1;
             }
-
-            // If BinOp binds less tightly with RHS than the operator after RHS,
-            // let the pending operator take RHS as its LHS.
-            int next_prec = getTokPrecedence();
-            if (tok_prec < next_prec)
-            {
-                rhs = parseBinOpRHS(tok_prec + 1, std::move(rhs));
-                if (!rhs)
-                {
-                    return nullptr;
-                }
+        } else if (strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc) {
+            jobs = strtoul(argv[++arg], nullptr, 10);
+            if (jobs == 0) {
+                jobs = std::max(1u, std::thread::hardware_concurrency());
             }
-
-            // Merge LHS/RHS.
-            lhs = std::make_unique<AST::BinaryExprAST>(binop, std::move(lhs), std::move(rhs));
-        }
-    }
-
-    // expression
-    // ::= primary binoprhs
-    //
-    std::unique_ptr<AST::ExprAST> parseExpression()
-    {
-        auto lhs = parsePrimary();
-        if (!lhs)
-        {
-            return nullptr;
+        } else {
+            break;
         }
-
-        return parseBinOpRHS(0, std::move(lhs));
     }
 
-    // prototype
-    // ::= id '(' id* ')'
-    std::unique_ptr<AST::PrototypeAST> parsePrototype()
-    {
-        if (cur_tok != static_cast<int>(Token::tok_identifier))
-        {
-            return logErrorP("Expected function name in prototype");
+    int status;
+    if (push) {
+        FILE *file = arg < argc ? fopen(argv[arg], "rb") : stdin;
+        if (!file) {
+            fmt::print(stderr, "Error: cannot open {}\n", argv[arg]);
+            return 1;
         }
-
-        std::string fn_name = identifier_str;
-        getNextToken();
-
-        if (cur_tok != '(')
-        {
-            return logErrorP("Expected '(' in prototype");
-        }
-
-        std::vector<std::string> arg_names;
-        while (getNextToken() == static_cast<int>(Token::tok_identifier))
-        {
-            arg_names.push_back(identifier_str);
+        status = runPush(file, session);
+        if (file != stdin) {
+            fclose(file);
         }
-        if (cur_tok != ')')
-        {
-            return logErrorP("Expected ')' in prototype");
+    } else if (arg < argc) {
+        MappedFileSource source{argv[arg]};
+        if (!source.isOpen()) {
+            fmt::print(stderr, "Error: cannot open {}\n", argv[arg]);
+            return 1;
         }
-
-        // success.
-        getNextToken(); // eat ')'.
-
-        return std::make_unique<AST::PrototypeAST>(fn_name, std::move(arg_names));
-    }
-
-    // definition ::= 'def' prototype expression
-    std::unique_ptr<AST::FunctionAST> parseDefinition()
-    {
-        getNextToken(); // eat def.
-        auto proto = parsePrototype();
-        if (!proto)
-        {
-            return nullptr;
-        }
-
-        if (auto e = parseExpression())
-        {
-            return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(e));
-        }
-        return nullptr;
-    }
-
-    // toplevelexpr ::= expression
-    std::unique_ptr<AST::FunctionAST> parseTopLevelExpr()
-    {
-        if (auto e = parseExpression())
-        {
-            // Make an anonymous proto.
-            auto proto = std::make_unique<AST::PrototypeAST>("__anon_expr", std::vector<std::string>());
-            return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(e));
-        }
-        return nullptr;
-    }
-
-    // external ::= 'extern' prototype
-    std::unique_ptr<AST::PrototypeAST> parseExtern()
-    {
-        getNextToken(); // eat extern.
-        return parsePrototype();
-    }
-
-private:
-    Lexer lexer;
-
-    // CurTok/getNextToken - Provide a simple token buffer. CurTok is the current token the parser is looking at.
-    // getNextToken reads another token from the lexer and updates CurTok with its results.
-    int cur_tok;
-    int getNextToken() { return cur_tok = lexer.getTok(); }
-    // BinopPrecedence - This holds the precedence for each binary operator that is defined.
-    std::map<char, int> binop_precedence;
-};
-
-//-----------------------
-// Top-Level parsing
-// ----------------------
-
-static void handleDefinition() {
-    if (parseDefinition()) {
-        fmt::print(stderr, "Parsed a function definition.\n");
+        status = jobs > 1 ? runParallel(source, jobs, session) : run(source, session);
     } else {
-        // Skip token for error recovery.
-        getNextToken();
+        StreamSource source;
+        status = run(source, session);
     }
-}
-
-static void handleExtern() {
-    if (parseExtern()) {
-        fmt::print(stderr, "Parsed an extern.\n");
-    } else {
-        // Skip token for error recovery.
-        getNextToken();
-    }
-}
 
-static void handleTopLevelExpression() {
-    // Evaluate a top-level expression into an anonymous function.
-    if (parseTopLevelExpr()) {
-        fmt::print(stderr, "Parsed a top-level expr.\n");
-    } else {
-        // Skip token for error recovery.
-        getNextToken();
-    }
+#ifdef KALEIDOSCOPE_STATS
+    stats().print(stderr);
+#endif
+    return status;
 }
-
-// top ::= definition | external | expression | ';'
-static void mainLoop() {
-    while (true) {
-        fmt::print("ready> ");
-        switch (cur_tok) {
-        case static_cast<int>(Token::tok_eof):
-            return;
-        case ';': // ignore top-level semicolons.
-            getNextToken();
-            break;
-        case static_cast<int>(Token::tok_def):
-            handleDefinition();
-            break;
-        case static_cast<int>(Token::tok_extern):
-            handleExtern();
-            break;
-        default:
-            handleTopLevelExpression();
-            break;
-        }
-    }
-}
-
-//-----------------------
-// Main driver code.
-//-----------------------
-
-int main() {
-    // Install standard binary operators.
-    // 1 is lowest precedence.
-    binop_precedence['<'] = 10;
-    binop_precedence['+'] = 20;
-    binop_precedence['-'] = 20;
-    binop_precedence['*'] = 40; // highest.
-
-    // Prime the first token.
-    fmt::print("ready> ");
-    getNextToken();
-
-    // Run the main "interpreter loop" now.
-    mainLoop();
-
-    return 0;
-}
\ No newline at end of file
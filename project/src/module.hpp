@@ -0,0 +1,144 @@
+#ifndef MODULE_HPP
+#define MODULE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "ast.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Native calls
+//-----------------------
+
+// The most arguments a native function may take; natives are called through a double(*)(double...) of matching
+// arity, and under the System V convention these all travel in xmm0-xmm7.
+constexpr size_t kMaxNativeArgs = 8;
+
+inline double callNative(void *fn, const double *a, size_t n)
+{
+    switch (n)
+    {
+    case 0: return reinterpret_cast<double (*)()>(fn)();
+    case 1: return reinterpret_cast<double (*)(double)>(fn)(a[0]);
+    case 2: return reinterpret_cast<double (*)(double, double)>(fn)(a[0], a[1]);
+    case 3: return reinterpret_cast<double (*)(double, double, double)>(fn)(a[0], a[1], a[2]);
+    case 4: return reinterpret_cast<double (*)(double, double, double, double)>(fn)(a[0], a[1], a[2], a[3]);
+    case 5:
+        return reinterpret_cast<double (*)(double, double, double, double, double)>(fn)(a[0], a[1], a[2], a[3], a[4]);
+    case 6:
+        return reinterpret_cast<double (*)(double, double, double, double, double, double)>(fn)(
+            a[0], a[1], a[2], a[3], a[4], a[5]);
+    case 7:
+        return reinterpret_cast<double (*)(double, double, double, double, double, double, double)>(fn)(
+            a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+    case 8:
+        return reinterpret_cast<double (*)(double, double, double, double, double, double, double, double)>(fn)(
+            a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    default: throw std::runtime_error("too many arguments for a native call");
+    }
+}
+
+//-----------------------
+// Module
+//-----------------------
+
+// Module - Every name a program can call, each bound to a stable slot index.
+// A slot holds either a user definition or an extern resolved to a native symbol. Redefining a name reuses its
+// slot, so compiled code that refers to callees by slot picks up the new definition. Slots are found by indexing
+// a table with the name's symbol.
+class Module
+{
+public:
+    struct Slot
+    {
+        Symbol name;
+        std::unique_ptr<AST::FunctionAST> function;
+        std::unique_ptr<AST::PrototypeAST> proto; // Set for externs.
+        void *native = nullptr;
+
+        bool isDefined() const { return function || native; }
+        size_t arity() const { return function ? function->getProto().getArgs().size() : proto->getArgs().size(); }
+    };
+
+    uint32_t slotFor(Symbol name)
+    {
+        if (name >= index_.size())
+        {
+            index_.resize(name + 1, kNoSlot);
+        }
+        if (index_[name] == kNoSlot)
+        {
+            index_[name] = static_cast<uint32_t>(slots_.size());
+            slots_.push_back(Slot{name, nullptr, nullptr, nullptr});
+        }
+        return index_[name];
+    }
+
+    std::optional<uint32_t> findSlot(Symbol name) const
+    {
+        if (name >= index_.size() || index_[name] == kNoSlot || !slots_[index_[name]].isDefined())
+        {
+            return std::nullopt;
+        }
+        return index_[name];
+    }
+
+    const Slot &getSlot(uint32_t slot) const { return slots_[slot]; }
+    size_t numSlots() const { return slots_.size(); }
+
+    // addFunction - Bind a definition to its name, replacing any previous one. Returns the slot.
+    uint32_t addFunction(std::unique_ptr<AST::FunctionAST> fn)
+    {
+        uint32_t slot = slotFor(fn->getProto().getName());
+        slots_[slot].function = std::move(fn);
+        slots_[slot].proto.reset();
+        slots_[slot].native = nullptr;
+        return slot;
+    }
+
+    // exchange - Replace whatever is bound to a slot, returning the old binding, so that a redefinition can be
+    // undone.
+    Slot exchange(uint32_t slot, Slot binding)
+    {
+        binding.name = slots_[slot].name;
+        std::swap(slots_[slot], binding);
+        return binding;
+    }
+
+    // addExtern - Resolve an extern against the symbols of the running process. Returns the slot, or nothing if
+    // no such symbol exists.
+    std::optional<uint32_t> addExtern(std::unique_ptr<AST::PrototypeAST> proto)
+    {
+        if (proto->getArgs().size() > kMaxNativeArgs)
+        {
+            return std::nullopt;
+        }
+        void *native = dlsym(RTLD_DEFAULT, std::string(symbols().name(proto->getName())).c_str());
+        if (!native)
+        {
+            return std::nullopt;
+        }
+        uint32_t slot = slotFor(proto->getName());
+        slots_[slot].function.reset();
+        slots_[slot].proto = std::move(proto);
+        slots_[slot].native = native;
+        return slot;
+    }
+
+private:
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> index_; // Slot of each symbol, or kNoSlot.
+};
+
+#endif // MODULE_HPP
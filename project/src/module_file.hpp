@@ -0,0 +1,553 @@
+#ifndef MODULE_FILE_HPP
+#define MODULE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast.hpp"
+#include "module.hpp"
+#include "parser.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Compiled module files
+//-----------------------
+
+// A module file holds the definitions and externs of one source file, ready to be mapped back in without lexing
+// or parsing it again. Each definition body is stored as a block of AST nodes in their in-memory layout; nodes
+// link with RelPtrs, so the block is used in place. Symbols in the file are the writer's, listed in a table of
+// names; a loader whose symbols differ rewrites them while it validates the nodes.
+//
+//   header | entries | symbol table | names | argument lists | node images (8-byte aligned)
+//
+// The header records a hash of the source, so a stale file is simply not used.
+
+// fnv1a - 64-bit FNV-1a hash of text.
+inline uint64_t fnv1a(std::string_view text)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text)
+    {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct ModuleFileHeader
+{
+    static constexpr char kMagic[8] = {'K', 'L', 'D', 'M', 'O', 'D', '\r', '\n'};
+    static constexpr uint32_t kVersion = 1;
+
+    // Node sizes and byte order: a file only loads on the kind of machine that wrote it.
+    static constexpr uint32_t kLayout = sizeof(AST::NumberExprAST) << 24 | sizeof(AST::VariableExprAST) << 16 |
+                                        sizeof(AST::BinaryExprAST) << 8 | sizeof(AST::CallExprAST) |
+                                        (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? 0 : 1u << 31);
+
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t source_hash;
+    uint64_t file_size;
+    uint32_t num_entries;
+    uint32_t num_symbols;
+    uint64_t entries_offset;
+    uint64_t symbols_offset;
+};
+
+struct ModuleFileEntry
+{
+    enum Kind : uint32_t { kDefinition, kExtern };
+
+    uint32_t kind;
+    uint32_t name;
+    uint32_t num_args;
+    uint32_t unused;
+    uint64_t args_offset;  // num_args symbols.
+    uint64_t image_offset; // Definitions: the nodes of the body.
+    uint64_t image_size;
+    uint64_t body_offset; // Definitions: the root node, from image_offset.
+};
+
+struct ModuleFileSymbol
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t unused;
+};
+
+//-----------------------
+// Writing
+//-----------------------
+
+// TreeFlattener - Copies a body into one contiguous block, children before their parents and shared nodes kept
+// shared, so that every link points backwards. Nodes start on 8-byte boundaries.
+class TreeFlattener
+{
+public:
+    // flatten - The block, and the offset of the root in it.
+    static std::pair<std::vector<uint8_t>, uint64_t> flatten(const AST::ExprAST *root)
+    {
+        TreeFlattener flattener{measure(root)};
+        auto copy = flattener.copy(root);
+        uint64_t root_offset = reinterpret_cast<const uint8_t *>(copy) - flattener.data();
+        return {std::vector<uint8_t>(flattener.data(), flattener.data() + flattener.used_), root_offset};
+    }
+
+    // allocate - Bump allocation in the block, which is sized up front so nodes never move once linked.
+    void *allocate(size_t size, size_t /*align*/)
+    {
+        void *p = reinterpret_cast<uint8_t *>(words_.data()) + used_;
+        used_ += roundUp8(size);
+        return p;
+    }
+
+private:
+    explicit TreeFlattener(size_t size) : words_(size / 8) {}
+
+    static size_t roundUp8(size_t n) { return (n + 7) & ~size_t(7); }
+
+    const uint8_t *data() const { return reinterpret_cast<const uint8_t *>(words_.data()); }
+
+    // measure - Bytes needed for the distinct nodes reachable from root.
+    static size_t measure(const AST::ExprAST *root)
+    {
+        std::unordered_map<const AST::ExprAST *, uint32_t> uses;
+        countUses(root, uses);
+        size_t size = 0;
+        for (auto const &use : uses)
+        {
+            switch (use.first->getKind())
+            {
+            case AST::ExprAST::Kind::Number:
+                size += roundUp8(sizeof(AST::NumberExprAST));
+                break;
+            case AST::ExprAST::Kind::Variable:
+                size += roundUp8(sizeof(AST::VariableExprAST));
+                break;
+            case AST::ExprAST::Kind::Binary:
+                size += roundUp8(sizeof(AST::BinaryExprAST));
+                break;
+            case AST::ExprAST::Kind::Call:
+                size += roundUp8(AST::CallExprAST::allocSize(
+                    static_cast<const AST::CallExprAST *>(use.first)->getArgs().size()));
+                break;
+            }
+        }
+        return size;
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    AST::ExprAST *copy(const AST::ExprAST *e)
+    {
+        auto it = copies_.find(e);
+        if (it != copies_.end())
+        {
+            return it->second;
+        }
+        AST::ExprAST *result = nullptr;
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+            result = make<AST::NumberExprAST>(*static_cast<const AST::NumberExprAST *>(e));
+            break;
+        case AST::ExprAST::Kind::Variable:
+            result = make<AST::VariableExprAST>(*static_cast<const AST::VariableExprAST *>(e));
+            break;
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            auto l = copy(bin->getLHS());
+            auto r = copy(bin->getRHS());
+            result = make<AST::BinaryExprAST>(bin->getOp(), l, r);
+            break;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            std::vector<AST::ExprAST *> args;
+            for (auto arg : call->getArgs())
+            {
+                args.push_back(copy(arg));
+            }
+            result = AST::CallExprAST::create(*this, call->getCallee(), args.data(), args.size());
+            break;
+        }
+        }
+        copies_.emplace(e, result);
+        return result;
+    }
+
+    std::vector<uint64_t> words_; // uint64_t for alignment.
+    size_t used_ = 0;
+    std::unordered_map<const AST::ExprAST *, AST::ExprAST *> copies_;
+};
+
+// writeModuleFile - Write the given slots of module to path, as compiled from source text with the given hash.
+// The file is written next to path and renamed into place, so a reader never sees half of it.
+inline bool writeModuleFile(const std::string &path, const Module &module, const std::vector<uint32_t> &slots,
+                            uint64_t source_hash)
+{
+    std::vector<uint8_t> out(sizeof(ModuleFileHeader));
+    auto append = [&out](const void *data, size_t size, size_t align) {
+        out.resize((out.size() + align - 1) & ~(align - 1));
+        size_t at = out.size();
+        out.insert(out.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+        return static_cast<uint64_t>(at);
+    };
+
+    std::vector<ModuleFileEntry> entries(slots.size());
+    size_t entries_at = append(entries.data(), entries.size() * sizeof(ModuleFileEntry), 8);
+
+    size_t num_symbols = symbols().size();
+    std::vector<ModuleFileSymbol> names(num_symbols);
+    size_t symbols_at = append(names.data(), names.size() * sizeof(ModuleFileSymbol), 8);
+    for (Symbol sym = 0; sym < num_symbols; ++sym)
+    {
+        std::string_view name = symbols().name(sym);
+        names[sym] = ModuleFileSymbol{append(name.data(), name.size(), 1), static_cast<uint32_t>(name.size()), 0};
+    }
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        auto const &slot = module.getSlot(slots[i]);
+        auto const &proto = slot.function ? slot.function->getProto() : *slot.proto;
+        ModuleFileEntry &entry = entries[i];
+        entry.kind = slot.function ? ModuleFileEntry::kDefinition : ModuleFileEntry::kExtern;
+        entry.name = proto.getName();
+        entry.num_args = static_cast<uint32_t>(proto.getArgs().size());
+        entry.args_offset = append(proto.getArgs().data(), proto.getArgs().size() * sizeof(Symbol), 4);
+        if (slot.function)
+        {
+            auto image = TreeFlattener::flatten(slot.function->getBody());
+            entry.image_offset = append(image.first.data(), image.first.size(), 8);
+            entry.image_size = image.first.size();
+            entry.body_offset = image.second;
+        }
+    }
+
+    ModuleFileHeader header{};
+    memcpy(header.magic, ModuleFileHeader::kMagic, sizeof(header.magic));
+    header.version = ModuleFileHeader::kVersion;
+    header.layout = ModuleFileHeader::kLayout;
+    header.source_hash = source_hash;
+    header.file_size = out.size();
+    header.num_entries = static_cast<uint32_t>(entries.size());
+    header.num_symbols = static_cast<uint32_t>(num_symbols);
+    header.entries_offset = entries_at;
+    header.symbols_offset = symbols_at;
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + entries_at, entries.data(), entries.size() * sizeof(ModuleFileEntry));
+    memcpy(out.data() + symbols_at, names.data(), names.size() * sizeof(ModuleFileSymbol));
+
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//-----------------------
+// Loading
+//-----------------------
+
+// ModuleFile - A module file mapped into memory. Definition bodies point straight into the mapping, which stays
+// alive as long as any of them does.
+class ModuleFile : public std::enable_shared_from_this<ModuleFile>
+{
+public:
+    // open - Map path if it is a valid module file compiled from source with the given hash, or return nullptr.
+    static std::shared_ptr<ModuleFile> open(const std::string &path, uint64_t source_hash)
+    {
+        std::shared_ptr<ModuleFile> file{new ModuleFile()};
+        if (!file->map(path) || !file->validate(source_hash))
+        {
+            return nullptr;
+        }
+        return file;
+    }
+
+    ModuleFile(const ModuleFile &) = delete;
+    ModuleFile &operator=(const ModuleFile &) = delete;
+
+    ~ModuleFile()
+    {
+        if (base_)
+        {
+            munmap(base_, size_);
+        }
+    }
+
+    // items - The definitions and externs of the file, in the order they were written.
+    std::vector<ParsedItem> items()
+    {
+        std::vector<ParsedItem> items;
+        for (uint32_t i = 0; i < header().num_entries; ++i)
+        {
+            auto const &entry = entries()[i];
+            std::vector<Symbol> args(entry.num_args);
+            auto file_args = reinterpret_cast<const uint32_t *>(base_ + entry.args_offset);
+            for (uint32_t a = 0; a < entry.num_args; ++a)
+            {
+                args[a] = symbol_map_[file_args[a]];
+            }
+            auto proto = std::make_unique<AST::PrototypeAST>(symbol_map_[entry.name], std::move(args));
+
+            ParsedItem item{};
+            if (entry.kind == ModuleFileEntry::kExtern)
+            {
+                item.kind = ParsedItem::Kind::Extern;
+                item.proto = std::move(proto);
+            }
+            else
+            {
+                item.kind = ParsedItem::Kind::Definition;
+                auto body = reinterpret_cast<AST::ExprAST *>(base_ + entry.image_offset + entry.body_offset);
+                item.function = std::make_unique<AST::FunctionAST>(std::move(proto), shared_from_this(), body);
+            }
+            items.push_back(std::move(item));
+        }
+        return items;
+    }
+
+private:
+    ModuleFile() = default;
+
+    const ModuleFileHeader &header() const { return *reinterpret_cast<const ModuleFileHeader *>(base_); }
+    const ModuleFileEntry *entries() const
+    {
+        return reinterpret_cast<const ModuleFileEntry *>(base_ + header().entries_offset);
+    }
+
+    // map - Private and writable, so that rewriting symbols copies just the touched pages.
+    bool map(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ModuleFileHeader))
+        {
+            void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                base_ = static_cast<uint8_t *>(p);
+                size_ = st.st_size;
+            }
+        }
+        close(fd);
+        return base_ != nullptr;
+    }
+
+    bool inBounds(uint64_t offset, uint64_t size, uint64_t align = 1) const
+    {
+        return offset <= size_ && size <= size_ - offset && offset % align == 0;
+    }
+
+    bool validate(uint64_t source_hash)
+    {
+        auto const &h = header();
+        if (memcmp(h.magic, ModuleFileHeader::kMagic, sizeof(h.magic)) != 0 ||
+            h.version != ModuleFileHeader::kVersion || h.layout != ModuleFileHeader::kLayout ||
+            h.source_hash != source_hash || h.file_size != size_ ||
+            !inBounds(h.entries_offset, uint64_t(h.num_entries) * sizeof(ModuleFileEntry), 8) ||
+            !inBounds(h.symbols_offset, uint64_t(h.num_symbols) * sizeof(ModuleFileSymbol), 8))
+        {
+            return false;
+        }
+
+        // Link the file's symbols to ours.
+        auto names = reinterpret_cast<const ModuleFileSymbol *>(base_ + h.symbols_offset);
+        symbol_map_.resize(h.num_symbols);
+        identity_ = true;
+        for (uint32_t i = 0; i < h.num_symbols; ++i)
+        {
+            if (!inBounds(names[i].offset, names[i].size))
+            {
+                return false;
+            }
+            symbol_map_[i] = symbols().intern(
+                std::string_view(reinterpret_cast<const char *>(base_ + names[i].offset), names[i].size));
+            identity_ = identity_ && symbol_map_[i] == i;
+        }
+
+        for (uint32_t i = 0; i < h.num_entries; ++i)
+        {
+            auto const &entry = entries()[i];
+            if (entry.kind > ModuleFileEntry::kExtern || entry.name >= h.num_symbols ||
+                !inBounds(entry.args_offset, uint64_t(entry.num_args) * sizeof(Symbol), alignof(Symbol)))
+            {
+                return false;
+            }
+            auto args = reinterpret_cast<const uint32_t *>(base_ + entry.args_offset);
+            for (uint32_t a = 0; a < entry.num_args; ++a)
+            {
+                if (args[a] >= h.num_symbols)
+                {
+                    return false;
+                }
+            }
+            if (entry.kind == ModuleFileEntry::kDefinition &&
+                (!inBounds(entry.image_offset, entry.image_size, 8) || !validateBody(entry)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // validateBody - Check every node of a definition lies in its image, links only to nodes before it (so
+    // there are no cycles) and names known symbols and arguments. Rewrites symbols to ours on the way. Nodes may
+    // be shared, so each is visited once: otherwise a DAG takes exponential time and symbols are rewritten twice.
+    bool validateBody(const ModuleFileEntry &entry)
+    {
+        uint8_t *image = base_ + entry.image_offset;
+        uint64_t image_size = entry.image_size;
+        auto nodeAt = [&](uint64_t offset, size_t size) -> AST::ExprAST * {
+            if (offset > image_size || size > image_size - offset || offset % 8 != 0)
+            {
+                return nullptr;
+            }
+            return reinterpret_cast<AST::ExprAST *>(image + offset);
+        };
+        // Where a link leads, or ~0 if it does not point to an earlier offset of the image.
+        auto target = [&](const RelPtr<AST::ExprAST> &link, uint64_t from) -> uint64_t {
+            int64_t rel = link.offset();
+            int64_t at = static_cast<int64_t>(reinterpret_cast<const uint8_t *>(&link) - image) + rel;
+            return rel < 0 && at >= 0 && static_cast<uint64_t>(at) < from ? static_cast<uint64_t>(at) : ~uint64_t(0);
+        };
+
+        std::vector<bool> visited(image_size / 8 + 1);
+        std::vector<uint64_t> stack{entry.body_offset};
+        while (!stack.empty())
+        {
+            uint64_t offset = stack.back();
+            stack.pop_back();
+            auto e = nodeAt(offset, sizeof(AST::ExprAST));
+            if (!e)
+            {
+                return false;
+            }
+            if (visited[offset / 8])
+            {
+                continue;
+            }
+            visited[offset / 8] = true;
+            switch (e->getKind())
+            {
+            case AST::ExprAST::Kind::Number:
+                if (!nodeAt(offset, sizeof(AST::NumberExprAST)))
+                {
+                    return false;
+                }
+                break;
+            case AST::ExprAST::Kind::Variable:
+            {
+                if (!nodeAt(offset, sizeof(AST::VariableExprAST)))
+                {
+                    return false;
+                }
+                auto var = static_cast<AST::VariableExprAST *>(e);
+                if (var->getName() >= symbol_map_.size() || var->getIndex() >= entry.num_args)
+                {
+                    return false;
+                }
+                if (!identity_)
+                {
+                    var->setName(symbol_map_[var->getName()]);
+                }
+                break;
+            }
+            case AST::ExprAST::Kind::Binary:
+            {
+                if (!nodeAt(offset, sizeof(AST::BinaryExprAST)))
+                {
+                    return false;
+                }
+                auto bin = static_cast<AST::BinaryExprAST *>(e);
+                char op = bin->getOp();
+                if (op != '+' && op != '-' && op != '*' && op != '<')
+                {
+                    return false;
+                }
+                for (size_t k = 0; k < 2; ++k)
+                {
+                    uint64_t child = target(bin->getOperands().link(k), offset);
+                    if (child == ~uint64_t(0))
+                    {
+                        return false;
+                    }
+                    stack.push_back(child);
+                }
+                break;
+            }
+            case AST::ExprAST::Kind::Call:
+            {
+                if (!nodeAt(offset, sizeof(AST::CallExprAST)))
+                {
+                    return false;
+                }
+                auto call = static_cast<AST::CallExprAST *>(e);
+                size_t num_args = call->getArgs().size();
+                if (call->getCallee() >= symbol_map_.size() || !nodeAt(offset, AST::CallExprAST::allocSize(num_args)))
+                {
+                    return false;
+                }
+                for (size_t k = 0; k < num_args; ++k)
+                {
+                    uint64_t child = target(call->getArgs().link(k), offset);
+                    if (child == ~uint64_t(0))
+                    {
+                        return false;
+                    }
+                    stack.push_back(child);
+                }
+                if (!identity_)
+                {
+                    call->setCallee(symbol_map_[call->getCallee()]);
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+    std::vector<Symbol> symbol_map_; // Our symbol for each of the file's.
+    bool identity_ = false;          // Whether every symbol of the file is already ours.
+};
+
+#endif // MODULE_FILE_HPP
@@ -0,0 +1,572 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "arena.hpp"
+#include "ast.hpp"
+#include "module.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Optimizer
+//-----------------------
+
+// Optimizer - Rewrites a function body through a fixed pipeline of passes:
+//   inline   - splice in the bodies of small definitions that are not (even indirectly) recursive
+//   fold     - evaluate operators whose operands are both constants
+//   simplify - algebraic identities that hold for every IEEE double, plus opt-in ones that do not
+//   cse      - hash-cons identical subtrees so each is computed once
+// Nothing that may call an extern is dropped, duplicated or merged: an inlined call only takes arguments free of
+// such calls, and only such calls are merged by CSE or cancelled by simplify.
+// Each pass copies the tree into a fresh arena, so the result is a new FunctionAST that owns only live nodes and
+// the original is left untouched for later re-optimization.
+class Optimizer
+{
+public:
+    struct Options
+    {
+        bool inline_calls = true;
+        size_t inline_threshold = 16; // Largest callee body, in nodes, that gets inlined.
+        size_t inline_budget = 256;   // Most nodes inlining may add to one definition, all levels together.
+        bool fold_constants = true;
+        bool simplify = true;
+        bool cse = true;
+        bool no_signed_zeros = false; // Allow x + 0 -> x, which turns -0 into +0.
+        bool finite_math = false;     // Allow x * 0 -> 0 and x - x -> 0, wrong for NaN and infinities.
+    };
+
+    struct PassStats
+    {
+        const char *pass;
+        size_t before;
+        size_t after;
+    };
+
+    explicit Optimizer(const Module &module) : Optimizer(module, Options{}) {}
+    Optimizer(const Module &module, Options options) : module_{module}, options_{options} {}
+
+    std::unique_ptr<AST::FunctionAST> optimize(const AST::FunctionAST &fn)
+    {
+        stats_.clear();
+        effects_.clear();
+        auto arena = std::make_unique<Arena>();
+        out_ = arena.get();
+        const AST::ExprAST *body = fn.getBody();
+
+        // The first pass always runs, since it is what copies the body out of the original arena.
+        size_t before = countNodes(body);
+        inline_stack_.assign(1, fn.getProto().getName());
+        inline_budget_ = options_.inline_budget;
+        body = copy(body, nullptr, options_.inline_calls ? kMaxInlineDepth : 0);
+        record("inline", before, body);
+
+        if (options_.fold_constants)
+        {
+            body = runPass("fold", body, arena, [this](AST::ExprAST *e) { return fold(e); });
+        }
+        if (options_.simplify)
+        {
+            body = runPass("simplify", body, arena, [this](AST::ExprAST *e) { return simplify(e); });
+        }
+        if (options_.cse)
+        {
+            cse_.clear();
+            body = runPass("cse", body, arena, [this](AST::ExprAST *e) { return hashCons(e); });
+        }
+
+        auto const &proto = fn.getProto();
+        return std::make_unique<AST::FunctionAST>(
+            std::make_unique<AST::PrototypeAST>(proto.getName(), proto.getArgs()), std::move(arena),
+            const_cast<AST::ExprAST *>(body));
+    }
+
+    const std::vector<PassStats> &stats() const { return stats_; }
+
+private:
+    static constexpr size_t kMaxInlineDepth = 8;
+
+    using Memo = std::unordered_map<const AST::ExprAST *, AST::ExprAST *>;
+
+    void record(const char *pass, size_t before, const AST::ExprAST *body)
+    {
+        stats_.push_back(PassStats{pass, before, countNodes(body)});
+    }
+
+    // runPass - Rebuild body bottom-up into a new arena. `visit` sees each node after its children have been
+    // rebuilt and returns its replacement.
+    template <typename Visit>
+    const AST::ExprAST *runPass(const char *pass, const AST::ExprAST *body, std::unique_ptr<Arena> &arena,
+                                Visit &&visit)
+    {
+        size_t before = countNodes(body);
+        auto next = std::make_unique<Arena>();
+        out_ = next.get();
+        Memo memo;
+        body = rebuild(body, memo, visit);
+        arena = std::move(next);
+        record(pass, before, body);
+        return body;
+    }
+
+    template <typename Visit>
+    AST::ExprAST *rebuild(const AST::ExprAST *e, Memo &memo, Visit &visit)
+    {
+        auto it = memo.find(e);
+        if (it != memo.end())
+        {
+            return it->second;
+        }
+        AST::ExprAST *result;
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            auto l = rebuild(bin->getLHS(), memo, visit);
+            auto r = rebuild(bin->getRHS(), memo, visit);
+            result = visit(out_->make<AST::BinaryExprAST>(bin->getOp(), l, r));
+            break;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            std::vector<AST::ExprAST *> args;
+            for (auto arg : call->getArgs())
+            {
+                args.push_back(rebuild(arg, memo, visit));
+            }
+            result = visit(makeCall(call->getCallee(), args));
+            break;
+        }
+        default:
+            result = visit(copyLeaf(e));
+            break;
+        }
+        memo.emplace(e, result);
+        return result;
+    }
+
+    AST::ExprAST *copyLeaf(const AST::ExprAST *e)
+    {
+        if (e->getKind() == AST::ExprAST::Kind::Number)
+        {
+            return out_->make<AST::NumberExprAST>(static_cast<const AST::NumberExprAST *>(e)->getVal());
+        }
+        auto var = static_cast<const AST::VariableExprAST *>(e);
+        return out_->make<AST::VariableExprAST>(var->getName(), var->getIndex());
+    }
+
+    AST::ExprAST *makeCall(Symbol callee, const std::vector<AST::ExprAST *> &args)
+    {
+        return AST::CallExprAST::create(*out_, callee, args.data(), args.size());
+    }
+
+    //-----------------------
+    // inline
+    //-----------------------
+
+    // copy - Copy e into the output arena. Inside an inlined body, `bindings` maps the callee's parameters to the
+    // argument expressions; those are shared rather than copied, so the result is a DAG.
+    AST::ExprAST *copy(const AST::ExprAST *e, const std::vector<AST::ExprAST *> *bindings, size_t depth)
+    {
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+            return copyLeaf(e);
+        case AST::ExprAST::Kind::Variable:
+            if (bindings)
+            {
+                return (*bindings)[static_cast<const AST::VariableExprAST *>(e)->getIndex()];
+            }
+            return copyLeaf(e);
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<const AST::BinaryExprAST *>(e);
+            auto l = copy(bin->getLHS(), bindings, depth);
+            auto r = copy(bin->getRHS(), bindings, depth);
+            return out_->make<AST::BinaryExprAST>(bin->getOp(), l, r);
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<const AST::CallExprAST *>(e);
+            std::vector<AST::ExprAST *> args;
+            for (auto arg : call->getArgs())
+            {
+                args.push_back(copy(arg, bindings, depth));
+            }
+            if (auto callee = inlineCandidate(call, args, depth))
+            {
+                inline_stack_.push_back(callee->getProto().getName());
+                auto body = copy(callee->getBody(), &args, depth - 1);
+                inline_stack_.pop_back();
+                return body;
+            }
+            return makeCall(call->getCallee(), args);
+        }
+        }
+        return nullptr;
+    }
+
+    // inlineCandidate - The definition to splice in for call, if any. The arguments are substituted for the
+    // parameters, so one the callee never uses is never evaluated, and one it uses twice is shared: none of them
+    // may call an extern. Each splice is charged to inline_budget_, since the callee's own calls are inlined in
+    // turn and small bodies calling each other would otherwise grow exponentially with the depth.
+    const AST::FunctionAST *inlineCandidate(const AST::CallExprAST *call, const std::vector<AST::ExprAST *> &args,
+                                            size_t depth)
+    {
+        if (depth == 0)
+        {
+            return nullptr;
+        }
+        auto slot = module_.findSlot(call->getCallee());
+        if (!slot)
+        {
+            return nullptr;
+        }
+        const AST::FunctionAST *callee = module_.getSlot(*slot).function.get();
+        if (!callee || callee->getProto().getArgs().size() != call->getArgs().size())
+        {
+            return nullptr;
+        }
+        size_t size = countNodes(callee->getBody());
+        if (size > options_.inline_threshold || size > inline_budget_)
+        {
+            return nullptr;
+        }
+        for (Symbol name : inline_stack_)
+        {
+            if (name == callee->getProto().getName())
+            {
+                return nullptr; // Recursive.
+            }
+        }
+        for (auto arg : args)
+        {
+            if (reachesExtern(arg))
+            {
+                return nullptr;
+            }
+        }
+        inline_budget_ -= size;
+        return callee;
+    }
+
+    //-----------------------
+    // side effects
+    //-----------------------
+
+    // reachesExtern - Whether evaluating e may call an extern, directly or through the definitions it calls.
+    bool reachesExtern(const AST::ExprAST *e)
+    {
+        std::vector<const AST::ExprAST *> stack{e};
+        std::unordered_set<const AST::ExprAST *> seen;
+        while (!stack.empty())
+        {
+            e = stack.back();
+            stack.pop_back();
+            if (!seen.insert(e).second)
+            {
+                continue;
+            }
+            if (e->getKind() == AST::ExprAST::Kind::Binary)
+            {
+                auto bin = static_cast<const AST::BinaryExprAST *>(e);
+                stack.push_back(bin->getLHS());
+                stack.push_back(bin->getRHS());
+            }
+            else if (e->getKind() == AST::ExprAST::Kind::Call)
+            {
+                auto call = static_cast<const AST::CallExprAST *>(e);
+                if (calleeReachesExtern(call->getCallee()))
+                {
+                    return true;
+                }
+                for (auto arg : call->getArgs())
+                {
+                    stack.push_back(arg);
+                }
+            }
+        }
+        return false;
+    }
+
+    // calleeReachesExtern - Whether a call to name may call an extern: name is one, or a definition that calls one
+    // directly or indirectly. A name with nothing bound to it counts as one, since it could become one. Answers
+    // are kept until the next optimize(), as the module does not change in between.
+    bool calleeReachesExtern(Symbol name)
+    {
+        auto known = effects_.find(name);
+        if (known != effects_.end())
+        {
+            return known->second;
+        }
+        bool result = false;
+        std::vector<Symbol> pending{name};
+        std::unordered_set<Symbol> visited{name};
+        std::vector<const AST::ExprAST *> stack;
+        while (!result && !pending.empty())
+        {
+            auto slot = module_.findSlot(pending.back());
+            pending.pop_back();
+            const AST::FunctionAST *fn = slot ? module_.getSlot(*slot).function.get() : nullptr;
+            if (!fn)
+            {
+                result = true;
+                break;
+            }
+            stack.assign(1, fn->getBody());
+            while (!stack.empty())
+            {
+                const AST::ExprAST *e = stack.back();
+                stack.pop_back();
+                if (e->getKind() == AST::ExprAST::Kind::Binary)
+                {
+                    auto bin = static_cast<const AST::BinaryExprAST *>(e);
+                    stack.push_back(bin->getLHS());
+                    stack.push_back(bin->getRHS());
+                }
+                else if (e->getKind() == AST::ExprAST::Kind::Call)
+                {
+                    auto call = static_cast<const AST::CallExprAST *>(e);
+                    if (visited.insert(call->getCallee()).second)
+                    {
+                        pending.push_back(call->getCallee());
+                    }
+                    for (auto arg : call->getArgs())
+                    {
+                        stack.push_back(arg);
+                    }
+                }
+            }
+        }
+        effects_.emplace(name, result);
+        return result;
+    }
+
+    //-----------------------
+    // fold
+    //-----------------------
+
+    static bool isNumber(const AST::ExprAST *e, double *val = nullptr)
+    {
+        if (e->getKind() != AST::ExprAST::Kind::Number)
+        {
+            return false;
+        }
+        if (val)
+        {
+            *val = static_cast<const AST::NumberExprAST *>(e)->getVal();
+        }
+        return true;
+    }
+
+    // isExactly - Compares bitwise, so that 0.0 and -0.0 are told apart.
+    static bool isExactly(const AST::ExprAST *e, double expected)
+    {
+        double val;
+        return isNumber(e, &val) && memcmp(&val, &expected, sizeof(double)) == 0;
+    }
+
+    AST::ExprAST *fold(AST::ExprAST *e)
+    {
+        if (e->getKind() != AST::ExprAST::Kind::Binary)
+        {
+            return e;
+        }
+        auto bin = static_cast<AST::BinaryExprAST *>(e);
+        double l, r;
+        if (!isNumber(bin->getLHS(), &l) || !isNumber(bin->getRHS(), &r))
+        {
+            return e;
+        }
+        switch (bin->getOp())
+        {
+        case '+': return out_->make<AST::NumberExprAST>(l + r);
+        case '-': return out_->make<AST::NumberExprAST>(l - r);
+        case '*': return out_->make<AST::NumberExprAST>(l * r);
+        case '<': return out_->make<AST::NumberExprAST>(l < r ? 1.0 : 0.0);
+        default: return e;
+        }
+    }
+
+    //-----------------------
+    // simplify
+    //-----------------------
+
+    AST::ExprAST *simplify(AST::ExprAST *e)
+    {
+        if (e->getKind() != AST::ExprAST::Kind::Binary)
+        {
+            return e;
+        }
+        auto bin = static_cast<AST::BinaryExprAST *>(e);
+        AST::ExprAST *l = bin->getLHS();
+        AST::ExprAST *r = bin->getRHS();
+        switch (bin->getOp())
+        {
+        case '*':
+            // x * 1 is exactly x for every double, including NaN, infinities and -0.
+            if (isExactly(r, 1.0))
+            {
+                return l;
+            }
+            if (isExactly(l, 1.0))
+            {
+                return r;
+            }
+            if (options_.finite_math && options_.no_signed_zeros &&
+                ((isExactly(r, 0.0) && !reachesExtern(l)) || (isExactly(l, 0.0) && !reachesExtern(r))))
+            {
+                return out_->make<AST::NumberExprAST>(0.0);
+            }
+            break;
+        case '+':
+            // x + -0 is exactly x; x + 0 turns a -0 into +0.
+            if (isExactly(r, -0.0) || (options_.no_signed_zeros && isExactly(r, 0.0)))
+            {
+                return l;
+            }
+            if (isExactly(l, -0.0) || (options_.no_signed_zeros && isExactly(l, 0.0)))
+            {
+                return r;
+            }
+            break;
+        case '-':
+            // x - 0 is exactly x, -0 included.
+            if (isExactly(r, 0.0) || (options_.no_signed_zeros && isExactly(r, -0.0)))
+            {
+                return l;
+            }
+            if (options_.finite_math && options_.no_signed_zeros && sameValue(l, r))
+            {
+                return out_->make<AST::NumberExprAST>(0.0);
+            }
+            break;
+        default:
+            break;
+        }
+        return fold(e);
+    }
+
+    // sameValue - Whether a and b compute the same value without calling an extern, so that x - x can go. CSE has
+    // not run yet, so equal operands are usually distinct nodes and are compared structurally.
+    bool sameValue(const AST::ExprAST *a, const AST::ExprAST *b)
+    {
+        if (a == b)
+        {
+            return !reachesExtern(a);
+        }
+        if (a->getKind() != b->getKind())
+        {
+            return false;
+        }
+        switch (a->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+        {
+            double x = static_cast<const AST::NumberExprAST *>(a)->getVal();
+            return isExactly(b, x);
+        }
+        case AST::ExprAST::Kind::Variable:
+            return static_cast<const AST::VariableExprAST *>(a)->getIndex() ==
+                   static_cast<const AST::VariableExprAST *>(b)->getIndex();
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto x = static_cast<const AST::BinaryExprAST *>(a);
+            auto y = static_cast<const AST::BinaryExprAST *>(b);
+            return x->getOp() == y->getOp() && sameValue(x->getLHS(), y->getLHS()) &&
+                   sameValue(x->getRHS(), y->getRHS());
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto x = static_cast<const AST::CallExprAST *>(a);
+            auto y = static_cast<const AST::CallExprAST *>(b);
+            if (x->getCallee() != y->getCallee() || x->getArgs().size() != y->getArgs().size() ||
+                calleeReachesExtern(x->getCallee()))
+            {
+                return false;
+            }
+            for (size_t i = 0; i < x->getArgs().size(); ++i)
+            {
+                if (!sameValue(x->getArgs()[i], y->getArgs()[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+
+    //-----------------------
+    // cse
+    //-----------------------
+
+    // hashCons - Return the existing node equal to e, or record e as the canonical one. Children are already
+    // canonical, so equality only needs to compare pointers one level down. Only calls that cannot reach an extern
+    // are merged, since an extern may have side effects; their arguments are canonical too, so they cannot reach
+    // one either.
+    AST::ExprAST *hashCons(AST::ExprAST *e)
+    {
+        std::string key(1, static_cast<char>(e->getKind()));
+        switch (e->getKind())
+        {
+        case AST::ExprAST::Kind::Number:
+        {
+            double val = static_cast<AST::NumberExprAST *>(e)->getVal();
+            key.append(reinterpret_cast<const char *>(&val), sizeof(val));
+            break;
+        }
+        case AST::ExprAST::Kind::Variable:
+        {
+            uint32_t index = static_cast<AST::VariableExprAST *>(e)->getIndex();
+            key.append(reinterpret_cast<const char *>(&index), sizeof(index));
+            break;
+        }
+        case AST::ExprAST::Kind::Binary:
+        {
+            auto bin = static_cast<AST::BinaryExprAST *>(e);
+            const AST::ExprAST *children[2] = {bin->getLHS(), bin->getRHS()};
+            key += bin->getOp();
+            key.append(reinterpret_cast<const char *>(children), sizeof(children));
+            break;
+        }
+        case AST::ExprAST::Kind::Call:
+        {
+            auto call = static_cast<AST::CallExprAST *>(e);
+            Symbol callee = call->getCallee();
+            if (calleeReachesExtern(callee))
+            {
+                return e;
+            }
+            key.append(reinterpret_cast<const char *>(&callee), sizeof(callee));
+            for (auto arg : call->getArgs())
+            {
+                key.append(reinterpret_cast<const char *>(&arg), sizeof(arg));
+            }
+            break;
+        }
+        }
+        return cse_.emplace(std::move(key), e).first->second;
+    }
+
+    const Module &module_;
+    Options options_;
+    std::vector<PassStats> stats_;
+    Arena *out_ = nullptr;
+    std::vector<Symbol> inline_stack_;
+    size_t inline_budget_ = 0; // Nodes inlining may still add to the current definition.
+    std::unordered_map<std::string, AST::ExprAST *> cse_;
+    std::unordered_map<Symbol, bool> effects_; // calleeReachesExtern answers.
+};
+
+#endif // OPTIMIZER_HPP
@@ -0,0 +1,203 @@
+#ifndef PARALLEL_PARSER_HPP
+#define PARALLEL_PARSER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+
+//-----------------------
+// Parallel parser
+//-----------------------
+
+// ParallelParser - Parses a whole buffer on several threads at once.
+// The buffer is cut into chunks at item boundaries, workers take chunks off a shared counter and parse each with
+// a Lexer and Parser of its own (so each has its own arenas and symbol cache), and the items come back in source
+// order. Errors come back as Error items in the place they were reported, so they can be printed in source order
+// too. Recovery from a syntax error (Parser::recover) resyncs on the same tokens chunks are cut at, so the items
+// do not depend on the number of jobs.
+class ParallelParser
+{
+public:
+    // Chunks per worker: more than one, so a worker that drew easy chunks can help with the rest.
+    static constexpr size_t kChunksPerJob = 8;
+    // Below this a chunk is not worth handing to another thread.
+    static constexpr size_t kMinChunkBytes = 16 * 1024;
+
+    explicit ParallelParser(size_t jobs) : jobs_{std::max<size_t>(jobs, 1)} {}
+
+    // installBinop - Declare a binary operator and its precedence, as Parser::installBinop.
+    void installBinop(char op, int prec) { binops_.emplace_back(op, prec); }
+
+    void installStandardBinops()
+    {
+        for (auto const &binop : Parser::kStandardBinops)
+        {
+            installBinop(binop.first, binop.second);
+        }
+    }
+
+    std::vector<ParsedItem> parse(std::string_view text) const
+    {
+        std::vector<size_t> cuts = cutPoints(text);
+        size_t chunks = cuts.size() - 1;
+        std::vector<std::vector<ParsedItem>> results(chunks);
+
+        std::atomic<size_t> next{0};
+        auto work = [&]() {
+            for (size_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < chunks;)
+            {
+                parseChunk(text.substr(cuts[c], cuts[c + 1] - cuts[c]), results[c]);
+            }
+        };
+        size_t threads = std::min(jobs_, chunks);
+        std::vector<Stats> worker_stats(threads > 1 ? threads - 1 : 0);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < worker_stats.size(); ++i)
+        {
+            workers.emplace_back([&work, &worker_stats, i]() {
+                work();
+                // The worker's counters die with it; hand them to the calling thread.
+                worker_stats[i] = stats();
+            });
+        }
+        work();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        for (auto const &counts : worker_stats)
+        {
+            stats() += counts;
+        }
+
+        std::vector<ParsedItem> items;
+        for (auto &result : results)
+        {
+            std::move(result.begin(), result.end(), std::back_inserter(items));
+        }
+        return items;
+    }
+
+private:
+    // cutPoints - Chunk boundaries: 0, then the start of a 'def', 'extern' or ';' near each multiple of the chunk
+    // size, then text.size(). None of those tokens can occur inside an item, so every item falls in one chunk.
+    std::vector<size_t> cutPoints(std::string_view text) const
+    {
+        size_t chunk = std::max(kMinChunkBytes, text.size() / (jobs_ * kChunksPerJob) + 1);
+        std::vector<size_t> cuts{0};
+        for (size_t target = chunk; target < text.size(); target = cuts.back() + chunk)
+        {
+            size_t cut = nextBoundary(text, target);
+            if (cut >= text.size())
+            {
+                break;
+            }
+            cuts.push_back(cut);
+        }
+        cuts.push_back(text.size());
+        return cuts;
+    }
+
+    // nextBoundary - Offset of the first boundary token on a line starting at or after `from`. Tokens and
+    // comments never span a newline, so lexing can safely start at the beginning of any line.
+    static size_t nextBoundary(std::string_view text, size_t from)
+    {
+        size_t i = text.find('\n', from - 1);
+        if (i == std::string_view::npos)
+        {
+            return text.size();
+        }
+        auto at = [&](size_t k) { return static_cast<unsigned char>(text[k]); };
+        while (++i < text.size())
+        {
+            int c = at(i);
+            if (c == ';')
+            {
+                return i;
+            }
+            else if (c == '#')
+            {
+                // Comment until end of line.
+                while (i + 1 < text.size() && at(i + 1) != '\n' && at(i + 1) != '\r')
+                {
+                    ++i;
+                }
+            }
+            else if (isalpha(c))
+            {
+                size_t start = i;
+                while (i + 1 < text.size() && isalnum(at(i + 1)))
+                {
+                    ++i;
+                }
+                std::string_view word = text.substr(start, i + 1 - start);
+                if (word == "def" || word == "extern")
+                {
+                    return start;
+                }
+            }
+            else if (isdigit(c) || c == '.')
+            {
+                while (i + 1 < text.size() && (isdigit(at(i + 1)) || at(i + 1) == '.'))
+                {
+                    ++i;
+                }
+            }
+        }
+        return text.size();
+    }
+
+    // parseChunk - The main loop, minus evaluation: parse every item of the chunk into out.
+    void parseChunk(std::string_view chunk, std::vector<ParsedItem> &out) const
+    {
+        MemorySource source{chunk};
+        Lexer lexer{source};
+        Parser parser{lexer};
+        for (auto const &binop : binops_)
+        {
+            parser.installBinop(binop.first, binop.second);
+        }
+        parser.setDiagnosticSink([&out](std::string_view message) {
+            ParsedItem error{};
+            error.kind = ParsedItem::Kind::Error;
+            error.message = std::string(message);
+            out.push_back(std::move(error));
+        });
+
+        parser.getNextToken();
+        while (parser.curTok() != static_cast<int>(Token::tok_eof))
+        {
+            if (parser.curTok() == ';')
+            {
+                // ignore top-level semicolons.
+                parser.getNextToken();
+                continue;
+            }
+            ParsedItem item = parser.parseItem();
+            if (item.parsed())
+            {
+                out.push_back(std::move(item));
+            }
+            else
+            {
+                parser.recover();
+            }
+        }
+    }
+
+    size_t jobs_;
+    std::vector<std::pair<char, int>> binops_;
+};
+
+#endif // PARALLEL_PARSER_HPP
@@ -0,0 +1,407 @@
+#ifndef PARSER_HPP
+#define PARSER_HPP
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "arena.hpp"
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "stats.hpp"
+#include "symbol.hpp"
+
+//-----------------------
+// Parser
+//-----------------------
+
+// ParsedItem - One top-level item, or an error the parser reported in its place.
+struct ParsedItem
+{
+    enum class Kind : unsigned char { Definition, Extern, TopLevelExpr, Error };
+
+    Kind kind;
+    std::unique_ptr<AST::FunctionAST> function; // Set for definitions and top-level expressions.
+    std::unique_ptr<AST::PrototypeAST> proto;   // Set for externs.
+    std::string message;                        // Set for errors.
+
+    bool parsed() const { return function || proto; }
+};
+
+class Parser
+{
+public:
+    // DiagnosticSink - Receives the message of every error the parser reports.
+    using DiagnosticSink = std::function<void(std::string_view)>;
+
+    explicit Parser(TokenStream &lexer) : lexer{lexer} {}
+
+    // setDiagnosticSink - Send errors to sink instead of printing them to stderr.
+    void setDiagnosticSink(DiagnosticSink sink) { diagnostics = std::move(sink); }
+
+    // installBinop - Declare a binary operator and its precedence. 1 is lowest precedence.
+    void installBinop(char op, int prec) { binop_precedence[op] = prec; }
+
+    // kStandardBinops - The standard binary operators and their precedences.
+    static constexpr std::pair<char, int> kStandardBinops[] = {
+        {'<', 10},
+        {'+', 20},
+        {'-', 20},
+        {'*', 40}, // highest.
+    };
+
+    // installStandardBinops - Install the standard binary operators.
+    void installStandardBinops()
+    {
+        for (auto const &binop : kStandardBinops)
+        {
+            installBinop(binop.first, binop.second);
+        }
+    }
+
+    // CurTok/getNextToken - Provide a simple token buffer. CurTok is the current token the parser is looking at.
+    // getNextToken reads another token from the lexer and updates CurTok with its results.
+    int curTok() const { return cur_tok; }
+    int getNextToken() { return cur_tok = lexer.getTok(); }
+
+    // GetTokPrecedence - Get the precedence of the pending binary operator token.
+    int getTokPrecedence()
+    {
+        if (!isascii(cur_tok))
+        {
+            return -1;
+        }
+
+        // Make sure it's a declared binop.
+        int tok_prec = binop_precedence[cur_tok];
+        if (tok_prec <= 0)
+        {
+            return -1;
+        }
+        return tok_prec;
+    }
+
+    // LogError* - These are little helper functions for error handling.
+    AST::ExprAST *logError(const char *str)
+    {
+        if (diagnostics)
+        {
+            diagnostics(str);
+        }
+        else
+        {
+            fmt::print(stderr, "Error: {}\n", str);
+        }
+        return nullptr;
+    }
+    std::unique_ptr<AST::PrototypeAST> logErrorP(const char *str)
+    {
+        logError(str);
+        return nullptr;
+    }
+
+    // numberexpr ::= number
+    AST::ExprAST *parseNumberExpr()
+    {
+        auto result = arena->make<AST::NumberExprAST>(lexer.num_val);
+        STATS_ADD(nodes, 1);
+        getNextToken(); // consume the number
+        return result;
+    }
+
+    // parenexpr ::= '(' expression ')'
+    AST::ExprAST *parseParenExpr()
+    {
+        getNextToken(); // consume '('
+        auto v = parseExpression();
+        if (!v)
+        {
+            return nullptr;
+        }
+
+        if (cur_tok != ')')
+        {
+            return logError("expected ')'");
+        }
+        getNextToken(); // consume ')'
+        return v;
+    }
+
+    // identifierexpr
+    // ::= identifier
+    // ::= identifier '(' expression* ')'
+    AST::ExprAST *parseIdentifierExpr()
+    {
+        Symbol id_name = lexer.identifier;
+
+        getNextToken(); // consume identifier
+
+        if (cur_tok != '(')
+        { // Simple variable ref, resolved to the argument it names.
+            for (size_t i = 0; i < params->size(); ++i)
+            {
+                if ((*params)[i] == id_name)
+                {
+                    STATS_ADD(nodes, 1);
+                    return arena->make<AST::VariableExprAST>(id_name, static_cast<uint32_t>(i));
+                }
+            }
+            return logError("Unknown variable name");
+        }
+
+        // Call.
+        getNextToken(); // consume '('
+        // Arguments collect on a shared stack (nested calls push above us) and are copied into the arena at the end.
+        size_t args_begin = arg_stack.size();
+        if (cur_tok != ')')
+        {
+            while (true)
+            {
+                if (auto arg = parseExpression())
+                {
+                    arg_stack.push_back(arg);
+                }
+                else
+                {
+                    arg_stack.resize(args_begin);
+                    return nullptr;
+                }
+
+                if (cur_tok == ')')
+                {
+                    break;
+                }
+
+                if (cur_tok != ',')
+                {
+                    arg_stack.resize(args_begin);
+                    return logError("Expected ')' or ',' in argument list");
+                }
+                getNextToken();
+            }
+        }
+
+        // Eat the ')'.
+        getNextToken();
+
+        size_t num_args = arg_stack.size() - args_begin;
+        auto call = AST::CallExprAST::create(*arena, id_name, arg_stack.data() + args_begin, num_args);
+        arg_stack.resize(args_begin);
+        STATS_ADD(nodes, 1);
+        return call;
+    }
+
+    // primary
+    // ::= identifierexpr
+    // ::= numberexpr
+    // ::= parenexpr
+    AST::ExprAST *parsePrimary()
+    {
+        switch (cur_tok)
+        {
+        default:
+            return logError("unknown token when expecting an expression");
+        case static_cast<int>(Token::tok_identifier):
+            return parseIdentifierExpr();
+        case static_cast<int>(Token::tok_number):
+            return parseNumberExpr();
+        case '(':
+            return parseParenExpr();
+        }
+    }
+
+    // binoprhs
+    // ::= ('+' primary)*
+    AST::ExprAST *parseBinOpRHS(int expr_prec, AST::ExprAST *lhs)
+    {
+        // If this is a binop, find its precedence.
+        while (true)
+        {
+            int tok_prec = getTokPrecedence();
+
+            // If this is a binop that binds at least as tightly as the current binop,
+            // consume it, otherwise we are done.
+            if (tok_prec < expr_prec)
+            {
+                return lhs;
+            }
+
+            // Okay, we know this is a binop.
+            int binop = cur_tok;
+            getNextToken(); // consume binop
+
+            // Parse the primary expression after the binary operator.
+            auto rhs = parsePrimary();
+            if (!rhs)
+            {
+                return nullptr;
+            }
+
+            // If BinOp binds less tightly with RHS than the operator after RHS,
+            // let the pending operator take RHS as its LHS.
+            int next_prec = getTokPrecedence();
+            if (tok_prec < next_prec)
+            {
+                rhs = parseBinOpRHS(tok_prec + 1, rhs);
+                if (!rhs)
+                {
+                    return nullptr;
+                }
+            }
+
+            // Merge LHS/RHS.
+            lhs = arena->make<AST::BinaryExprAST>(binop, lhs, rhs);
+            STATS_ADD(nodes, 1);
+        }
+    }
+
+    // expression
+    // ::= primary binoprhs
+    //
+    AST::ExprAST *parseExpression()
+    {
+        auto lhs = parsePrimary();
+        if (!lhs)
+        {
+            return nullptr;
+        }
+
+        return parseBinOpRHS(0, lhs);
+    }
+
+    // prototype
+    // ::= id '(' id* ')'
+    std::unique_ptr<AST::PrototypeAST> parsePrototype()
+    {
+        if (cur_tok != static_cast<int>(Token::tok_identifier))
+        {
+            return logErrorP("Expected function name in prototype");
+        }
+
+        Symbol fn_name = lexer.identifier;
+        getNextToken();
+
+        if (cur_tok != '(')
+        {
+            return logErrorP("Expected '(' in prototype");
+        }
+
+        std::vector<Symbol> arg_names;
+        while (getNextToken() == static_cast<int>(Token::tok_identifier))
+        {
+            arg_names.push_back(lexer.identifier);
+        }
+        if (cur_tok != ')')
+        {
+            return logErrorP("Expected ')' in prototype");
+        }
+
+        // success.
+        getNextToken(); // eat ')'.
+
+        return std::make_unique<AST::PrototypeAST>(fn_name, std::move(arg_names));
+    }
+
+    // definition ::= 'def' prototype expression
+    std::unique_ptr<AST::FunctionAST> parseDefinition()
+    {
+        getNextToken(); // eat def.
+        auto proto = parsePrototype();
+        if (!proto)
+        {
+            return nullptr;
+        }
+
+        auto body_arena = std::make_unique<Arena>();
+        arena = body_arena.get();
+        params = &proto->getArgs();
+        if (auto e = parseExpression())
+        {
+            return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(body_arena), e);
+        }
+        return nullptr;
+    }
+
+    // toplevelexpr ::= expression
+    std::unique_ptr<AST::FunctionAST> parseTopLevelExpr()
+    {
+        auto body_arena = std::make_unique<Arena>();
+        arena = body_arena.get();
+        params = &no_params;
+        if (auto e = parseExpression())
+        {
+            // Make an anonymous proto.
+            auto proto = std::make_unique<AST::PrototypeAST>(SymbolTable::kAnonExpr, std::vector<Symbol>());
+            return std::make_unique<AST::FunctionAST>(std::move(proto), std::move(body_arena), e);
+        }
+        return nullptr;
+    }
+
+    // external ::= 'extern' prototype
+    std::unique_ptr<AST::PrototypeAST> parseExtern()
+    {
+        getNextToken(); // eat extern.
+        return parsePrototype();
+    }
+
+    // item ::= definition | external | expression
+    // On a parse error the item has neither a function nor a prototype, and the caller is left to recover().
+    ParsedItem parseItem()
+    {
+        STATS_ADD(items, 1);
+        ParsedItem item{};
+        switch (cur_tok)
+        {
+        case static_cast<int>(Token::tok_def):
+            item.kind = ParsedItem::Kind::Definition;
+            item.function = parseDefinition();
+            break;
+        case static_cast<int>(Token::tok_extern):
+            item.kind = ParsedItem::Kind::Extern;
+            item.proto = parseExtern();
+            break;
+        default:
+            item.kind = ParsedItem::Kind::TopLevelExpr;
+            item.function = parseTopLevelExpr();
+            break;
+        }
+        return item;
+    }
+
+    // recover - Error recovery after parseItem failed: skip to the next token that can only start an item,
+    // 'def', 'extern' or ';', unless the error was found on one. ParallelParser cuts its chunks at these tokens, so
+    // every driver resyncs in the same place however the input was split.
+    void recover()
+    {
+        while (cur_tok != static_cast<int>(Token::tok_def) && cur_tok != static_cast<int>(Token::tok_extern) &&
+               cur_tok != ';' && cur_tok != static_cast<int>(Token::tok_eof))
+        {
+            getNextToken();
+        }
+    }
+
+private:
+    TokenStream &lexer;
+
+    int cur_tok;
+    // Arena - Owns the nodes of the item being parsed; handed over to its FunctionAST when parsing succeeds.
+    Arena *arena = nullptr;
+    // Params - Arguments of the function being parsed, which are the only names a variable can refer to.
+    const std::vector<Symbol> no_params;
+    const std::vector<Symbol> *params = &no_params;
+    // ArgStack - Scratch space for call arguments, reused across calls so parsing them doesn't allocate.
+    std::vector<AST::ExprAST *> arg_stack;
+    DiagnosticSink diagnostics;
+    // BinopPrecedence - This holds the precedence for each binary operator that is defined.
+    std::map<char, int> binop_precedence;
+};
+
+#endif // PARSER_HPP
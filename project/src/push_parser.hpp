@@ -0,0 +1,218 @@
+#ifndef PUSH_PARSER_HPP
+#define PUSH_PARSER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+//-----------------------
+// Push parser
+//-----------------------
+
+// TokenBuffer - A TokenStream over tokens that were lexed ahead of time, which the parser can be rewound over.
+// Reading past the end returns tok_eof; until finish() that only means the rest has not arrived yet, and
+// starved() says so.
+class TokenBuffer : public TokenStream
+{
+public:
+    int getTok() override
+    {
+        if (pos_ < tokens_.size())
+        {
+            auto const &t = tokens_[pos_++];
+            identifier = t.identifier;
+            num_val = t.num_val;
+            return t.tok;
+        }
+        ++pos_;
+        starved_ = !finished_;
+        return static_cast<int>(Token::tok_eof);
+    }
+
+    std::vector<BufferedToken> &tokens() { return tokens_; }
+    const BufferedToken &operator[](size_t i) const { return tokens_[i]; }
+    size_t size() const { return tokens_.size(); }
+
+    // pos - Index of the token most recently returned by getTok(), plus one.
+    size_t pos() const { return pos_; }
+    void seek(size_t pos)
+    {
+        pos_ = pos;
+        starved_ = false;
+    }
+
+    // drop - Forget the first n tokens, shifting positions down by n.
+    void drop(size_t n)
+    {
+        tokens_.erase(tokens_.begin(), tokens_.begin() + n);
+        pos_ = pos_ > n ? pos_ - n : 0;
+    }
+
+    void finish() { finished_ = true; }
+    bool finished() const { return finished_; }
+    bool starved() const { return starved_; }
+
+private:
+    std::vector<BufferedToken> tokens_;
+    size_t pos_ = 0;
+    bool starved_ = false;
+    bool finished_ = false;
+};
+
+// PushParser - Parses input that is pushed to it in chunks of any size, so one thread can serve many streams
+// without blocking on any of them. Items come out of feed() as soon as they are known to be complete.
+//
+// An item is only parsed once a token that cannot be part of it - 'def', 'extern' or ';' - has arrived after its
+// start, or the input is finished; up to then its tokens wait in a buffer. Should the parser still run out of
+// tokens, the item is rewound and retried with the next chunk. An item longer than max_pending_tokens is
+// reported and skipped up to the next 'def', 'extern' or ';', so a session never holds more than that many
+// tokens plus one chunk's worth, and PushLexer::kMaxTokenBytes of a partial token.
+class PushParser
+{
+public:
+    static constexpr size_t kDefaultMaxPendingTokens = 1 << 16;
+
+    explicit PushParser(size_t max_pending_tokens = kDefaultMaxPendingTokens)
+        : parser_{tokens_}, max_pending_{max_pending_tokens} {}
+
+    PushParser(const PushParser &) = delete;
+    PushParser &operator=(const PushParser &) = delete;
+
+    // parser - For installing binary operators.
+    Parser &parser() { return parser_; }
+
+    // feed - Consume the next chunk, appending every item it completes to items.
+    void feed(std::string_view chunk, std::vector<ParsedItem> &items)
+    {
+        size_t old_size = tokens_.size();
+        lexer_.feed(chunk, tokens_.tokens());
+        noteTokens(old_size);
+        parseReady(items);
+
+        if (!tokens_.finished() && tokens_.size() - item_start_ > max_pending_)
+        {
+            fmt::print(stderr, "Error: item longer than {} tokens\n", max_pending_);
+            tokens_.drop(tokens_.size());
+            item_start_ = 0;
+            discarding_ = true;
+        }
+    }
+
+    // finish - End of input: parse whatever is left.
+    void finish(std::vector<ParsedItem> &items)
+    {
+        size_t old_size = tokens_.size();
+        lexer_.finish(tokens_.tokens());
+        tokens_.finish();
+        noteTokens(old_size);
+        parseReady(items);
+    }
+
+    // pendingTokens - Tokens lexed but not yet part of a parsed item.
+    size_t pendingTokens() const { return tokens_.size() - item_start_; }
+
+private:
+    static bool isBoundary(int tok)
+    {
+        return tok == static_cast<int>(Token::tok_def) || tok == static_cast<int>(Token::tok_extern) || tok == ';';
+    }
+
+    // noteTokens - Account for the tokens appended from old_size on: drop them while skipping an overlong item,
+    // and remember where the last boundary is.
+    void noteTokens(size_t old_size)
+    {
+        auto const &tokens = tokens_.tokens();
+        for (size_t i = old_size; i < tokens.size(); ++i)
+        {
+            if (isBoundary(tokens[i].tok))
+            {
+                if (discarding_)
+                {
+                    tokens_.drop(i);
+                    discarding_ = false;
+                    i = 0;
+                }
+                last_boundary_ = i;
+                has_boundary_ = true;
+            }
+        }
+        if (discarding_)
+        {
+            tokens_.drop(tokens_.size());
+        }
+    }
+
+    bool ready() const
+    {
+        return item_start_ < tokens_.size() &&
+               (tokens_.finished() || tokens_[item_start_].tok == ';' ||
+                (has_boundary_ && last_boundary_ > item_start_));
+    }
+
+    void parseReady(std::vector<ParsedItem> &items)
+    {
+        while (ready())
+        {
+            tokens_.seek(item_start_);
+            if (parser_.getNextToken() == ';')
+            {
+                // ignore top-level semicolons.
+                ++item_start_;
+                continue;
+            }
+            ParsedItem item = parser_.parseItem();
+
+            if (tokens_.starved())
+            {
+                // The item runs on past the tokens we have; try again from its start once more arrive.
+                break;
+            }
+            if (item.parsed())
+            {
+                items.push_back(std::move(item));
+            }
+            else
+            {
+                parser_.recover();
+            }
+            // The parser stops with the first token of the next item as its current token.
+            item_start_ = tokens_.pos() - 1;
+        }
+
+        if (item_start_ > tokens_.size())
+        {
+            item_start_ = tokens_.size();
+        }
+        if (item_start_ > 0)
+        {
+            tokens_.drop(item_start_);
+            if (has_boundary_ && last_boundary_ >= item_start_)
+            {
+                last_boundary_ -= item_start_;
+            }
+            else
+            {
+                has_boundary_ = false;
+            }
+            item_start_ = 0;
+        }
+    }
+
+    PushLexer lexer_;
+    TokenBuffer tokens_;
+    Parser parser_;
+    size_t max_pending_;
+    size_t item_start_ = 0;    // First token of the item being waited for.
+    size_t last_boundary_ = 0; // Position of the last 'def', 'extern' or ';', if has_boundary_.
+    bool has_boundary_ = false;
+    bool discarding_ = false;
+};
+
+#endif // PUSH_PARSER_HPP
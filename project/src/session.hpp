@@ -0,0 +1,294 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "call_graph.hpp"
+#include "jit.hpp"
+#include "module.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+//-----------------------
+// Session
+//-----------------------
+
+// Session - Everything defined so far, and the engines that run it.
+// The module keeps each definition as parsed; what the engines run is an optimized copy. Every definition gets
+// bytecode; the JIT additionally compiles what it can, and the VM runs the rest.
+class Session
+{
+public:
+    Session() = default;
+    explicit Session(Optimizer::Options options) : optimizer_{module_, options} {}
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    const Module &module() const { return module_; }
+
+    // Per-pass node counts of the last optimized definition or expression.
+    const std::vector<Optimizer::PassStats> &optStats() const { return opt_stats_; }
+
+    // define - Add or replace a definition. Returns false, having reported why, if it does not compile, or if a
+    // definition that calls it would no longer compile; the old definition stays in place then.
+    bool define(std::unique_ptr<AST::FunctionAST> fn)
+    {
+        Symbol name = fn->getProto().getName();
+        bool existed = module_.findSlot(name).has_value();
+        auto affected = graph_.dependents(name);
+        if (existed || affected.size() > 1)
+        {
+            // Everything in affected was compiled against the old binding, so bind the new definition first and
+            // compile it along with them.
+            uint32_t slot = module_.slotFor(name);
+            std::vector<uint32_t> compiled;
+            for (Symbol dependent : affected)
+            {
+                if (auto caller = module_.findSlot(dependent); caller && *caller != slot && vm_.lookup(*caller))
+                {
+                    compiled.push_back(*caller);
+                }
+            }
+            Module::Slot old = module_.exchange(slot, Module::Slot{name, std::move(fn), nullptr, nullptr});
+            setCallees(*module_.getSlot(slot).function);
+            std::vector<uint32_t> failed;
+            rebuild(affected, &failed);
+
+            // A caller that used to compile and no longer does would be left undefined.
+            bool ok = true;
+            std::string broken;
+            for (uint32_t failed_slot : failed)
+            {
+                if (failed_slot == slot)
+                {
+                    ok = false;
+                }
+                else if (std::find(compiled.begin(), compiled.end(), failed_slot) != compiled.end())
+                {
+                    broken += broken.empty() ? "" : ", ";
+                    broken += symbols().name(module_.getSlot(failed_slot).name);
+                }
+            }
+            if (ok && broken.empty())
+            {
+                return true;
+            }
+            if (!broken.empty())
+            {
+                fmt::print(stderr, "Error: redefining {} would break {}\n", symbols().name(name), broken);
+            }
+            // Put the old binding back, along with what was compiled against it.
+            module_.exchange(slot, std::move(old));
+            if (auto const &restored = module_.getSlot(slot).function)
+            {
+                setCallees(*restored);
+            }
+            else
+            {
+                graph_.setCallees(name, {});
+            }
+            rebuild(affected);
+            return false;
+        }
+
+        auto optimized = optimizer_.optimize(*fn);
+        opt_stats_ = optimizer_.stats();
+        auto code = compiler_.compile(*optimized);
+        if (!code)
+        {
+            return false;
+        }
+        setCallees(*fn);
+        uint32_t slot = module_.addFunction(std::move(fn));
+        vm_.define(slot, std::move(code));
+        jit_.define(slot, jit_.compile(*optimized));
+        return true;
+    }
+
+    // declareExtern - Bind a prototype to the native symbol of the same name. Returns false if there is none.
+    bool declareExtern(std::unique_ptr<AST::PrototypeAST> proto)
+    {
+        Symbol name = proto->getName();
+        size_t arity = proto->getArgs().size();
+        auto old = module_.findSlot(name);
+        // Declaring an extern again changes nothing: the symbol resolves to the same native code.
+        bool unchanged = old && !module_.getSlot(*old).function && module_.getSlot(*old).arity() == arity;
+        if (!module_.addExtern(std::move(proto)))
+        {
+            return false;
+        }
+        graph_.setCallees(name, {});
+        if (!unchanged)
+        {
+            rebuild(graph_.dependents(name));
+        }
+        return true;
+    }
+
+    // defineAll - Add a batch of definitions and externs, such as a whole library, compiling everything once at
+    // the end rather than after each redefinition. Returns false, having reported why, if an extern is unknown or
+    // anything does not compile.
+    bool defineAll(std::vector<ParsedItem> items)
+    {
+        bool ok = true;
+        std::vector<Symbol> names;
+        for (auto &item : items)
+        {
+            if (item.kind == ParsedItem::Kind::Definition)
+            {
+                names.push_back(item.function->getProto().getName());
+                setCallees(*item.function);
+                module_.addFunction(std::move(item.function));
+            }
+            else if (item.kind == ParsedItem::Kind::Extern)
+            {
+                Symbol name = item.proto->getName();
+                if (!module_.addExtern(std::move(item.proto)))
+                {
+                    fmt::print(stderr, "Error: Unknown extern\n");
+                    ok = false;
+                    continue;
+                }
+                names.push_back(name);
+                graph_.setCallees(name, {});
+            }
+        }
+
+        std::vector<Symbol> affected;
+        for (Symbol name : names)
+        {
+            for (Symbol dependent : graph_.dependents(name))
+            {
+                affected.push_back(dependent);
+            }
+        }
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+        return rebuild(affected) && ok;
+    }
+
+    // evaluate - Run an anonymous top-level expression, JIT'd if possible. Returns nothing, having reported
+    // why, if it fails to compile or run.
+    std::optional<double> evaluate(const AST::FunctionAST &fn)
+    {
+        auto optimized = optimizer_.optimize(fn);
+        opt_stats_ = optimizer_.stats();
+        auto code = compiler_.compile(*optimized);
+        if (!code)
+        {
+            return std::nullopt;
+        }
+        uint8_t *mark = jit_.mark();
+        if (void *native = jit_.compile(*optimized))
+        {
+            double result = reinterpret_cast<double (*)()>(native)();
+            jit_.rewind(mark);
+            return result;
+        }
+        try
+        {
+            return vm_.run(std::move(code), nullptr);
+        }
+        catch (const std::exception &e)
+        {
+            fmt::print(stderr, "Error: {}\n", e.what());
+            return std::nullopt;
+        }
+    }
+
+private:
+    void setCallees(const AST::FunctionAST &fn)
+    {
+        std::vector<Symbol> callees;
+        CallGraph::collectCallees(fn.getBody(), callees);
+        graph_.setCallees(fn.getProto().getName(), std::move(callees));
+    }
+
+    // rebuild - Recompile the named definitions after a name they depend on was rebound; names without a
+    // definition are skipped. Callers may have inlined the old body, and JIT'd callers call its code directly, so
+    // names must come with all of their dependents. Returns false if any definition no longer compiles, and
+    // appends the slots of those to failed if given. The pass stats kept are those of names.front().
+    bool rebuild(const std::vector<Symbol> &names, std::vector<uint32_t> *failed = nullptr)
+    {
+        std::vector<uint32_t> slots;
+        for (Symbol name : names)
+        {
+            if (auto slot = module_.findSlot(name); slot && module_.getSlot(*slot).function)
+            {
+                slots.push_back(*slot);
+                // None of them may be called directly until it has been compiled again.
+                jit_.define(*slot, nullptr);
+            }
+        }
+
+        bool ok = true;
+        std::vector<std::pair<uint32_t, std::unique_ptr<AST::FunctionAST>>> pending;
+        for (uint32_t slot : slots)
+        {
+            auto optimized = optimizer_.optimize(*module_.getSlot(slot).function);
+            if (module_.getSlot(slot).name == names.front())
+            {
+                opt_stats_ = optimizer_.stats();
+            }
+            auto code = compiler_.compile(*optimized);
+            if (code)
+            {
+                vm_.define(slot, std::move(code));
+                pending.emplace_back(slot, std::move(optimized));
+            }
+            else
+            {
+                vm_.undefine(slot);
+                ok = false;
+                if (failed)
+                {
+                    failed->push_back(slot);
+                }
+            }
+        }
+
+        // A callee can only be called directly once it has code, so keep going while any definition compiles.
+        bool progress = true;
+        while (progress)
+        {
+            progress = false;
+            for (auto &entry : pending)
+            {
+                if (!entry.second)
+                {
+                    continue;
+                }
+                if (void *native = jit_.compile(*entry.second))
+                {
+                    jit_.define(entry.first, native);
+                    entry.second.reset();
+                    progress = true;
+                }
+            }
+        }
+        return ok;
+    }
+
+    Module module_;
+    Optimizer optimizer_{module_};
+    BytecodeCompiler compiler_{module_};
+    VM vm_{module_};
+    JIT jit_{module_};
+    CallGraph graph_;
+    std::vector<Optimizer::PassStats> opt_stats_;
+};
+
+#endif // SESSION_HPP
@@ -0,0 +1,81 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fmt/core.h>
+
+//-----------------------
+// Statistics
+//-----------------------
+
+// Counters and phase timers for the lexer, parser and main loop. They are only compiled in when KALEIDOSCOPE_STATS
+// is defined (configure with -DKALEIDOSCOPE_STATS=ON); otherwise STATS_ADD and PhaseTimer cost nothing.
+
+// Stats - What the current thread has done so far.
+struct Stats
+{
+    uint64_t tokens = 0;       // Tokens returned by Lexer, end of input included.
+    uint64_t bytes = 0;        // Input bytes handed to Lexer.
+    uint64_t nodes = 0;        // Expression nodes built by Parser.
+    uint64_t items = 0;        // Top-level items Parser was asked for.
+    uint64_t arena_blocks = 0; // Blocks malloc'd by arenas.
+    uint64_t parse_ns = 0;     // Main loop: parsing items.
+    uint64_t eval_ns = 0;      // Main loop: defining and evaluating them.
+
+    Stats &operator+=(const Stats &other)
+    {
+        tokens += other.tokens;
+        bytes += other.bytes;
+        nodes += other.nodes;
+        items += other.items;
+        arena_blocks += other.arena_blocks;
+        parse_ns += other.parse_ns;
+        eval_ns += other.eval_ns;
+        return *this;
+    }
+
+    void print(FILE *out) const
+    {
+        fmt::print(out, "stats: {} bytes, {} tokens, {} items, {} nodes, {} arena blocks\n", bytes, tokens, items,
+                   nodes, arena_blocks);
+        fmt::print(out, "stats: parse {:.3f} ms, eval {:.3f} ms\n", parse_ns / 1e6, eval_ns / 1e6);
+    }
+};
+
+// stats - Per thread, so that counting needs no synchronization. Threads that work for another add their counts
+// to its stats() when they are done, as ParallelParser's workers do when they are joined.
+inline Stats &stats()
+{
+    static thread_local Stats thread_stats;
+    return thread_stats;
+}
+
+#ifdef KALEIDOSCOPE_STATS
+#define STATS_ADD(field, n) (stats().field += (n))
+#else
+#define STATS_ADD(field, n) ((void)0)
+#endif
+
+// PhaseTimer - Adds the time until it goes out of scope to one of the _ns fields.
+class PhaseTimer
+{
+public:
+#ifdef KALEIDOSCOPE_STATS
+    explicit PhaseTimer(uint64_t Stats::*field) : field_{field}, start_{std::chrono::steady_clock::now()} {}
+    ~PhaseTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        stats().*field_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+private:
+    uint64_t Stats::*field_;
+    std::chrono::steady_clock::time_point start_;
+#else
+    explicit PhaseTimer(uint64_t Stats::*) {}
+#endif
+};
+
+#endif // STATS_HPP
@@ -0,0 +1,126 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+
+//-----------------------
+// Symbols
+//-----------------------
+
+// Symbol - A small integer standing for an interned name. Two names are equal exactly when their symbols are, so
+// comparing or hashing a name never touches its characters, and a symbol can index a table directly.
+using Symbol = uint32_t;
+
+// SymbolTable - Interns names, handing out dense symbols in first-seen order.
+// The keywords are interned first so the lexer can recognize them by number. Names live in an arena that is
+// never freed, so the views returned by name() stay valid for the life of the table. Safe to use from several
+// threads: lookups share a lock, and only a name seen for the first time takes it exclusively.
+class SymbolTable
+{
+public:
+    static constexpr Symbol kDef = 0;
+    static constexpr Symbol kExtern = 1;
+    static constexpr Symbol kAnonExpr = 2; // Name of the function wrapping a top-level expression.
+
+    SymbolTable()
+    {
+        intern("def");
+        intern("extern");
+        intern("__anon_expr");
+    }
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    Symbol intern(std::string_view name)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock{mutex_};
+            auto it = index_.find(name);
+            if (it != index_.end())
+            {
+                return it->second;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock{mutex_};
+        auto it = index_.find(name);
+        if (it != index_.end())
+        {
+            return it->second;
+        }
+        std::string_view stored = storage_.copyString(name);
+        Symbol sym = static_cast<Symbol>(names_.size());
+        names_.push_back(stored);
+        index_.emplace(stored, sym);
+        return sym;
+    }
+
+    std::string_view name(Symbol sym) const
+    {
+        std::shared_lock<std::shared_mutex> lock{mutex_};
+        return names_[sym];
+    }
+
+    size_t size() const
+    {
+        std::shared_lock<std::shared_mutex> lock{mutex_};
+        return names_.size();
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    Arena storage_{16 * 1024};
+    std::vector<std::string_view> names_;
+    std::unordered_map<std::string_view, Symbol> index_;
+};
+
+// symbols - The process-wide table. Symbols are shared by every lexer, AST and module.
+inline SymbolTable &symbols()
+{
+    static SymbolTable table;
+    return table;
+}
+
+// SymbolCache - A small direct-mapped cache in front of symbols(), one per lexer. A source uses few distinct
+// names over and over, so lexers running on different threads rarely need the shared table or its lock.
+class SymbolCache
+{
+public:
+    Symbol intern(std::string_view name)
+    {
+        size_t hash = std::hash<std::string_view>{}(name);
+        Entry &entry = entries_[hash & (kEntries - 1)];
+        if (entry.hash != hash || entry.name != name)
+        {
+            entry.sym = symbols().intern(name);
+            entry.name = symbols().name(entry.sym);
+            entry.hash = hash;
+        }
+        return entry.sym;
+    }
+
+private:
+    static constexpr size_t kEntries = 256;
+
+    struct Entry
+    {
+        size_t hash = 0;
+        std::string_view name; // Points into the table, so it outlives the text it was looked up with.
+        Symbol sym = 0;
+    };
+
+    std::array<Entry, kEntries> entries_{};
+};
+
+#endif // SYMBOL_HPP
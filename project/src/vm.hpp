@@ -0,0 +1,243 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "module.hpp"
+
+//-----------------------
+// Register VM
+//-----------------------
+
+// VM - Runs BytecodeFunctions on one flat stack of double registers.
+// A callee's frame starts right after its caller's, and arguments are copied straight into its parameter
+// registers. When built with GCC or Clang, code is direct-threaded: each instruction is rewritten once, at
+// define time, to carry the address of its handler, and handlers jump straight to the next one.
+class VM
+{
+public:
+    explicit VM(const Module &module, size_t stack_size = 1 << 18)
+        : module_{module}, stack_(stack_size) {}
+
+    // define - Bind compiled code to a module slot, replacing what was there.
+    void define(uint32_t slot, std::unique_ptr<BytecodeFunction> fn)
+    {
+        if (slot >= entries_.size())
+        {
+            entries_.resize(slot + 1);
+        }
+        entries_[slot] = std::make_unique<Entry>(thread(std::move(fn)));
+    }
+
+    void undefine(uint32_t slot)
+    {
+        if (slot < entries_.size())
+        {
+            entries_[slot].reset();
+        }
+    }
+
+    const BytecodeFunction *lookup(uint32_t slot) const
+    {
+        return slot < entries_.size() && entries_[slot] ? entries_[slot]->fn.get() : nullptr;
+    }
+
+    // run - Execute fn without binding it to a slot, as for a top-level expression.
+    double run(std::unique_ptr<BytecodeFunction> fn, const double *args)
+    {
+        Entry entry = thread(std::move(fn));
+        return call(entry, args);
+    }
+
+    double call(uint32_t slot, const double *args)
+    {
+        if (slot >= entries_.size() || !entries_[slot])
+        {
+            throw std::runtime_error("call to a function with no compiled code");
+        }
+        return call(*entries_[slot], args);
+    }
+
+private:
+    struct ThreadedInstr
+    {
+        const void *handler;
+        Op op;
+        uint16_t a, b, c;
+    };
+
+    struct Entry
+    {
+        std::unique_ptr<BytecodeFunction> fn;
+        std::vector<ThreadedInstr> code;
+    };
+
+    static constexpr size_t kMaxDepth = 10000;
+
+    Entry thread(std::unique_ptr<BytecodeFunction> fn)
+    {
+        const void *const *labels = dispatchTable();
+        Entry entry;
+        entry.code.reserve(fn->code.size());
+        for (const Instr &in : fn->code)
+        {
+            entry.code.push_back(ThreadedInstr{labels ? labels[static_cast<int>(in.op)] : nullptr, in.op, in.a, in.b, in.c});
+        }
+        entry.fn = std::move(fn);
+        return entry;
+    }
+
+    double call(const Entry &entry, const double *args)
+    {
+        const BytecodeFunction &fn = *entry.fn;
+        if (fn.num_regs > stack_.size())
+        {
+            throw std::runtime_error("stack overflow");
+        }
+        for (size_t i = 0; i < fn.num_params; ++i)
+        {
+            stack_[i] = args[i];
+        }
+        // The outermost call counts, as in TreeEvaluator, so both allow kMaxDepth calls in flight.
+        depth_ = 1;
+        return exec(entry, stack_.data());
+    }
+
+    // dispatchTable - The handler address of every opcode, or nullptr when falling back to a switch.
+    const void *const *dispatchTable() { return static_cast<const void *const *>(execImpl(nullptr, nullptr)); }
+
+    double exec(const Entry &entry, double *regs)
+    {
+        double result;
+        execImpl(&entry, regs, &result);
+        return result;
+    }
+
+    // execImpl - The interpreter loop. Called with a null entry it only reports its dispatch table.
+    const void *execImpl(const Entry *entry, double *regs, double *result = nullptr)
+    {
+#if defined(__GNUC__)
+        static const void *const labels[] = {
+            &&op_loadk, &&op_move, &&op_add, &&op_sub, &&op_mul, &&op_lt, &&op_call, &&op_ret,
+        };
+        if (!entry)
+        {
+            return labels;
+        }
+
+        const BytecodeFunction &fn = *entry->fn;
+        const double *consts = fn.consts.data();
+        const ThreadedInstr *ip = entry->code.data();
+        const ThreadedInstr *in;
+
+#define VM_NEXT() \
+    do            \
+    {             \
+        in = ip++; \
+        goto *in->handler; \
+    } while (0)
+
+        VM_NEXT();
+    op_loadk:
+        regs[in->a] = consts[in->b];
+        VM_NEXT();
+    op_move:
+        regs[in->a] = regs[in->b];
+        VM_NEXT();
+    op_add:
+        regs[in->a] = regs[in->b] + regs[in->c];
+        VM_NEXT();
+    op_sub:
+        regs[in->a] = regs[in->b] - regs[in->c];
+        VM_NEXT();
+    op_mul:
+        regs[in->a] = regs[in->b] * regs[in->c];
+        VM_NEXT();
+    op_lt:
+        regs[in->a] = regs[in->b] < regs[in->c] ? 1.0 : 0.0;
+        VM_NEXT();
+    op_call:
+        regs[in->a] = callOut(fn, *in, regs);
+        VM_NEXT();
+    op_ret:
+        *result = regs[in->a];
+        return nullptr;
+#undef VM_NEXT
+#else
+        if (!entry)
+        {
+            return nullptr;
+        }
+
+        const BytecodeFunction &fn = *entry->fn;
+        const double *consts = fn.consts.data();
+        for (const ThreadedInstr *in = entry->code.data();; ++in)
+        {
+            switch (in->op)
+            {
+            case Op::LoadK: regs[in->a] = consts[in->b]; break;
+            case Op::Move: regs[in->a] = regs[in->b]; break;
+            case Op::Add: regs[in->a] = regs[in->b] + regs[in->c]; break;
+            case Op::Sub: regs[in->a] = regs[in->b] - regs[in->c]; break;
+            case Op::Mul: regs[in->a] = regs[in->b] * regs[in->c]; break;
+            case Op::Lt: regs[in->a] = regs[in->b] < regs[in->c] ? 1.0 : 0.0; break;
+            case Op::Call: regs[in->a] = callOut(fn, *in, regs); break;
+            case Op::Ret: *result = regs[in->a]; return nullptr;
+            }
+        }
+#endif
+    }
+
+    double callOut(const BytecodeFunction &fn, const ThreadedInstr &in, double *regs)
+    {
+        uint32_t slot = fn.callees[in.b];
+        const uint16_t *site = fn.call_args.data() + in.c;
+        size_t nargs = site[0];
+
+        auto const &target = module_.getSlot(slot);
+        if (target.native)
+        {
+            double argv[kMaxNativeArgs];
+            for (size_t i = 0; i < nargs; ++i)
+            {
+                argv[i] = regs[site[1 + i]];
+            }
+            return callNative(target.native, argv, nargs);
+        }
+
+        if (slot >= entries_.size() || !entries_[slot])
+        {
+            throw std::runtime_error("call to a function with no compiled code");
+        }
+        const Entry &callee = *entries_[slot];
+        if (callee.fn->num_params != nargs)
+        {
+            throw std::runtime_error("Incorrect # arguments passed");
+        }
+
+        double *frame = regs + fn.num_regs;
+        if (frame + callee.fn->num_regs > stack_.data() + stack_.size() || ++depth_ > kMaxDepth)
+        {
+            throw std::runtime_error("stack overflow");
+        }
+        for (size_t i = 0; i < nargs; ++i)
+        {
+            frame[i] = regs[site[1 + i]];
+        }
+        double result = exec(callee, frame);
+        --depth_;
+        return result;
+    }
+
+    const Module &module_;
+    std::vector<double> stack_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+    size_t depth_ = 0;
+};
+
+#endif // VM_HPP
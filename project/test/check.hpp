@@ -0,0 +1,114 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/core.h>
+
+#include "ast.hpp"
+#include "parallel_parser.hpp"
+#include "parser.hpp"
+#include "symbol.hpp"
+
+// A minimal harness for the test programs: CHECK reports a failed condition and carries on, and main returns
+// failures() so that ctest sees the result.
+
+inline int &failureCount()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                                               \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (!(cond))                                                                                              \
+        {                                                                                                         \
+            fmt::print(stderr, "{}:{}: CHECK failed: {}\n", __FILE__, __LINE__, #cond);                           \
+            ++failureCount();                                                                                     \
+        }                                                                                                         \
+    } while (0)
+
+inline int failures()
+{
+    if (failureCount())
+    {
+        fmt::print(stderr, "{} check(s) failed\n", failureCount());
+    }
+    return failureCount() ? 1 : 0;
+}
+
+// parseText - Every item of text, as the main loop would parse it.
+inline std::vector<ParsedItem> parseText(std::string_view text)
+{
+    ParallelParser parser{1};
+    parser.installStandardBinops();
+    return parser.parse(text);
+}
+
+// describe - e as an s-expression, and a prototype as its name followed by its arguments.
+inline std::string describe(const AST::ExprAST *e)
+{
+    switch (e->getKind())
+    {
+    case AST::ExprAST::Kind::Number:
+        return fmt::format("{}", static_cast<const AST::NumberExprAST *>(e)->getVal());
+    case AST::ExprAST::Kind::Variable:
+        return std::string(symbols().name(static_cast<const AST::VariableExprAST *>(e)->getName()));
+    case AST::ExprAST::Kind::Binary:
+    {
+        auto bin = static_cast<const AST::BinaryExprAST *>(e);
+        return fmt::format("({} {} {})", bin->getOp(), describe(bin->getLHS()), describe(bin->getRHS()));
+    }
+    case AST::ExprAST::Kind::Call:
+    {
+        auto call = static_cast<const AST::CallExprAST *>(e);
+        std::string s = fmt::format("({}", symbols().name(call->getCallee()));
+        for (auto arg : call->getArgs())
+        {
+            s += " " + describe(arg);
+        }
+        return s + ")";
+    }
+    }
+    return "?";
+}
+
+inline std::string describe(const AST::PrototypeAST &proto)
+{
+    std::string s(symbols().name(proto.getName()));
+    for (Symbol arg : proto.getArgs())
+    {
+        s += fmt::format(" {}", symbols().name(arg));
+    }
+    return s;
+}
+
+// describe - One line per item, enough to tell any two different parses apart.
+inline std::vector<std::string> describe(const std::vector<ParsedItem> &items)
+{
+    std::vector<std::string> lines;
+    for (auto const &item : items)
+    {
+        switch (item.kind)
+        {
+        case ParsedItem::Kind::Definition:
+            lines.push_back("def " + describe(item.function->getProto()) + ": " +
+                            describe(item.function->getBody()));
+            break;
+        case ParsedItem::Kind::Extern:
+            lines.push_back("extern " + describe(*item.proto));
+            break;
+        case ParsedItem::Kind::TopLevelExpr:
+            lines.push_back("expr " + describe(item.function->getBody()));
+            break;
+        case ParsedItem::Kind::Error:
+            lines.push_back("error " + item.message);
+            break;
+        }
+    }
+    return lines;
+}
+
+#endif // CHECK_HPP
@@ -0,0 +1,324 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fmt/core.h>
+
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "check.hpp"
+#include "evaluator.hpp"
+#include "jit.hpp"
+#include "module.hpp"
+#include "session.hpp"
+#include "symbol.hpp"
+#include "vm.hpp"
+
+// Tests that the tree evaluator, the VM, the JIT and the batch evaluator agree on the same definitions: the same
+// values (NaN included), and the same calls failing.
+
+// An extern for the programs to call. Exported from the executable, so that dlsym finds it.
+extern "C" double enginesTestMix(double x, double y)
+{
+    return x * 2 - y;
+}
+
+static constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+static constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// same - Equal, with any NaN equal to any other and 0 distinct from -0.
+static bool same(double a, double b)
+{
+    return std::isnan(a) ? std::isnan(b) : a == b && std::signbit(a) == std::signbit(b);
+}
+
+// Engines - A module and every engine that runs it. After each load every definition is compiled again in slot
+// order, callees before their callers, so nothing calls code compiled against an old binding.
+class Engines
+{
+public:
+    // load - Add or replace the definitions and externs of text.
+    void load(std::string_view text)
+    {
+        for (auto &item : parseText(text))
+        {
+            if (item.kind == ParsedItem::Kind::Definition)
+            {
+                module_.addFunction(std::move(item.function));
+            }
+            else
+            {
+                CHECK(item.kind == ParsedItem::Kind::Extern && module_.addExtern(std::move(item.proto)));
+            }
+        }
+        for (uint32_t slot = 0; slot < module_.numSlots(); ++slot)
+        {
+            jit_.define(slot, nullptr);
+        }
+        for (uint32_t slot = 0; slot < module_.numSlots(); ++slot)
+        {
+            if (auto const &fn = module_.getSlot(slot).function)
+            {
+                auto code = compiler_.compile(*fn);
+                CHECK(code);
+                vm_.define(slot, std::move(code));
+                jit_.define(slot, jit_.compile(*fn));
+            }
+        }
+    }
+
+    bool jitted(std::string_view name) const { return jit_.lookup(slot(name)) != nullptr; }
+
+    // compare - Call name on every row of args with each engine and require the same outcome from all of them.
+    // Returns the tree evaluator's results, nothing for a call that failed. The JIT has no depth limit, so it is
+    // only compared on the calls that succeed.
+    std::vector<std::optional<double>> compare(std::string_view name, const std::vector<std::vector<double>> &rows)
+    {
+        uint32_t f = slot(name);
+        const AST::FunctionAST &fn = *module_.getSlot(f).function;
+        size_t arity = fn.getProto().getArgs().size();
+        TreeEvaluator tree{module_};
+        void *native = jit_.lookup(f);
+
+        std::vector<std::optional<double>> expected;
+        bool any_failed = false;
+        for (auto const &args : rows)
+        {
+            CHECK(args.size() == arity);
+            auto want = attempt([&]() { return tree.call(fn, args.data()); });
+            auto got = attempt([&]() { return vm_.call(f, args.data()); });
+            if (!agree(want, got))
+            {
+                fmt::print(stderr, "{}({}): tree {}, vm {}\n", name, show(args), show(want), show(got));
+            }
+            CHECK(agree(want, got));
+            if (native && want)
+            {
+                double jit = callNative(native, args.data(), arity);
+                if (!same(*want, jit))
+                {
+                    fmt::print(stderr, "{}({}): tree {}, jit {}\n", name, show(args), *want, jit);
+                }
+                CHECK(same(*want, jit));
+            }
+            any_failed |= !want;
+            expected.push_back(want);
+        }
+
+        // The batch evaluator takes the rows as columns, and fails as a whole if any row does.
+        std::vector<std::vector<double>> columns(arity, std::vector<double>(rows.size()));
+        std::vector<const double *> column_ptrs;
+        for (size_t p = 0; p < arity; ++p)
+        {
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                columns[p][i] = rows[i][p];
+            }
+            column_ptrs.push_back(columns[p].data());
+        }
+        std::vector<double> out(rows.size());
+        BatchEvaluator batch{module_};
+        bool batch_failed = !attempt([&]() {
+            batch.evaluate(fn, column_ptrs.data(), rows.size(), out.data());
+            return 0.0;
+        });
+        CHECK(batch_failed == any_failed);
+        for (size_t i = 0; !batch_failed && i < rows.size(); ++i)
+        {
+            if (!same(*expected[i], out[i]))
+            {
+                fmt::print(stderr, "{}({}): tree {}, batch {}\n", name, show(rows[i]), *expected[i], out[i]);
+            }
+            CHECK(same(*expected[i], out[i]));
+        }
+        return expected;
+    }
+
+private:
+    uint32_t slot(std::string_view name) const
+    {
+        auto found = module_.findSlot(symbols().intern(name));
+        CHECK(found);
+        return *found;
+    }
+
+    template <typename Fn>
+    static std::optional<double> attempt(Fn &&fn)
+    {
+        try
+        {
+            return fn();
+        }
+        catch (const std::exception &)
+        {
+            return std::nullopt;
+        }
+    }
+
+    static bool agree(std::optional<double> a, std::optional<double> b)
+    {
+        return a && b ? same(*a, *b) : !a && !b;
+    }
+
+    static std::string show(std::optional<double> v) { return v ? fmt::format("{}", *v) : "error"; }
+
+    static std::string show(const std::vector<double> &args)
+    {
+        std::string text;
+        for (double arg : args)
+        {
+            text += text.empty() ? "" : ", ";
+            text += fmt::format("{}", arg);
+        }
+        return text;
+    }
+
+    Module module_;
+    BytecodeCompiler compiler_{module_};
+    VM vm_{module_};
+    JIT jit_{module_};
+};
+
+// pairs - Every pair of values, as rows of two arguments.
+static std::vector<std::vector<double>> pairs(const std::vector<double> &values)
+{
+    std::vector<std::vector<double>> rows;
+    for (double x : values)
+    {
+        for (double y : values)
+        {
+            rows.push_back({x, y});
+        }
+    }
+    return rows;
+}
+
+static const std::vector<double> kValues = {0.0, -0.0, 1.0, -2.5, 3.0, 1e300, kInf, -kInf, kNaN};
+
+static void lessThanWithNaN()
+{
+    Engines engines;
+    engines.load("def lt(x y) x < y;\n"
+                 "def gt(x y) y < x;\n"
+                 "def ltConst(x y) (x < 1) + (2 < y) * 2;\n"
+                 "def ltSelf(x y) (x < x) + (y - y < 1) * 2;\n"
+                 "def ltNested(x y) (x * y < x + y) * 4 - (x - y < 0);\n"
+                 "def ltMasks(x y) x * (x < y) + y * (y < x);\n");
+    for (auto name : {"lt", "gt", "ltConst", "ltSelf", "ltNested", "ltMasks"})
+    {
+        CHECK(engines.jitted(name) == bool(KALEIDOSCOPE_JIT));
+        engines.compare(name, pairs(kValues));
+    }
+    // NaN compares false either way.
+    auto got = engines.compare("lt", {{kNaN, 1}, {1, kNaN}, {kNaN, kNaN}});
+    CHECK(got.size() == 3 && got[0] == 0.0 && got[1] == 0.0 && got[2] == 0.0);
+}
+
+static void callsBetweenDefinitions()
+{
+    Engines engines;
+    engines.load("def sq(x) x*x;\n"
+                 "def poly(x y) sq(x)*3 + sq(y)*2 - x*y + 1;\n"
+                 "def mix(a b c) poly(a, b) * (a < c) + poly(c, b) * (c < a);\n"
+                 "def f(x y) mix(x, y, x*y) + poly(y - x, x + y) * 0.5;\n");
+    CHECK(engines.jitted("f") == bool(KALEIDOSCOPE_JIT));
+    engines.compare("f", pairs(kValues));
+}
+
+static void callsToExterns()
+{
+    Engines engines;
+    engines.load("extern enginesTestMix(x y);\n"
+                 "def twice(x) x + x;\n"
+                 "def e(x y) enginesTestMix(twice(x), y) * (x < enginesTestMix(y, x)) + twice(y);\n"
+                 "def direct(x y) enginesTestMix(x, y);\n");
+    CHECK(engines.jitted("e") == bool(KALEIDOSCOPE_JIT));
+    auto got = engines.compare("direct", {{3, 4}});
+    CHECK(got.size() == 1 && got[0] == 2.0);
+    engines.compare("direct", pairs(kValues));
+    engines.compare("e", pairs(kValues));
+}
+
+// chain - A definition that makes n nested calls, down to d0, and returns n.
+static std::string chain(size_t n)
+{
+    std::string text = "def d0(x) x;\n";
+    for (size_t i = 1; i <= n; ++i)
+    {
+        text += fmt::format("def d{}(x) d{}(x) + 1;\n", i, i - 1);
+    }
+    return text;
+}
+
+static void deepRecursion()
+{
+    // Both interpreters allow 10000 calls in flight: the outermost and 9999 nested ones.
+    Engines engines;
+    engines.load(chain(10000));
+    auto got = engines.compare("d9999", {{0}, {0.5}, {kNaN}});
+    CHECK(got.size() == 3 && got[0] == 9999 && got[1] == 9999.5 && got[2] && std::isnan(*got[2]));
+    got = engines.compare("d10000", {{0}});
+    CHECK(got.size() == 1 && !got[0]);
+
+    // Recursion without a base case runs out in each of them.
+    engines.load("def forever(x) forever(x + 1);\n"
+                 "def mutual(x) other(x) + 1;\n"
+                 "def other(x) mutual(x * 2);\n");
+    got = engines.compare("forever", {{0}});
+    CHECK(got.size() == 1 && !got[0]);
+    got = engines.compare("mutual", {{1}});
+    CHECK(got.size() == 1 && !got[0]);
+}
+
+static void redefinitionAfterAJittedCaller()
+{
+    Engines engines;
+    engines.load("def f(x) x + 1;\n"
+                 "def g(x y) f(x) * f(y) + (x < y);\n");
+    CHECK(engines.jitted("g") == bool(KALEIDOSCOPE_JIT));
+    auto got = engines.compare("g", {{2, 3}});
+    CHECK(got.size() == 1 && got[0] == 13);
+    engines.load("def f(x) x * 10;\n");
+    got = engines.compare("g", {{2, 3}});
+    CHECK(got.size() == 1 && got[0] == 601);
+    engines.compare("g", pairs(kValues));
+
+    // The session recompiles only what depends on f, and runs expressions through the JIT where it can; they
+    // must see the new f as the tree evaluator over its module does.
+    Session session;
+    for (auto text : {"def f(x) x + 1;", "def g(x y) f(x) * f(y) + (x < y);", "def h(x) g(x, x + 1) - f(x);",
+                      "def f(x) x * 10;"})
+    {
+        auto items = parseText(text);
+        CHECK(items.size() == 1 && session.define(std::move(items[0].function)));
+    }
+    TreeEvaluator tree{session.module()};
+    for (auto text : {"g(2, 3);", "h(2);", "h(0 - 2) + g(1, 0);"})
+    {
+        auto items = parseText(text);
+        CHECK(items.size() == 1 && items[0].kind == ParsedItem::Kind::TopLevelExpr);
+        auto want = tree.call(*items[0].function, nullptr);
+        auto got = session.evaluate(*items[0].function);
+        if (!got || !same(want, *got))
+        {
+            fmt::print(stderr, "{} tree {}, session {}\n", text, want, got ? fmt::format("{}", *got) : "error");
+        }
+        CHECK(got && same(want, *got));
+    }
+}
+
+int main()
+{
+    lessThanWithNaN();
+    callsBetweenDefinitions();
+    callsToExterns();
+    deepRecursion();
+    redefinitionAfterAJittedCaller();
+    return failures();
+}
@@ -0,0 +1,215 @@
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "optimizer.hpp"
+#include "session.hpp"
+
+// Tests that the optimizer never changes how often an extern is called.
+
+// An extern with a side effect the tests can see. Exported from the executable, so that dlsym finds it.
+static int counted_calls = 0;
+extern "C" double optimizerTestCount(double x)
+{
+    ++counted_calls;
+    return x;
+}
+
+// run - Define, declare and evaluate every item of text in session. Returns the value of the last expression.
+static std::optional<double> run(Session &session, std::string_view text)
+{
+    std::optional<double> result;
+    for (auto &item : parseText(text))
+    {
+        switch (item.kind)
+        {
+        case ParsedItem::Kind::Definition:
+            CHECK(session.define(std::move(item.function)));
+            break;
+        case ParsedItem::Kind::Extern:
+            CHECK(session.declareExtern(std::move(item.proto)));
+            break;
+        case ParsedItem::Kind::TopLevelExpr:
+            result = session.evaluate(*item.function);
+            break;
+        case ParsedItem::Kind::Error:
+            CHECK(!"parse error");
+            break;
+        }
+    }
+    return result;
+}
+
+// optimizeLast - The optimized body of the last definition in text, after defining everything before it.
+static const AST::ExprAST *optimizeLast(Session &session, std::string_view text, Optimizer::Options options,
+                                        std::unique_ptr<AST::FunctionAST> &out)
+{
+    auto items = parseText(text);
+    CHECK(!items.empty() && items.back().kind == ParsedItem::Kind::Definition);
+    auto last = std::move(items.back().function);
+    items.pop_back();
+    for (auto &item : items)
+    {
+        if (item.kind == ParsedItem::Kind::Definition)
+        {
+            CHECK(session.define(std::move(item.function)));
+        }
+        else if (item.kind == ParsedItem::Kind::Extern)
+        {
+            CHECK(session.declareExtern(std::move(item.proto)));
+        }
+    }
+    Optimizer optimizer{session.module(), options};
+    out = optimizer.optimize(*last);
+    return out->getBody();
+}
+
+static void unusedArgumentIsStillEvaluated()
+{
+    Session session;
+    counted_calls = 0;
+    auto result = run(session, "extern optimizerTestCount(x);\n"
+                               "def ignore(x) 1;\n"
+                               "ignore(optimizerTestCount(65));\n");
+    CHECK(result && *result == 1);
+    CHECK(counted_calls == 1);
+}
+
+static void argumentUsedTwiceIsEvaluatedOnce()
+{
+    Session session;
+    counted_calls = 0;
+    auto result = run(session, "extern optimizerTestCount(x);\n"
+                               "def double(x) x + x;\n"
+                               "double(optimizerTestCount(2));\n");
+    CHECK(result && *result == 4);
+    CHECK(counted_calls == 1);
+}
+
+static void callsReachingAnExternAreNotMerged()
+{
+    Optimizer::Options options;
+    options.inline_calls = false;
+    Session session{options};
+    counted_calls = 0;
+    auto result = run(session, "extern optimizerTestCount(x);\n"
+                               "def wrap(x) optimizerTestCount(x);\n"
+                               "def outer(x) wrap(x);\n"
+                               "outer(1) + outer(1);\n");
+    CHECK(result && *result == 2);
+    CHECK(counted_calls == 2);
+}
+
+static void pureCallsAreStillMerged()
+{
+    Optimizer::Options options;
+    options.inline_calls = false;
+    Session session{options};
+    std::unique_ptr<AST::FunctionAST> fn;
+    auto body = optimizeLast(session, "def sq(x) x * x;\n"
+                                      "def f(a) sq(a) + sq(a);\n",
+                             options, fn);
+    CHECK(body->getKind() == AST::ExprAST::Kind::Binary);
+    auto bin = static_cast<const AST::BinaryExprAST *>(body);
+    CHECK(bin->getLHS() == bin->getRHS());
+}
+
+static void inlineStillSplicesPureArguments()
+{
+    Session session;
+    std::unique_ptr<AST::FunctionAST> fn;
+    auto body = optimizeLast(session, "def ignore(x) 1;\n"
+                                      "def f(a) ignore(a * 2);\n",
+                             Optimizer::Options{}, fn);
+    CHECK(body->getKind() == AST::ExprAST::Kind::Number);
+}
+
+static void multiplyByZeroKeepsExternCalls()
+{
+    Optimizer::Options options;
+    options.finite_math = true;
+    options.no_signed_zeros = true;
+    Session session{options};
+    counted_calls = 0;
+    auto result = run(session, "extern optimizerTestCount(x);\n"
+                               "optimizerTestCount(3) * 0;\n");
+    CHECK(result && *result == 0);
+    CHECK(counted_calls == 1);
+}
+
+static void subtractingEqualOperandsFolds()
+{
+    Optimizer::Options options;
+    options.finite_math = true;
+    options.no_signed_zeros = true;
+    Session session{options};
+    std::unique_ptr<AST::FunctionAST> fn;
+    auto body = optimizeLast(session, "def f(a b) (a * b + 1) - (a * b + 1);\n", options, fn);
+    CHECK(body->getKind() == AST::ExprAST::Kind::Number &&
+          static_cast<const AST::NumberExprAST *>(body)->getVal() == 0);
+
+    // Not without the options, and not for different operands.
+    Session strict;
+    body = optimizeLast(strict, "def f(a) a - a;\n", Optimizer::Options{}, fn);
+    CHECK(body->getKind() == AST::ExprAST::Kind::Binary);
+    body = optimizeLast(session, "def f(a b) (a * b) - (b * a);\n", options, fn);
+    CHECK(body->getKind() == AST::ExprAST::Kind::Binary);
+}
+
+static void subtractingExternCallsDoesNotFold()
+{
+    Optimizer::Options options;
+    options.finite_math = true;
+    options.no_signed_zeros = true;
+    Session session{options};
+    counted_calls = 0;
+    auto result = run(session, "extern optimizerTestCount(x);\n"
+                               "optimizerTestCount(5) - optimizerTestCount(5);\n");
+    CHECK(result && *result == 0);
+    CHECK(counted_calls == 2);
+}
+
+static void inliningGrowthIsBounded()
+{
+    // Every level calls the one below eight times, and each body is under the inline threshold: inlined all the
+    // way down, a8 would have 8^8 leaves.
+    Session session;
+    std::string text = "def a0() 1;\n";
+    for (int level = 1; level <= 8; ++level)
+    {
+        text += fmt::format("def a{}() a{}()", level, level - 1);
+        for (int i = 1; i < 8; ++i)
+        {
+            text += fmt::format(" + a{}()", level - 1);
+        }
+        text += ";\n";
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto &item : parseText(text))
+    {
+        CHECK(session.define(std::move(item.function)));
+        auto const &inlined = session.optStats().front();
+        CHECK(inlined.after <= inlined.before + Optimizer::Options{}.inline_budget);
+    }
+    CHECK(run(session, "a8();\n") == 16777216);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+}
+
+int main()
+{
+    unusedArgumentIsStillEvaluated();
+    argumentUsedTwiceIsEvaluatedOnce();
+    callsReachingAnExternAreNotMerged();
+    pureCallsAreStillMerged();
+    inlineStillSplicesPureArguments();
+    multiplyByZeroKeepsExternCalls();
+    subtractingEqualOperandsFolds();
+    subtractingExternCallsDoesNotFold();
+    inliningGrowthIsBounded();
+    return failures();
+}
@@ -0,0 +1,103 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/core.h>
+
+#include "check.hpp"
+#include "lexer.hpp"
+#include "parallel_parser.hpp"
+#include "parser.hpp"
+
+// Tests that the items, errors included, do not depend on how many threads parse the input.
+
+// parseSequential - Every item of text from one Parser over all of it, as the main loop reads a file.
+static std::vector<ParsedItem> parseSequential(std::string_view text)
+{
+    std::vector<ParsedItem> items;
+    MemorySource source{text};
+    Lexer lexer{source};
+    Parser parser{lexer};
+    parser.installStandardBinops();
+    parser.setDiagnosticSink([&items](std::string_view message) {
+        ParsedItem error{};
+        error.kind = ParsedItem::Kind::Error;
+        error.message = std::string(message);
+        items.push_back(std::move(error));
+    });
+    parser.getNextToken();
+    while (parser.curTok() != static_cast<int>(Token::tok_eof))
+    {
+        if (parser.curTok() == ';')
+        {
+            parser.getNextToken();
+            continue;
+        }
+        ParsedItem item = parser.parseItem();
+        if (item.parsed())
+        {
+            items.push_back(std::move(item));
+        }
+        else
+        {
+            parser.recover();
+        }
+    }
+    return items;
+}
+
+// program - Enough items for many chunks, with a syntax error after every other definition, so that chunks are
+// cut right after some of them. Several errors are cut off by the next definition.
+static std::string program()
+{
+    static const char *const kErrors[] = {
+        "foo(1, 2\n",
+        "def (x) x;\n",
+        "extern 5;\n",
+        ") + 1;\n",
+        "def g(x y) x + ;\n",
+        "def h(x\n",
+        "(1 + 2\n",
+        "foo(1, 2 extern bar(a);\n",
+    };
+    std::string text;
+    for (int i = 0; i < 20000; ++i)
+    {
+        text += fmt::format("def f{}(a b) a * {} + b;\n", i, i);
+        if (i % 2 == 1)
+        {
+            text += kErrors[i / 2 % (sizeof(kErrors) / sizeof(kErrors[0]))];
+        }
+        if (i % 5 == 0)
+        {
+            text += fmt::format("f{}(2, 3)\n", i);
+        }
+    }
+    return text;
+}
+
+static void itemsDoNotDependOnTheJobs()
+{
+    std::string text = program();
+    auto expected = describe(parseSequential(text));
+    CHECK(expected.size() > 20000);
+    for (size_t jobs : {1, 2, 8})
+    {
+        ParallelParser parser{jobs};
+        parser.installStandardBinops();
+        auto got = describe(parser.parse(text));
+        CHECK(got == expected);
+    }
+}
+
+static void definitionAfterAnErrorIsKept()
+{
+    auto got = describe(parseSequential("foo(1, 2\ndef f(x) x;\nf(3);\n"));
+    CHECK(got.size() == 3 && got[1] == "def f x: x" && got[2] == "expr (f 3)");
+}
+
+int main()
+{
+    itemsDoNotDependOnTheJobs();
+    definitionAfterAnErrorIsKept();
+    return failures();
+}
@@ -0,0 +1,80 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "push_parser.hpp"
+
+// Tests that the push parser produces the same items as the pull parser however its input is chunked.
+
+// pushText - Every item of text, fed to a PushParser chunk bytes at a time.
+static std::vector<ParsedItem> pushText(std::string_view text, size_t chunk,
+                                        size_t max_pending = PushParser::kDefaultMaxPendingTokens)
+{
+    PushParser parser{max_pending};
+    parser.parser().installStandardBinops();
+    std::vector<ParsedItem> items;
+    for (size_t i = 0; i < text.size(); i += chunk)
+    {
+        parser.feed(text.substr(i, chunk), items);
+    }
+    parser.finish(items);
+    return items;
+}
+
+static const char *const kProgram = "# Multi-character tokens, comments and numbers split at every offset.\n"
+                                    "extern sin(angle);\n"
+                                    "def fib(number) # a comment after code\n"
+                                    "  fib(number - 1.5) + fib(number - 2.25) * 1000;\n"
+                                    ";;\n"
+                                    "def average(first second third)\n"
+                                    "  (first + second + third) * 3;\n"
+                                    "average(fib(10), sin(0.5), 123456.789);\n"
+                                    "extern cos(x) def twice(x) x + x\n"
+                                    "twice(cos(twice(4)))\n"
+                                    "# an unterminated comment at the very end";
+
+static void chunkingDoesNotChangeTheItems()
+{
+    auto expected = describe(parseText(kProgram));
+    CHECK(expected.size() == 7);
+    for (size_t chunk : {1, 7, 4096})
+    {
+        auto got = describe(pushText(kProgram, chunk));
+        CHECK(got == expected);
+    }
+}
+
+static void overlongTokenIsDropped()
+{
+    std::string text = "def f(x) x;\n" + std::string(PushLexer::kMaxTokenBytes + 1000, 'a') + ";\ndef g(y) y;\n";
+    for (size_t chunk : {1, 7, 4096})
+    {
+        auto got = describe(pushText(text, chunk));
+        CHECK(got == (std::vector<std::string>{"def f x: x", "def g y: y"}));
+    }
+}
+
+static void overlongItemIsSkipped()
+{
+    std::string text = "def f(x) x;\ndef long(x) x";
+    for (int i = 0; i < 100; ++i)
+    {
+        text += " + x";
+    }
+    text += ";\ndef g(y) y;\n";
+    // Only small chunks: an item that arrives whole is parsed before the cap is checked.
+    for (size_t chunk : {1, 7})
+    {
+        auto got = describe(pushText(text, chunk, 64));
+        CHECK(got == (std::vector<std::string>{"def f x: x", "def g y: y"}));
+    }
+}
+
+int main()
+{
+    chunkingDoesNotChangeTheItems();
+    overlongTokenIsDropped();
+    overlongItemIsSkipped();
+    return failures();
+}
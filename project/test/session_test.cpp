@@ -0,0 +1,71 @@
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "check.hpp"
+#include "session.hpp"
+
+// Tests that redefining a name rebinds everything compiled against it, or nothing when it or a caller does not
+// compile.
+
+// define - Define the single definition in text. Returns what Session::define does.
+static bool define(Session &session, std::string_view text)
+{
+    auto items = parseText(text);
+    CHECK(items.size() == 1 && items[0].kind == ParsedItem::Kind::Definition);
+    return session.define(std::move(items[0].function));
+}
+
+static std::optional<double> evaluate(Session &session, std::string_view text)
+{
+    auto items = parseText(text);
+    CHECK(items.size() == 1 && items[0].kind == ParsedItem::Kind::TopLevelExpr);
+    return session.evaluate(*items[0].function);
+}
+
+static void redefinitionReachesCallers()
+{
+    Session session;
+    CHECK(define(session, "def f(x) x + 1;"));
+    CHECK(define(session, "def g(x) f(x) * 2;"));
+    CHECK(evaluate(session, "g(3);") == 8);
+    CHECK(define(session, "def f(x) x + 10;"));
+    CHECK(!session.optStats().empty());
+    CHECK(evaluate(session, "f(3);") == 13);
+    CHECK(evaluate(session, "g(3);") == 26);
+}
+
+static void failedRedefinitionKeepsTheOldOne()
+{
+    Session session;
+    CHECK(define(session, "def f(x) x + 1;"));
+    CHECK(define(session, "def g(x) f(x) * 2;"));
+    CHECK(!define(session, "def f(x) unknownFunction(x);"));
+    CHECK(evaluate(session, "f(3);") == 4);
+    CHECK(evaluate(session, "g(3);") == 8);
+}
+
+static void redefinitionThatBreaksACallerIsRefused()
+{
+    Session session;
+    CHECK(define(session, "def f(x) x + 1;"));
+    CHECK(define(session, "def g(x) f(x) * 2;"));
+    CHECK(define(session, "def h(x) g(x) + 1;"));
+    // g calls f with one argument.
+    CHECK(!define(session, "def f(x y) x + y;"));
+    CHECK(evaluate(session, "f(3);") == 4);
+    CHECK(evaluate(session, "g(3);") == 8);
+    CHECK(evaluate(session, "h(3);") == 9);
+    // Once g no longer calls f, nothing stands in the way.
+    CHECK(define(session, "def g(x) x;"));
+    CHECK(define(session, "def f(x y) x + y;"));
+    CHECK(evaluate(session, "f(3, 4);") == 7);
+}
+
+int main()
+{
+    redefinitionReachesCallers();
+    failedRedefinitionKeepsTheOldOne();
+    redefinitionThatBreaksACallerIsRefused();
+    return failures();
+}